@@ -0,0 +1,676 @@
+#define _GNU_SOURCE
+#include "efd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sched.h>
+
+// Message tags understood by the bench child (first payload byte)
+#define TAG_PING 'P'   // Echo the full payload back
+#define TAG_STREAM 'S' // Consume silently
+#define TAG_END 'E'    // Echo one byte, marks the end of a stream run
+#define TAG_TRACE 'T'  // Reply with the child's stage summary, then reset its counters
+
+#define MIN_PAYLOAD 8
+#define BATCH 16       // Messages per shm_parent_send_batch with -api batch
+#define MAX_SAMPLES 1000000
+#define MAX_PIN_CPUS 64
+
+// Send call under test
+typedef enum {
+    API_DATA,  // shm_parent_send_data
+    API_BATCH, // shm_parent_send_batch, BATCH messages per call when streaming
+    API_ZC     // shm_parent_send_reserve/commit, the payload is left in place
+} bench_api_t;
+
+typedef struct {
+    shm_mode_t channel_mode;
+    bench_api_t api;
+    int echo;          // The child is a bench child that answers pings
+    uint32_t spin;
+    unsigned mem_flags;
+    unsigned uring_flags;
+    int futex;
+    int stats;         // Print the library's per-direction counters per SHM size
+    int trace;         // Print a per-stage latency breakdown per case
+    int parent_cpus[MAX_PIN_CPUS];
+    int n_parent_cpus;
+    int child_cpus[MAX_PIN_CPUS];
+    int n_child_cpus;
+    int numa_node;
+    size_t slot_size;  // SHM_MODE_SLOTS, 0 for the library default
+    size_t nt_copy;    // Non-temporal copy threshold, both sides
+    size_t compress;   // LZ4 threshold, both sides, 0 for off
+    size_t iters;      // Upper bound on messages per case
+    size_t bytes;      // Upper bound on payload bytes per case
+    size_t max_payload;
+} bench_opts_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(const uint64_t *sorted, size_t n, double q) {
+    size_t idx = (size_t)(q * (double)(n - 1) + 0.5);
+    return (double)sorted[idx] / 1000.0;
+}
+
+// Percentiles of one stage, as the child reports them to the parent.
+typedef struct {
+    uint64_t count;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+} stage_summary_t;
+
+typedef struct {
+    uint8_t tag;
+    stage_summary_t send[SHM_STAGES];
+    stage_summary_t recv[SHM_STAGES];
+} trace_reply_t;
+
+static void summarize_stages(const shm_dir_stats_t *d, stage_summary_t *out) {
+    for (int i = 0; i < SHM_STAGES; i++) {
+        const shm_hist_t *h = &d->stage_ns[i];
+        out[i].count = h->count;
+        out[i].p50_ns = shm_hist_percentile(h, 50);
+        out[i].p99_ns = shm_hist_percentile(h, 99);
+        out[i].p999_ns = shm_hist_percentile(h, 99.9);
+    }
+}
+
+static const char* mode_name(shm_mode_t mode) {
+    switch (mode) {
+    case SHM_MODE_RING: return "ring";
+    case SHM_MODE_SLOTS: return "slots";
+    case SHM_MODE_AUTO: return "auto";
+    default: return "standard";
+    }
+}
+
+static const char* api_name(bench_api_t api) {
+    switch (api) {
+        case API_BATCH: return "batch";
+        case API_ZC: return "zc";
+        default: return "data";
+    }
+}
+
+// Sends n copies of buf through the API under test. A zero-copy producer
+// builds its message in the reserved region, so only the tag is written.
+static int bench_send(shm_parent_t *p, const bench_opts_t *o, uint8_t *buf, size_t payload, int n) {
+    if (o->api == API_BATCH) {
+        struct iovec msgs[BATCH];
+        for (int i = 0; i < n; i++) msgs[i] = (struct iovec){ .iov_base = buf, .iov_len = payload };
+        return shm_parent_send_batch(p, msgs, n);
+    }
+    for (int i = 0; i < n; i++) {
+        if (o->api == API_ZC) {
+            uint8_t *dst = shm_parent_send_reserve(p, payload);
+            if (!dst) return -1;
+            dst[0] = buf[0];
+            if (shm_parent_send_commit(p, payload) != 0) return -1;
+        } else if (shm_parent_send_data(p, buf, payload) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void print_header(void) {
+    printf("%-10s %-10s %-6s %8s %12s %9s %9s %9s %9s\n",
+           "shm_size", "payload", "test", "msgs", "msgs/s", "GB/s", "p50_us", "p99_us", "p999_us");
+}
+
+static void report(size_t shm_size, size_t payload, const char *test,
+                   uint64_t *lat, size_t n, uint64_t elapsed_ns) {
+    qsort(lat, n, sizeof(uint64_t), cmp_u64);
+    double secs = (double)elapsed_ns / 1e9;
+    printf("%-10zu %-10zu %-6s %8zu %12.0f %9.3f %9.2f %9.2f %9.2f\n",
+           shm_size, payload, test, n, (double)n / secs,
+           (double)n * (double)payload / secs / 1e9,
+           percentile_us(lat, n, 0.50), percentile_us(lat, n, 0.99), percentile_us(lat, n, 0.999));
+    fflush(stdout);
+}
+
+static void print_stage(const char *name, const stage_summary_t *st) {
+    if (st->count == 0) {
+        printf(" %s=-", name);
+        return;
+    }
+    printf(" %s=%.2f/%.2f/%.2f", name, st->p50_ns / 1e3, st->p99_ns / 1e3, st->p999_ns / 1e3);
+}
+
+// One direction in the order a message goes through it: the sender's
+// copy and signal, the receiver's wakeup and handler, then the ack.
+static void print_trace_dir(size_t shm_size, size_t payload, const char *test, const char *dir,
+                            const stage_summary_t *send, const stage_summary_t *recv) {
+    printf("# trace %zu %zu %s %s", shm_size, payload, test, dir);
+    print_stage("copy", &send[SHM_STAGE_COPY]);
+    print_stage("signal", &send[SHM_STAGE_SIGNAL]);
+    print_stage("wake", &recv[SHM_STAGE_WAKE]);
+    print_stage("handler", &recv[SHM_STAGE_HANDLER]);
+    print_stage("ack", &send[SHM_STAGE_ACK]);
+    printf("\n");
+}
+
+// Per-stage p50/p99/p99.9 in microseconds for the case just reported,
+// from the parent's counters and the child's (fetched with TAG_TRACE),
+// which both start over for the next case.
+static int report_trace(shm_parent_t *p, const bench_opts_t *o, size_t payload, const char *test) {
+    shm_stats_t st;
+    shm_parent_get_stats(p, &st);
+    stage_summary_t send[SHM_STAGES], recv[SHM_STAGES];
+    summarize_stages(&st.send, send);
+    summarize_stages(&st.recv, recv);
+
+    // Slots may be too small for the reply; the child's stages show as -
+    trace_reply_t child;
+    memset(&child, 0, sizeof(child));
+    if (o->echo && shm_parent_max_message(p) >= sizeof(child)) {
+        uint8_t tag = TAG_TRACE;
+        const uint8_t *reply;
+        size_t len;
+        if (shm_parent_send_data(p, &tag, 1) != 0) return -1;
+        if (shm_parent_read_begin(p, &reply, &len) != 0) return -1;
+        if (len == sizeof(child)) memcpy(&child, reply, sizeof(child));
+        if (shm_parent_read_end(p) != 0) return -1;
+    }
+
+    print_trace_dir(p->shm_size, payload, test, "p2c", send, child.recv);
+    print_trace_dir(p->shm_size, payload, test, "c2p", child.send, recv);
+    fflush(stdout);
+    shm_parent_reset_stats(p);
+    return 0;
+}
+
+// Round trip per message: echo from a bench child, ack from any other child.
+static int run_pingpong(shm_parent_t *p, const bench_opts_t *o, uint8_t *buf,
+                        size_t payload, size_t iters, uint64_t *lat) {
+    buf[0] = TAG_PING;
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < iters; i++) {
+        uint64_t t0 = now_ns();
+        if (bench_send(p, o, buf, payload, 1) != 0) return -1;
+        if (o->echo) {
+            const uint8_t *reply;
+            size_t len;
+            if (shm_parent_read_begin(p, &reply, &len) != 0) return -1;
+            if (shm_parent_read_end(p) != 0) return -1;
+        }
+        lat[i] = now_ns() - t0;
+    }
+
+    report(p->shm_size, payload, "ping", lat, iters, now_ns() - start);
+    return o->trace ? report_trace(p, o, payload, "ping") : 0;
+}
+
+// Back-to-back sends; latency is the time spent inside each send call,
+// shared out evenly over the messages of a batch.
+static int run_stream(shm_parent_t *p, const bench_opts_t *o, uint8_t *buf,
+                      size_t payload, size_t iters, uint64_t *lat) {
+    buf[0] = TAG_STREAM;
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < iters;) {
+        int n = o->api == API_BATCH && iters - i >= BATCH ? BATCH : 1;
+        uint64_t t0 = now_ns();
+        if (bench_send(p, o, buf, payload, n) != 0) return -1;
+        uint64_t per = (now_ns() - t0) / (uint64_t)n;
+        for (int k = 0; k < n; k++) lat[i++] = per;
+    }
+
+    // Ring sends return before the child has read anything
+    if (o->echo) {
+        const uint8_t *reply;
+        size_t len;
+        uint8_t end = TAG_END;
+        if (shm_parent_send_data(p, &end, 1) != 0) return -1;
+        if (shm_parent_read_begin(p, &reply, &len) != 0) return -1;
+        if (shm_parent_read_end(p) != 0) return -1;
+    }
+
+    report(p->shm_size, payload, "stream", lat, iters, now_ns() - start);
+    return o->trace ? report_trace(p, o, payload, "stream") : 0;
+}
+
+// Foreign children print what they receive; keep that off our report.
+static int start_quiet(shm_parent_t *p) {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (saved == -1 || devnull == -1) return -1;
+
+    dup2(devnull, STDOUT_FILENO);
+    int ret = shm_parent_start(p);
+    dup2(saved, STDOUT_FILENO);
+
+    close(devnull);
+    close(saved);
+    return ret;
+}
+
+static void print_dir_stats(size_t shm_size, const char *dir, const shm_dir_stats_t *d) {
+    const shm_hist_t *h = &d->latency_ns;
+    printf("# stats %zu %-4s msgs=%lu bytes=%lu too_large=%lu spin=%lu blocks=%lu blocked_ms=%.1f"
+           " timeouts=%lu dropped=%lu lat_us p50=%.2f p99=%.2f p99.9=%.2f max=%.2f\n",
+           shm_size, dir, d->msgs, d->bytes, d->too_large, d->spin_wakeups, d->blocks, d->blocked_ns / 1e6,
+           d->timeouts, d->dropped,
+           shm_hist_percentile(h, 50) / 1e3, shm_hist_percentile(h, 99) / 1e3,
+           shm_hist_percentile(h, 99.9) / 1e3, h->max / 1e3);
+}
+
+static int run_shm_size(const char *child_path, size_t shm_size, const bench_opts_t *o) {
+    shm_parent_t *p = shm_parent_new(child_path, shm_size);
+    if (!p) return -1;
+    if (shm_parent_set_mode(p, o->channel_mode) != 0) {
+        fprintf(stderr, "[Bench] SHM size %zu too small for this mode\n", shm_size);
+        shm_parent_close(p);
+        return 0;
+    }
+    if (o->slot_size && shm_parent_set_slot_size(p, o->slot_size) != 0) {
+        fprintf(stderr, "[Bench] Invalid slot size %zu\n", o->slot_size);
+        shm_parent_close(p);
+        return -1;
+    }
+    shm_parent_set_spin(p, o->spin);
+    shm_parent_set_futex(p, o->futex);
+    shm_parent_set_stats(p, (o->stats ? SHM_STATS_LATENCY : 0) | (o->trace ? SHM_STATS_TRACE : 0));
+    if (shm_parent_set_compress(p, o->compress) != 0) {
+        fprintf(stderr, "[Bench] Compression is not available in this mode\n");
+        shm_parent_close(p);
+        return -1;
+    }
+    if (shm_parent_set_affinity(p, o->parent_cpus, o->n_parent_cpus, o->child_cpus, o->n_child_cpus) != 0 ||
+        shm_parent_set_numa_node(p, o->numa_node) != 0) {
+        fprintf(stderr, "[Bench] Invalid CPU or NUMA node\n");
+        shm_parent_close(p);
+        return -1;
+    }
+    shm_parent_set_mem_flags(p, o->mem_flags);
+    if (shm_parent_set_uring(p, o->uring_flags) != 0) {
+        fprintf(stderr, "[Bench] io_uring not available\n");
+        shm_parent_close(p);
+        return -1;
+    }
+    if (start_quiet(p) != 0) {
+        fprintf(stderr, "[Bench] Failed to start child\n");
+        shm_parent_close(p);
+        return -1;
+    }
+    if (o->channel_mode == SHM_MODE_AUTO) {
+        printf("# negotiated %zu mode=%s peer_features=%#x\n", shm_size, mode_name(p->mode), shm_parent_peer_features(p));
+    }
+
+    size_t limit = shm_parent_max_message(p);
+    if (limit > o->max_payload) limit = o->max_payload;
+
+    uint8_t *buf = (uint8_t*)malloc(limit);
+    uint64_t *lat = (uint64_t*)malloc(sizeof(uint64_t) * o->iters);
+    if (!buf || !lat) {
+        free(buf);
+        free(lat);
+        shm_parent_close(p);
+        return -1;
+    }
+    memset(buf, 0xab, limit);
+
+    int ret = 0;
+    for (size_t payload = MIN_PAYLOAD; payload <= limit && ret == 0; payload *= 8) {
+        size_t iters = o->bytes / payload;
+        if (iters > o->iters) iters = o->iters;
+        if (iters < 10) iters = 10;
+
+        ret = run_pingpong(p, o, buf, payload, iters, lat);
+        if (ret == 0) ret = run_stream(p, o, buf, payload, iters, lat);
+    }
+    if (ret != 0) fprintf(stderr, "[Bench] Communication error at SHM size %zu\n", shm_size);
+
+    if (o->stats) {
+        shm_stats_t st;
+        shm_parent_get_stats(p, &st);
+        print_dir_stats(shm_size, "send", &st.send);
+        print_dir_stats(shm_size, "recv", &st.recv);
+    }
+
+    free(buf);
+    free(lat);
+    shm_parent_close(p);
+    return ret;
+}
+
+// --- Bench Child ---
+
+static shm_child_t *bench_child;
+
+// Standard mode only acks once the handler returns, and the parent does not
+// read replies until then, so echoes are handed to a sender thread.
+static pthread_mutex_t echo_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t echo_cond = PTHREAD_COND_INITIALIZER;
+static uint8_t *echo_buf;
+static size_t echo_len;
+static int echo_pending;
+
+static void* echo_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&echo_lock);
+        while (!echo_pending) pthread_cond_wait(&echo_cond, &echo_lock);
+        pthread_mutex_unlock(&echo_lock);
+
+        if (shm_child_send_data(bench_child, echo_buf, echo_len) != 0) exit(1);
+
+        pthread_mutex_lock(&echo_lock);
+        echo_pending = 0;
+        pthread_cond_signal(&echo_cond);
+        pthread_mutex_unlock(&echo_lock);
+    }
+    return NULL;
+}
+
+static void bench_child_reply(const uint8_t *data, size_t len) {
+    if (bench_child->mode != SHM_MODE_STANDARD) {
+        if (shm_child_send_data(bench_child, data, len) != 0) exit(1);
+        return;
+    }
+
+    pthread_mutex_lock(&echo_lock);
+    while (echo_pending) pthread_cond_wait(&echo_cond, &echo_lock);
+    memcpy(echo_buf, data, len);
+    echo_len = len;
+    echo_pending = 1;
+    pthread_cond_signal(&echo_cond);
+    pthread_mutex_unlock(&echo_lock);
+}
+
+static void bench_child_handler(const uint8_t *data, size_t len) {
+    if (len == 0 || data[0] == TAG_STREAM) return;
+    if (data[0] == TAG_END) len = 1;
+
+    if (data[0] == TAG_TRACE) {
+        shm_stats_t st;
+        trace_reply_t reply;
+        memset(&reply, 0, sizeof(reply));
+        shm_child_get_stats(bench_child, &st);
+        shm_child_reset_stats(bench_child);
+        reply.tag = TAG_TRACE;
+        summarize_stages(&st.send, reply.send);
+        summarize_stages(&st.recv, reply.recv);
+        bench_child_reply((const uint8_t*)&reply, sizeof(reply));
+        return;
+    }
+    bench_child_reply(data, len);
+}
+
+// The child's argv is fixed by shm_parent_start, so the parent hands its
+// per-side settings down through the environment.
+#define ENV_SPIN "EFDSTREAM_BENCH_SPIN"
+#define ENV_URING "EFDSTREAM_BENCH_URING"
+#define ENV_FUTEX "EFDSTREAM_BENCH_FUTEX"
+#define ENV_NT_COPY "EFDSTREAM_BENCH_NT_COPY"
+#define ENV_COMPRESS "EFDSTREAM_BENCH_COMPRESS"
+#define ENV_TRACE "EFDSTREAM_BENCH_TRACE"
+
+static void export_child_opts(const bench_opts_t *o) {
+    char val[32];
+    sprintf(val, "%u", o->spin);
+    setenv(ENV_SPIN, val, 1);
+    sprintf(val, "%u", o->uring_flags);
+    setenv(ENV_URING, val, 1);
+    setenv(ENV_FUTEX, o->futex ? "1" : "0", 1);
+    sprintf(val, "%zu", o->nt_copy);
+    setenv(ENV_NT_COPY, val, 1);
+    sprintf(val, "%zu", o->compress);
+    setenv(ENV_COMPRESS, val, 1);
+    setenv(ENV_TRACE, o->trace ? "1" : "0", 1);
+}
+
+static unsigned env_uint(const char *name) {
+    const char *val = getenv(name);
+    return val ? (unsigned)strtoul(val, NULL, 10) : 0;
+}
+
+static int run_child(size_t shm_size) {
+    bench_child = shm_child_new(shm_size);
+    if (!bench_child) return 1;
+    shm_child_set_spin(bench_child, env_uint(ENV_SPIN));
+    shm_child_set_futex(bench_child, (int)env_uint(ENV_FUTEX));
+    const char *nt_copy = getenv(ENV_NT_COPY);
+    if (nt_copy) shm_set_nt_copy_threshold(strtoul(nt_copy, NULL, 10));
+    if (shm_child_set_uring(bench_child, env_uint(ENV_URING)) != 0) return 1;
+    if (shm_child_set_compress(bench_child, env_uint(ENV_COMPRESS)) != 0) return 1;
+    if (env_uint(ENV_TRACE)) shm_child_set_stats(bench_child, SHM_STATS_TRACE);
+
+    if (bench_child->mode == SHM_MODE_STANDARD) {
+        echo_buf = (uint8_t*)malloc(shm_size);
+        pthread_t tid;
+        if (!echo_buf || pthread_create(&tid, NULL, echo_thread, NULL) != 0) return 1;
+    }
+
+    shm_child_listen(bench_child, bench_child_handler);
+    shm_child_close(bench_child);
+    return 0;
+}
+
+// "0,2-3" style list, as in /sys/devices/system/cpu/online.
+static int parse_cpu_list(const char *list, int *cpus, int max) {
+    int n = 0;
+    while (*list && n < max) {
+        char *end;
+        long lo = strtol(list, &end, 10), hi = lo;
+        if (end == list) break;
+        if (*end == '-') hi = strtol(end + 1, &end, 10);
+        for (long cpu = lo; cpu <= hi && n < max; cpu++) cpus[n++] = (int)cpu;
+        list = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+// -cpus PARENT:CHILD, e.g. 0:2 or 0-1:4-5; either side may be empty.
+static void parse_cpus(const char *arg, bench_opts_t *o) {
+    const char *sep = strchr(arg, ':');
+    o->n_parent_cpus = parse_cpu_list(arg, o->parent_cpus, MAX_PIN_CPUS);
+    o->n_child_cpus = sep ? parse_cpu_list(sep + 1, o->child_cpus, MAX_PIN_CPUS) : 0;
+}
+
+static void print_sysfs(const char *label, const char *path) {
+    char buf[256] = "?";
+    FILE *f = fopen(path, "r");
+    if (f) {
+        if (!fgets(buf, sizeof(buf), f)) strcpy(buf, "?");
+        fclose(f);
+    }
+    buf[strcspn(buf, "\n")] = '\0';
+    printf(" %s=%s", label, buf);
+}
+
+static void print_cpus(const char *label, const int *cpus, int n) {
+    printf(" %s=", label);
+    if (n == 0) printf("any");
+    for (int i = 0; i < n; i++) printf("%s%d", i ? "," : "", cpus[i]);
+}
+
+// Which CPUs each NUMA node has, and where the bench asked to run.
+static void print_topology(const bench_opts_t *o) {
+    printf("# topology:");
+    print_sysfs("cpus", "/sys/devices/system/cpu/online");
+    print_sysfs("nodes", "/sys/devices/system/node/online");
+    for (int node = 0; node < SHM_MAX_NUMA_NODES; node++) {
+        char path[96], label[32];
+        sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+        if (access(path, R_OK) != 0) continue;
+        sprintf(label, "node%d", node);
+        print_sysfs(label, path);
+    }
+    printf("\n# placement: parent_on=%d", sched_getcpu());
+    print_cpus("parent_cpus", o->parent_cpus, o->n_parent_cpus);
+    print_cpus("child_cpus", o->child_cpus, o->n_child_cpus);
+    if (o->numa_node >= 0) printf(" shm_node=%d\n", o->numa_node);
+    else printf(" shm_node=default\n");
+}
+
+static unsigned parse_mem_flags(const char *list) {
+    unsigned flags = 0;
+    if (strstr(list, "hugetlb")) flags |= SHM_MEM_HUGETLB;
+    if (strstr(list, "populate")) flags |= SHM_MEM_POPULATE;
+    if (strstr(list, "thp")) flags |= SHM_MEM_THP;
+    return flags;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -channel-mode MODE           standard, ring, slots or auto (default standard)\n"
+        "  -api data|batch|zc           Send with send_data, send_batch or reserve/commit (default data)\n"
+        "  -child PATH                  Foreign child binary (Go/Rust/C demo); ack-only\n"
+        "  -child-echo                  The -child binary is another efdstream_bench\n"
+        "  -shm-sizes A,B,...           SHM sizes to sweep (default 65536,1048576,134217728)\n"
+        "  -max-payload N               Largest payload (default 67108864)\n"
+        "  -iters N                     Max messages per case (default 100000)\n"
+        "  -bytes N                     Max payload bytes per case (default 1073741824)\n"
+        "  -slot-size N                 Bytes per slot in slots mode (default 64)\n"
+        "  -spin N                      Ring mode spin count before blocking\n"
+        "  -mem populate,thp,hugetlb    Memory options for the memfds\n"
+        "  -uring off|on|sqpoll         Eventfd I/O through io_uring (default off)\n"
+        "  -futex                       Ring mode sleeps on futexes instead of eventfds\n"
+        "  -nt-copy N                   Non-temporal copies from N bytes, 0 for off (default 1048576)\n"
+        "  -compress N                  LZ4-compress messages from N bytes (payloads are one repeated byte)\n"
+        "  -stats                       Print the parent's channel counters and latency percentiles\n"
+        "  -trace                       Print p50/p99/p99.9 us of each message stage per case\n"
+        "                               (resets the counters, so -stats covers the last case)\n"
+        "  -cpus PARENT:CHILD           Pin the parent thread and the child, e.g. 0:2 or 0-1:4-5\n"
+        "  -numa N                      Bind the SHM pages to NUMA node N\n",
+        prog);
+}
+
+int main(int argc, char *argv[]) {
+    char *mode = "parent";
+    char *child_path = NULL;
+    char *shm_sizes = "65536,1048576,134217728";
+    size_t shm_size = 1024 * 1024;
+    bench_opts_t o = {
+        .channel_mode = SHM_MODE_STANDARD,
+        .api = API_DATA,
+        .echo = 1,
+        .spin = 0,
+        .mem_flags = 0,
+        .uring_flags = 0,
+        .futex = 0,
+        .stats = 0,
+        .trace = 0,
+        .n_parent_cpus = 0,
+        .n_child_cpus = 0,
+        .numa_node = -1,
+        .slot_size = 0,
+        .nt_copy = SHM_NT_COPY_DEFAULT,
+        .compress = 0,
+        .iters = 100000,
+        .bytes = 1ull << 30,
+        .max_payload = 64ull << 20,
+    };
+    int child_echo = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-mode") == 0 && i + 1 < argc) {
+            mode = argv[++i];
+        } else if (strcmp(argv[i], "-shm-size") == 0 && i + 1 < argc) {
+            shm_size = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-channel-mode") == 0 && i + 1 < argc) {
+            const char *val = argv[++i];
+            o.channel_mode = strcmp(val, "ring") == 0 ? SHM_MODE_RING :
+                             strcmp(val, "slots") == 0 ? SHM_MODE_SLOTS :
+                             strcmp(val, "auto") == 0 ? SHM_MODE_AUTO : SHM_MODE_STANDARD;
+        } else if (strcmp(argv[i], "-api") == 0 && i + 1 < argc) {
+            const char *val = argv[++i];
+            o.api = strcmp(val, "batch") == 0 ? API_BATCH : strcmp(val, "zc") == 0 ? API_ZC : API_DATA;
+        } else if (strcmp(argv[i], "-slot-size") == 0 && i + 1 < argc) {
+            o.slot_size = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-child") == 0 && i + 1 < argc) {
+            child_path = argv[++i];
+        } else if (strcmp(argv[i], "-child-echo") == 0) {
+            child_echo = 1;
+        } else if (strcmp(argv[i], "-shm-sizes") == 0 && i + 1 < argc) {
+            shm_sizes = argv[++i];
+        } else if (strcmp(argv[i], "-max-payload") == 0 && i + 1 < argc) {
+            o.max_payload = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-iters") == 0 && i + 1 < argc) {
+            o.iters = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-bytes") == 0 && i + 1 < argc) {
+            o.bytes = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-spin") == 0 && i + 1 < argc) {
+            o.spin = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-mem") == 0 && i + 1 < argc) {
+            o.mem_flags = parse_mem_flags(argv[++i]);
+        } else if (strcmp(argv[i], "-nt-copy") == 0 && i + 1 < argc) {
+            o.nt_copy = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-compress") == 0 && i + 1 < argc) {
+            o.compress = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-futex") == 0) {
+            o.futex = 1;
+        } else if (strcmp(argv[i], "-stats") == 0) {
+            o.stats = 1;
+        } else if (strcmp(argv[i], "-trace") == 0) {
+            o.trace = 1;
+        } else if (strcmp(argv[i], "-cpus") == 0 && i + 1 < argc) {
+            parse_cpus(argv[++i], &o);
+        } else if (strcmp(argv[i], "-numa") == 0 && i + 1 < argc) {
+            o.numa_node = (int)strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-uring") == 0 && i + 1 < argc) {
+            const char *val = argv[++i];
+            o.uring_flags = strcmp(val, "on") == 0 ? SHM_URING_ENABLE :
+                            strcmp(val, "sqpoll") == 0 ? SHM_URING_ENABLE | SHM_URING_SQPOLL : 0;
+        } else if (strncmp(argv[i], "-fd-", 4) == 0 && i + 1 < argc) {
+            i++; // Fixed FDs, passed for compatibility
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (strcmp(mode, "child") == 0) return run_child(shm_size);
+
+    char self[4096];
+    if (!child_path) {
+        ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+        if (n <= 0) return 1;
+        self[n] = '\0';
+        child_path = self;
+    } else {
+        o.echo = child_echo;
+        // Other implementations only speak the standard protocol, which
+        // auto mode finds out by itself
+        if (!child_echo && o.channel_mode != SHM_MODE_AUTO) o.channel_mode = SHM_MODE_STANDARD;
+    }
+    shm_set_nt_copy_threshold(o.nt_copy);
+    if (o.echo) export_child_opts(&o);
+    if (o.iters > MAX_SAMPLES) o.iters = MAX_SAMPLES;
+    if (o.iters == 0) o.iters = 1;
+
+    printf("# efdstream bench: channel-mode=%s api=%s child=%s reply=%s uring=%s wait=%s copy=%s@%zu lz4=%zu\n",
+           mode_name(o.channel_mode), api_name(o.api), child_path, o.echo ? "echo" : "ack",
+           o.uring_flags & SHM_URING_SQPOLL ? "sqpoll" : o.uring_flags ? "on" : "off",
+           o.futex ? "futex" : "eventfd", o.nt_copy ? shm_nt_copy_impl() : "memcpy", o.nt_copy, o.compress);
+    print_topology(&o);
+    print_header();
+
+    char *list = strdup(shm_sizes);
+    int ret = 0;
+    for (char *tok = strtok(list, ","); tok && ret == 0; tok = strtok(NULL, ",")) {
+        ret = run_shm_size(child_path, strtoul(tok, NULL, 10), &o);
+    }
+    free(list);
+
+    return ret == 0 ? 0 : 1;
+}
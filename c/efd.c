@@ -3,229 +3,4321 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/eventfd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#ifndef MFD_HUGE_2MB
+#define MFD_HUGE_2MB (21U << 26)
+#endif
+
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+// USDT probes for perf, bpftrace or LTTng. Unattached, each is one nop.
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SHM_PROBE(name, r, len) DTRACE_PROBE2(efdstream, name, r, len)
+#else
+#define SHM_PROBE(name, r, len) do { (void)(r); (void)(len); } while (0)
+#endif
+
+// --- Memory Helpers ---
+
+// Pre-faults and/or requests transparent huge pages for an existing mapping.
+static void shm_advise(uint8_t *ptr, size_t size, unsigned mem_flags, int writable) {
+    if (mem_flags & SHM_MEM_THP) madvise(ptr, size, MADV_HUGEPAGE);
+    if (mem_flags & SHM_MEM_POPULATE) madvise(ptr, size, writable ? MADV_POPULATE_WRITE : MADV_POPULATE_READ);
+}
+
+static uint8_t* shm_map(int fd, size_t size, int prot, unsigned mem_flags) {
+    int flags = MAP_SHARED;
+    if (mem_flags & SHM_MEM_POPULATE) flags |= MAP_POPULATE;
+
+    uint8_t *ptr = mmap(NULL, size, prot, flags, fd, 0);
+    if (ptr == MAP_FAILED) return ptr;
+
+    shm_advise(ptr, size, mem_flags & SHM_MEM_THP, 0);
+    return ptr;
+}
+
+// Binds a fresh shared mapping to one NUMA node. MPOL_MF_MOVE also moves
+// pages already faulted in, e.g. by a hugetlb reservation.
+static int shm_bind_node(uint8_t *ptr, size_t size, int node) {
+    unsigned long mask[SHM_MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = { 0 };
+    mask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+    return (int)syscall(SYS_mbind, ptr, size, MPOL_BIND, mask, (unsigned long)SHM_MAX_NUMA_NODES + 1,
+                        MPOL_MF_STRICT | MPOL_MF_MOVE);
+}
+
+// Extends a mapping of fd to the memfd's current size (mremap, or a new mapping
+// where that fails). Only the thread using the mapping may call this.
+static int shm_remap(int fd, uint8_t **ptr, size_t *size, size_t need, int prot, unsigned mem_flags) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return -1;
+    size_t new_size = (size_t)st.st_size;
+    if (new_size < need || new_size <= *size) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    uint8_t *ptr_new = mremap(*ptr, *size, new_size, MREMAP_MAYMOVE);
+    if (ptr_new == MAP_FAILED) {
+        ptr_new = mmap(NULL, new_size, prot, MAP_SHARED, fd, 0);
+        if (ptr_new == MAP_FAILED) return -1;
+        munmap(*ptr, *size);
+    }
+    shm_advise(ptr_new, new_size, mem_flags, prot & PROT_WRITE);
+    *ptr = ptr_new;
+    *size = new_size;
+    return 0;
+}
+
+// Gives the pages of [start, end) of a memfd back; they read as zeros when
+// next touched. The range is shrunk to whole pages of the memfd.
+static int shm_punch(int fd, size_t start, size_t end, unsigned mem_flags) {
+    size_t page = (mem_flags & SHM_MEM_HUGETLB) ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    start = (start + page - 1) & ~(page - 1);
+    end &= ~(page - 1);
+    if (start >= end) return 0;
+    return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)start, (off_t)(end - start));
+}
+
+// Above the threshold, copies into shared memory use non-temporal stores
+// (picked once with cpuid) so they do not evict the writer's caches
+typedef void (*shm_copy_fn)(uint8_t *dst, const uint8_t *src, size_t len);
+
+static size_t nt_copy_threshold = SHM_NT_COPY_DEFAULT;
+static shm_copy_fn nt_copy;
+static const char *nt_copy_name = "memcpy";
+static pthread_once_t nt_copy_once = PTHREAD_ONCE_INIT;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+// dst is first brought to the vector alignment, which streaming stores need
+__attribute__((target("avx2")))
+static void nt_copy_avx2(uint8_t *dst, const uint8_t *src, size_t len) {
+    size_t head = (32 - ((uintptr_t)dst & 31)) & 31;
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    len -= head;
+
+    for (; len >= 128; len -= 128, dst += 128, src += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)src);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(src + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(src + 96));
+        _mm256_stream_si256((__m256i*)dst, a);
+        _mm256_stream_si256((__m256i*)(dst + 32), b);
+        _mm256_stream_si256((__m256i*)(dst + 64), c);
+        _mm256_stream_si256((__m256i*)(dst + 96), d);
+    }
+    _mm_sfence();
+    memcpy(dst, src, len);
+}
+
+__attribute__((target("avx512f")))
+static void nt_copy_avx512(uint8_t *dst, const uint8_t *src, size_t len) {
+    size_t head = (64 - ((uintptr_t)dst & 63)) & 63;
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    len -= head;
+
+    for (; len >= 256; len -= 256, dst += 256, src += 256) {
+        __m512i a = _mm512_loadu_si512((const void*)src);
+        __m512i b = _mm512_loadu_si512((const void*)(src + 64));
+        __m512i c = _mm512_loadu_si512((const void*)(src + 128));
+        __m512i d = _mm512_loadu_si512((const void*)(src + 192));
+        _mm512_stream_si512((void*)dst, a);
+        _mm512_stream_si512((void*)(dst + 64), b);
+        _mm512_stream_si512((void*)(dst + 128), c);
+        _mm512_stream_si512((void*)(dst + 192), d);
+    }
+    _mm_sfence();
+    memcpy(dst, src, len);
+}
+#endif
+
+static void nt_copy_init(void) {
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        nt_copy = nt_copy_avx512;
+        nt_copy_name = "avx512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        nt_copy = nt_copy_avx2;
+        nt_copy_name = "avx2";
+    }
+#endif
+}
+
+static inline void shm_copy(uint8_t *dst, const uint8_t *src, size_t len) {
+    if (nt_copy_threshold && len >= nt_copy_threshold) {
+        pthread_once(&nt_copy_once, nt_copy_init);
+        if (nt_copy) {
+            nt_copy(dst, src, len);
+            return;
+        }
+    }
+    memcpy(dst, src, len);
+}
+
+void shm_set_nt_copy_threshold(size_t bytes) {
+    nt_copy_threshold = bytes;
+}
+
+const char* shm_nt_copy_impl(void) {
+    pthread_once(&nt_copy_once, nt_copy_init);
+    return nt_copy_name;
+}
+
+// --- LZ4 Codec ---
+
+// LZ4 block format: token (literal length << 4 | match length - 4), extra length
+// bytes, literals, 16-bit LE offset. The last 5 bytes are always literals.
+#define LZ4_HASH_BITS 12
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MFLIMIT 12
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_MAX_INPUT 0x7E000000u
+
+static inline uint32_t lz4_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t lz4_read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// End of the common prefix of a and b, stopping at limit; b is behind a.
+static inline const uint8_t* lz4_extend(const uint8_t *a, const uint8_t *b, const uint8_t *limit) {
+    while (a + 8 <= limit) {
+        uint64_t diff = lz4_read64(a) ^ lz4_read64(b);
+        if (diff) return a + (__builtin_ctzll(diff) >> 3);
+        a += 8;
+        b += 8;
+    }
+    while (a < limit && *a == *b) {
+        a++;
+        b++;
+    }
+    return a;
+}
+
+static inline uint32_t lz4_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+static inline uint8_t* lz4_put_len(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// Bytes a sequence with lit literals and an extra match length of mlen can
+// take, with room for both length continuations.
+static inline size_t lz4_seq_bound(size_t lit, size_t mlen) {
+    return 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1;
+}
+
+// Greedy single-probe compressor. Returns the block size, or 0 if it would
+// exceed cap.
+static size_t lz4_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    const uint8_t *ip = src, *anchor = src, *end = src + n;
+    uint8_t *op = dst, *oend = dst + cap;
+
+    if (n >= LZ4_MFLIMIT + 1) {
+        const uint8_t *mflimit = end - LZ4_MFLIMIT;
+        const uint8_t *match_limit = end - LZ4_LAST_LITERALS;
+        uint32_t table[1 << LZ4_HASH_BITS];
+        memset(table, 0, sizeof(table));
+
+        while (ip <= mflimit) {
+            uint32_t seq = lz4_read32(ip);
+            uint32_t h = lz4_hash(seq);
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || lz4_read32(ref) != seq) {
+                // Skip faster through data that does not match
+                ip += 1 + ((size_t)(ip - anchor) >> 6);
+                continue;
+            }
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t *mp = lz4_extend(ip + LZ4_MIN_MATCH, ref + LZ4_MIN_MATCH, match_limit);
+
+            size_t lit = (size_t)(ip - anchor), mlen = (size_t)(mp - ip) - LZ4_MIN_MATCH;
+            if (lz4_seq_bound(lit, mlen) > (size_t)(oend - op)) return 0;
+
+            uint8_t *token = op++;
+            *token = (uint8_t)((lit >= 15 ? 15 : lit) << 4 | (mlen >= 15 ? 15 : mlen));
+            if (lit >= 15) op = lz4_put_len(op, lit - 15);
+            memcpy(op, anchor, lit);
+            op += lit;
+            size_t off = (size_t)(ip - ref);
+            *op++ = (uint8_t)off;
+            *op++ = (uint8_t)(off >> 8);
+            if (mlen >= 15) op = lz4_put_len(op, mlen - 15);
+
+            ip = anchor = mp;
+            if (ip <= mflimit) table[lz4_hash(lz4_read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+        }
+    }
+
+    size_t lit = (size_t)(end - anchor);
+    if (1 + lit / 255 + 1 + lit > (size_t)(oend - op)) return 0;
+    *op++ = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15) op = lz4_put_len(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+    return (size_t)(op - dst);
+}
+
+static int lz4_get_len(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+    unsigned b;
+    do {
+        if (*ip >= iend) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+// Fails unless the block decodes to exactly raw bytes without touching
+// anything outside src or dst.
+static int lz4_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t raw) {
+    const uint8_t *ip = src, *iend = src + n;
+    uint8_t *op = dst, *oend = dst + raw;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15 && lz4_get_len(&ip, iend, &lit) != 0) return -1;
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) return -1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend) break; // The last sequence has no match
+
+        if (iend - ip < 2) return -1;
+        size_t off = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (off == 0 || off > (size_t)(op - dst)) return -1;
+
+        size_t mlen = token & 15;
+        if (mlen == 15 && lz4_get_len(&ip, iend, &mlen) != 0) return -1;
+        mlen += LZ4_MIN_MATCH;
+        if (mlen > (size_t)(oend - op)) return -1;
+
+        // Overlapping matches repeat the last off bytes: copy whole periods,
+        // twice as many each time
+        const uint8_t *m = op - off;
+        for (size_t done = 0; done < mlen;) {
+            size_t n = off + done < mlen - done ? off + done : mlen - done;
+            memcpy(op + done, m, n);
+            done += n;
+        }
+        op += mlen;
+    }
+    return op == oend ? 0 : -1;
+}
+
+// Compresses a message into a frame of at most cap bytes. Returns 0 when
+// that is not smaller than the message itself.
+static size_t lz4_frame(uint8_t *dst, size_t cap, const uint8_t *src, size_t len) {
+    if (cap >= len) cap = len - 1;
+    if (len > LZ4_MAX_INPUT || len == 0 || cap <= SHM_LZ4_HDR_SIZE) return 0;
+
+    size_t n = lz4_compress(src, len, dst + SHM_LZ4_HDR_SIZE, cap - SHM_LZ4_HDR_SIZE);
+    if (n == 0) return 0;
+    for (int i = 0; i < 4; i++) dst[i] = (uint8_t)(len >> (8 * i));
+    memset(dst + 4, 0, SHM_LZ4_HDR_SIZE - 4);
+    return SHM_LZ4_HDR_SIZE + n;
+}
+
+// Decompresses a received frame into the direction's buffer, which is
+// lent in place of the frame until the next message.
+static int lz4_unframe(shm_ring_t *r, const uint8_t *frame, size_t n, const uint8_t **data, size_t *len) {
+    size_t raw = 0;
+    if (n >= SHM_LZ4_HDR_SIZE) {
+        for (int i = 0; i < 4; i++) raw |= (size_t)frame[i] << (8 * i);
+    }
+    if (n < SHM_LZ4_HDR_SIZE || raw > LZ4_MAX_INPUT) goto corrupt;
+
+    if (raw > r->lz4_cap || !r->lz4_buf) {
+        uint8_t *buf = (uint8_t*)realloc(r->lz4_buf, raw ? raw : 1);
+        if (!buf) return -1;
+        r->lz4_buf = buf;
+        r->lz4_cap = raw;
+    }
+    if (lz4_decompress(frame + SHM_LZ4_HDR_SIZE, n - SHM_LZ4_HDR_SIZE, r->lz4_buf, raw) != 0) goto corrupt;
+
+    *data = r->lz4_buf;
+    *len = raw;
+    return 0;
+
+corrupt:
+    fprintf(stderr, "Corrupt LZ4 frame of %zu bytes\n", n);
+    errno = EBADMSG;
+    return -1;
+}
+
+// --- Buffer Pool ---
+
+// Header in front of every pooled buffer, cached ones are chained through next
+typedef struct shm_buf_hdr_s {
+    shm_buf_pool_t *pool;
+    struct shm_buf_hdr_s *next;
+    uint32_t cls;
+} shm_buf_hdr_t;
+
+#define BUF_HDR_SIZE ((sizeof(shm_buf_hdr_t) + 15) & ~(size_t)15)
+#define BUF_NO_CLASS UINT32_MAX // Larger than the biggest class, never cached
+
+struct shm_buf_pool_s {
+    pthread_mutex_t lock;
+    int per_class;
+    int closed;
+    size_t outstanding; // Buffers handed out and not yet released
+    shm_buf_hdr_t *free_list[SHM_POOL_CLASSES];
+    int cached[SHM_POOL_CLASSES];
+};
+
+static inline shm_buf_hdr_t* buf_hdr(void *buf) {
+    return (shm_buf_hdr_t*)((uint8_t*)buf - BUF_HDR_SIZE);
+}
+
+static inline size_t buf_class_size(uint32_t cls) {
+    return (size_t)1 << (SHM_POOL_MIN_SHIFT + cls);
+}
+
+static uint32_t buf_class(size_t len) {
+    for (uint32_t cls = 0; cls < SHM_POOL_CLASSES; cls++) {
+        if (len <= buf_class_size(cls)) return cls;
+    }
+    return BUF_NO_CLASS;
+}
+
+static shm_buf_pool_t* pool_new(int per_class) {
+    shm_buf_pool_t *pool = (shm_buf_pool_t*)calloc(1, sizeof(shm_buf_pool_t));
+    if (!pool) return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->per_class = per_class;
+    return pool;
+}
+
+static void pool_destroy(shm_buf_pool_t *pool) {
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+// Drops the cache. The pool itself lives on until the last buffer it
+// handed out has been released.
+static void pool_close(shm_buf_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->closed = 1;
+    for (int cls = 0; cls < SHM_POOL_CLASSES; cls++) {
+        while (pool->free_list[cls]) {
+            shm_buf_hdr_t *h = pool->free_list[cls];
+            pool->free_list[cls] = h->next;
+            free(h);
+        }
+        pool->cached[cls] = 0;
+    }
+    int dead = pool->outstanding == 0;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (dead) pool_destroy(pool);
+}
+
+static uint8_t* pool_alloc(shm_buf_pool_t *pool, size_t len) {
+    uint32_t cls = buf_class(len);
+    shm_buf_hdr_t *h = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (cls != BUF_NO_CLASS && pool->free_list[cls]) {
+        h = pool->free_list[cls];
+        pool->free_list[cls] = h->next;
+        pool->cached[cls]--;
+    }
+    pool->outstanding++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!h) {
+        h = (shm_buf_hdr_t*)malloc(BUF_HDR_SIZE + (cls != BUF_NO_CLASS ? buf_class_size(cls) : len));
+        if (!h) {
+            pthread_mutex_lock(&pool->lock);
+            pool->outstanding--;
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        h->pool = pool;
+        h->cls = cls;
+    }
+    return (uint8_t*)h + BUF_HDR_SIZE;
+}
+
+void shm_buffer_release(void *buf) {
+    if (!buf) return;
+
+    shm_buf_hdr_t *h = buf_hdr(buf);
+    shm_buf_pool_t *pool = h->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->outstanding--;
+    if (!pool->closed && h->cls != BUF_NO_CLASS && pool->cached[h->cls] < pool->per_class) {
+        h->next = pool->free_list[h->cls];
+        pool->free_list[h->cls] = h;
+        pool->cached[h->cls]++;
+        h = NULL;
+    }
+    int dead = pool->closed && pool->outstanding == 0;
+    pthread_mutex_unlock(&pool->lock);
+
+    free(h);
+    if (dead) pool_destroy(pool);
+}
+
+// realloc for a buffer that came from pool_alloc (or NULL).
+static uint8_t* pool_realloc(shm_buf_pool_t *pool, uint8_t *buf, size_t used, size_t len) {
+    uint8_t *grown = pool_alloc(pool, len);
+    if (!grown) return NULL;
+    if (buf) {
+        memcpy(grown, buf, used);
+        shm_buffer_release(buf);
+    }
+    return grown;
+}
+
+// --- io_uring Transport ---
+
+// One io_uring per channel direction, for eventfd I/O only; with SQPOLL a
+// fire-and-forget write costs no syscall
+
+#if defined(__NR_io_uring_setup) && defined(IORING_OFF_SQ_RING)
+
+#define URING_ENTRIES 64 // Power of two, as io_uring_setup rounds up
+#define URING_IDLE_MS 10
+#define URING_TAG_WRITE 0
+#define URING_TAG_READ 1
+
+struct shm_uring_s {
+    int fd;
+    unsigned setup_flags;
+    int files[2]; // Registered as fixed files 0 and 1
+
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_flags, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size, sqes_size;
+
+    unsigned queued;   // SQEs not yet handed to the kernel (no SQPOLL)
+    unsigned inflight; // Writes without a reaped completion
+    int write_failed;
+
+    // Write sources must stay put until the kernel has consumed them
+    uint64_t vals[URING_ENTRIES];
+    unsigned next_val;
+
+    uint64_t read_val;
+    int read_done;
+    int read_res;
+};
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void uring_free(shm_uring_t *u) {
+    if (!u) return;
+    if (u->sqes && u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_size);
+    if (u->cq_map && u->cq_map != MAP_FAILED) munmap(u->cq_map, u->cq_map_size);
+    if (u->sq_map && u->sq_map != MAP_FAILED) munmap(u->sq_map, u->sq_map_size);
+    if (u->fd != -1) close(u->fd);
+    free(u);
+}
+
+// wq_fd shares the SQPOLL thread of an existing ring (-1 for a new one).
+static shm_uring_t* uring_new(int fd_send, int fd_ack, unsigned flags, int wq_fd) {
+    shm_uring_t *u = (shm_uring_t*)calloc(1, sizeof(shm_uring_t));
+    if (!u) return NULL;
+    u->files[0] = fd_send;
+    u->files[1] = fd_ack;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if (flags & SHM_URING_SQPOLL) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = URING_IDLE_MS;
+        if (wq_fd != -1) {
+            params.flags |= IORING_SETUP_ATTACH_WQ;
+            params.wq_fd = (uint32_t)wq_fd;
+        }
+    }
+
+    u->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (u->fd == -1) {
+        free(u);
+        return NULL;
+    }
+    u->setup_flags = params.flags;
+
+    u->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    u->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    u->sq_map = mmap(NULL, u->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    u->cq_map = mmap(NULL, u->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sq_map == MAP_FAILED || u->cq_map == MAP_FAILED || u->sqes == MAP_FAILED) {
+        uring_free(u);
+        return NULL;
+    }
+
+    uint8_t *sq = (uint8_t*)u->sq_map, *cq = (uint8_t*)u->cq_map;
+    u->sq_head = (unsigned*)(sq + params.sq_off.head);
+    u->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    u->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    u->sq_flags = (unsigned*)(sq + params.sq_off.flags);
+    u->sq_array = (unsigned*)(sq + params.sq_off.array);
+    u->cq_head = (unsigned*)(cq + params.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    u->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_FILES, u->files, 2) != 0) {
+        uring_free(u);
+        return NULL;
+    }
+    return u;
+}
+
+static void uring_reap(shm_uring_t *u) {
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+        if (cqe->user_data == URING_TAG_READ) {
+            u->read_done = 1;
+            u->read_res = cqe->res;
+        } else {
+            u->inflight--;
+            if (cqe->res != 8) u->write_failed = 1;
+        }
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Hands queued SQEs to the kernel and optionally waits for a completion.
+static int uring_submit(shm_uring_t *u, int wait) {
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    unsigned to_submit = 0;
+
+    if (u->setup_flags & IORING_SETUP_SQPOLL) {
+        // The tail store must be visible before we look at the wakeup flag
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(u->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) flags |= IORING_ENTER_SQ_WAKEUP;
+    } else {
+        to_submit = u->queued;
+    }
+    if (to_submit == 0 && flags == 0) return 0;
+
+    int ret = uring_enter(u->fd, to_submit, wait ? 1 : 0, flags);
+    if (ret == -1) return errno == EINTR || errno == EBUSY ? 0 : -1;
+    if (!(u->setup_flags & IORING_SETUP_SQPOLL)) u->queued -= (unsigned)ret;
+    return 0;
+}
+
+static struct io_uring_sqe* uring_get_sqe(shm_uring_t *u) {
+    unsigned tail = *u->sq_tail;
+    while (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) > *u->sq_mask) {
+        if (uring_submit(u, 0) != 0) return NULL;
+    }
+
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    return sqe;
+}
+
+static void uring_push(shm_uring_t *u) {
+    __atomic_store_n(u->sq_tail, *u->sq_tail + 1, __ATOMIC_RELEASE);
+    u->queued++;
+}
+
+static int uring_file(const shm_uring_t *u, int fd) {
+    return fd == u->files[0] ? 0 : 1;
+}
+
+// Queues an eventfd write without submitting it.
+static int uring_queue_write(shm_uring_t *u, int fd, uint64_t val) {
+    // Never reuse a value slot whose write may still be in flight
+    while (u->inflight >= URING_ENTRIES) {
+        uring_reap(u);
+        if (u->inflight >= URING_ENTRIES && uring_submit(u, 1) != 0) return -1;
+    }
+
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    if (!sqe) return -1;
+
+    uint64_t *src = &u->vals[u->next_val++ % URING_ENTRIES];
+    *src = val;
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = uring_file(u, fd);
+    sqe->addr = (uint64_t)(uintptr_t)src;
+    sqe->len = 8;
+    sqe->user_data = URING_TAG_WRITE;
+    uring_push(u);
+    u->inflight++;
+    return 0;
+}
+
+static int uring_signal(shm_uring_t *u, int fd, uint64_t val) {
+    uring_reap(u);
+    if (u->write_failed) return -1;
+    if (uring_queue_write(u, fd, val) != 0) return -1;
+    return uring_submit(u, 0);
+}
+
+// Submits everything queued plus the read, then waits for the read.
+static int uring_recv(shm_uring_t *u, int fd, uint64_t *val) {
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    if (!sqe) return -1;
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = uring_file(u, fd);
+    sqe->addr = (uint64_t)(uintptr_t)&u->read_val;
+    sqe->len = 8;
+    sqe->user_data = URING_TAG_READ;
+    uring_push(u);
+    u->read_done = 0;
+
+    while (1) {
+        uring_reap(u);
+        if (u->read_done) break;
+        if (uring_submit(u, 1) != 0) return -1;
+    }
+
+    if (u->write_failed) return -1;
+    if (u->read_res != 8) {
+        if (u->read_res < 0) errno = -u->read_res;
+        return -1;
+    }
+    *val = u->read_val;
+    return 0;
+}
+
+static int uring_fd(const shm_uring_t *u) {
+    return u->fd;
+}
+
+// Probes with two empty (-1) file slots.
+static int uring_available(unsigned flags) {
+    shm_uring_t *u = uring_new(-1, -1, flags, -1);
+    if (u) {
+        uring_free(u);
+        return 1;
+    }
+    return 0;
+}
+
+#else
+
+static shm_uring_t* uring_new(int fd_send, int fd_ack, unsigned flags, int wq_fd) {
+    (void)fd_send; (void)fd_ack; (void)flags; (void)wq_fd;
+    errno = ENOSYS;
+    return NULL;
+}
+static void uring_free(shm_uring_t *u) { (void)u; }
+static int uring_queue_write(shm_uring_t *u, int fd, uint64_t val) { (void)u; (void)fd; (void)val; return -1; }
+static int uring_signal(shm_uring_t *u, int fd, uint64_t val) { (void)u; (void)fd; (void)val; return -1; }
+static int uring_recv(shm_uring_t *u, int fd, uint64_t *val) { (void)u; (void)fd; (void)val; return -1; }
+static int uring_fd(const shm_uring_t *u) { (void)u; return -1; }
+static int uring_available(unsigned flags) { (void)flags; return 0; }
+
+#endif
+
+// --- Eventfd Helpers ---
+
+// Blocking read that also works when the eventfd is EFD_NONBLOCK.
+static int efd_read(int fd, uint64_t *val) {
+    while (1) {
+        if (read(fd, val, 8) == 8) return 0;
+        if (errno != EAGAIN) return -1;
+
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, -1) == -1) return -1;
+    }
+}
+
+// Reads the counter if it is non-zero, whatever the fd's O_NONBLOCK setting.
+// Returns 1 if a value was read, 0 if there was nothing to read.
+static int efd_try_read(int fd, uint64_t *val) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int ret = poll(&pfd, 1, 0);
+    if (ret <= 0) return ret;
+    return efd_read(fd, val) == 0 ? 1 : -1;
+}
+
+// The signalling primitives: through the direction's io_uring if it has one.
+static int efd_signal(shm_uring_t *u, int fd, uint64_t val) {
+    if (u) return uring_signal(u, fd, val);
+    return write(fd, &val, 8) == 8 ? 0 : -1;
+}
+
+static int efd_recv(shm_uring_t *u, int fd, uint64_t *val) {
+    if (u) return uring_recv(u, fd, val);
+    return efd_read(fd, val);
+}
+
+// Acks a standard-mode message that cannot be lent, so the sender goes on.
+static int efd_reject(shm_uring_t *uring, int fd_ack) {
+    efd_signal(uring, fd_ack, 1);
+    errno = EBADMSG;
+    return -1;
+}
+
+// Standard mode send: signal the length, then wait for the ack. With
+// io_uring both go to the kernel in one io_uring_enter.
+static int efd_signal_wait(shm_uring_t *u, int fd_send, uint64_t val, int fd_ack, uint64_t *ack) {
+    if (u) {
+        if (uring_queue_write(u, fd_send, val) != 0) return -1;
+        return uring_recv(u, fd_ack, ack);
+    }
+    if (write(fd_send, &val, 8) != 8) return -1;
+    return efd_read(fd_ack, ack);
+}
+
+// --- Handshake ---
+
+static void hello_fill(uint8_t *base, size_t shm_size) {
+    shm_hello_t *h = (shm_hello_t*)base;
+    memset(h, 0, sizeof(*h));
+    h->magic = SHM_HELLO_MAGIC;
+    h->version = SHM_HELLO_VERSION;
+    h->features = SHM_FEATURES;
+    h->hdr_version = SHM_HDR_VERSION;
+    h->shm_size = shm_size;
+}
+
+// Both sides race for the magic word of the parent's P2C hello, which a
+// child without the handshake never writes: the child to claim it, the
+// parent to close it on timeout
+static int hello_cas(shm_hello_t *p2c, uint32_t to) {
+    uint32_t expected = SHM_HELLO_MAGIC;
+    return atomic_compare_exchange_strong((_Atomic uint32_t*)&p2c->magic, &expected, to);
+}
+
+static int hello_valid(const shm_hello_t *h) {
+    return h->magic == SHM_HELLO_MAGIC && h->version >= 1;
+}
+
+// Gives both directions of a lane their own io_uring. *wq_fd is the ring
+// whose SQPOLL thread the others share, -1 until the first one exists.
+static int uring_attach(shm_ring_t *p2c, int p2c_send, int p2c_ack,
+                        shm_ring_t *c2p, int c2p_send, int c2p_ack,
+                        unsigned flags, int *wq_fd) {
+    p2c->uring = uring_new(p2c_send, p2c_ack, flags, *wq_fd);
+    if (!p2c->uring) return -1;
+    if (*wq_fd == -1) *wq_fd = uring_fd(p2c->uring);
+
+    c2p->uring = uring_new(c2p_send, c2p_ack, flags, *wq_fd);
+    return c2p->uring ? 0 : -1;
+}
+
+static void uring_detach(shm_ring_t *p2c, shm_ring_t *c2p) {
+    uring_free(p2c->uring);
+    uring_free(c2p->uring);
+    p2c->uring = c2p->uring = NULL;
+}
+
+// efd_recv, or efd_try_read failing with EAGAIN when there is nothing to read.
+static int efd_wait(shm_uring_t *u, int fd, uint64_t *val, int block) {
+    if (block) return efd_recv(u, fd, val);
+
+    int ret = efd_try_read(fd, val);
+    if (ret == 0) errno = EAGAIN;
+    return ret == 1 ? 0 : -1;
+}
+
+// --- Statistics ---
+
+static inline uint64_t stats_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static unsigned hist_index(uint64_t v) {
+    if (v < SHM_HIST_SUB) return (unsigned)v;
+
+    unsigned shift = 63 - (unsigned)__builtin_clzll(v);
+    if (shift > SHM_HIST_MAX_SHIFT) return SHM_HIST_BUCKETS - 1;
+    unsigned sub = (unsigned)(v >> (shift - SHM_HIST_SUB_BITS)) & (SHM_HIST_SUB - 1);
+    return (shift - SHM_HIST_SUB_BITS + 1) * SHM_HIST_SUB + sub;
+}
+
+// Largest value that lands in bucket i.
+static uint64_t hist_bucket_max(unsigned i) {
+    if (i < SHM_HIST_SUB) return i;
+
+    unsigned shift = i / SHM_HIST_SUB - 1;
+    uint64_t low = (uint64_t)(SHM_HIST_SUB + i % SHM_HIST_SUB) << shift;
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+static void hist_record(shm_hist_t *h, uint64_t v) {
+    if (h->count == 0 || v < h->min) h->min = v;
+    if (v > h->max) h->max = v;
+    h->count++;
+    h->sum += v;
+    h->buckets[hist_index(v)]++;
+}
+
+uint64_t shm_hist_percentile(const shm_hist_t *h, double percentile) {
+    if (h->count == 0) return 0;
+
+    double want = percentile / 100.0 * (double)h->count;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < SHM_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > 0 && (double)seen >= want) {
+            uint64_t v = hist_bucket_max(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+// Latency samples are only taken with SHM_STATS_LATENCY; start is 0 otherwise.
+static inline uint64_t stats_start(const shm_ring_t *r) {
+    return (r->stats_flags & (SHM_STATS_LATENCY | SHM_STATS_TRACE)) ? stats_clock() : 0;
+}
+
+static inline uint64_t stats_trace_clock(const shm_ring_t *r) {
+    return (r->stats_flags & SHM_STATS_TRACE) ? stats_clock() : 0;
+}
+
+// Records a stage that began at start (0 if it was not timed) and returns
+// the clock it ended at.
+static inline uint64_t stats_stage(shm_ring_t *r, shm_stage_t stage, uint64_t start) {
+    if (!start || !(r->stats_flags & SHM_STATS_TRACE)) return 0;
+    uint64_t now = stats_clock();
+    hist_record(&r->stats.stage_ns[stage], now - start);
+    return now;
+}
+
+// Consumer: ends the handler stage of what read_begin lent last.
+static inline void stats_end_read(shm_ring_t *r) {
+    stats_stage(r, SHM_STAGE_HANDLER, r->lent_ns);
+    r->lent_ns = 0;
+    SHM_PROBE(recv_end, r, 0);
+}
+
+static inline void stats_latency(shm_ring_t *r, uint64_t start) {
+    if (start && (r->stats_flags & SHM_STATS_LATENCY)) hist_record(&r->stats.latency_ns, stats_clock() - start);
+}
+
+static inline void stats_count(shm_ring_t *r, size_t len) {
+    r->stats.msgs++;
+    r->stats.bytes += len;
+}
+
+// Counting for the sends of a multi-producer ring, which several threads
+// make on the same shm_ring_t. They record no latency.
+static inline void stats_add(uint64_t *counter, uint64_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+// Sleeps are syscalls anyway, so they are always timed.
+static inline void stats_blocked(shm_ring_t *r, uint64_t start) {
+    r->stats.blocks++;
+    r->stats.blocked_ns += stats_clock() - start;
+}
+
+static inline void* stats_too_large(shm_ring_t *r) {
+    r->stats.too_large++;
+    errno = EMSGSIZE;
+    return NULL;
+}
+
+// Deadlines of bounded waits are stats_clock values, 0 for none.
+static inline uint64_t deadline_after(uint64_t timeout_ns) {
+    return timeout_ns ? stats_clock() + timeout_ns : 0;
+}
+
+// efd_read that gives up with EAGAIN at the deadline. It polls the fd
+// itself, past any io_uring, so it cannot leave a read queued behind it.
+static int efd_read_until(int fd, uint64_t *val, uint64_t deadline) {
+    while (1) {
+        uint64_t now = stats_clock();
+        int ms = now < deadline ? (int)((deadline - now + 999999) / 1000000) : 0;
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int ret = poll(&pfd, 1, ms);
+        if (ret == -1) return -1;
+        if (ret == 0) {
+            if (ms > 0) continue;
+            errno = EAGAIN;
+            return -1;
+        }
+
+        if (read(fd, val, 8) == 8) return 0;
+        if (errno != EAGAIN) return -1;
+    }
+}
+
+// Standard mode waits of one direction, counted like ring sleeps. Only a
+// producer's waits for the ack have an overflow policy.
+static int stats_efd_wait(shm_ring_t *r, int fd, uint64_t *val, int block) {
+    if (!block || r->overflow == SHM_OVERFLOW_FAIL) return efd_wait(r->uring, fd, val, 0);
+
+    uint64_t start = stats_clock();
+    int ret = r->timeout_ns ? efd_read_until(fd, val, start + r->timeout_ns) : efd_recv(r->uring, fd, val);
+    stats_blocked(r, start);
+    if (ret != 0 && r->timeout_ns && errno == EAGAIN) r->stats.timeouts++;
+    return ret;
+}
+
+// The message is out once signalled, so an ack that does not come back in time
+// is left *pending for the next send, and this send still succeeds.
+static int stats_efd_signal_wait(shm_ring_t *r, int fd_send, uint64_t val, int fd_ack, int *pending) {
+    uint64_t ack, start = stats_clock();
+    int trace = (r->stats_flags & SHM_STATS_TRACE) != 0;
+    if (r->overflow != SHM_OVERFLOW_FAIL && !r->timeout_ns && !trace) {
+        int ret = efd_signal_wait(r->uring, fd_send, val, fd_ack, &ack);
+        stats_blocked(r, start);
+        SHM_PROBE(send_ack, r, val);
+        return ret;
+    }
+
+    if (efd_signal(r->uring, fd_send, val) != 0) return -1;
+    uint64_t signalled = stats_stage(r, SHM_STAGE_SIGNAL, start);
+    SHM_PROBE(send_signal, r, val);
+    *pending = 1;
+    if (r->overflow == SHM_OVERFLOW_FAIL) return 0;
+
+    int ret = r->timeout_ns ? efd_read_until(fd_ack, &ack, start + r->timeout_ns) : efd_recv(r->uring, fd_ack, &ack);
+    stats_blocked(r, start);
+    if (ret == 0) {
+        *pending = 0;
+        stats_stage(r, SHM_STAGE_ACK, signalled);
+        SHM_PROBE(send_ack, r, val);
+    } else {
+        if (errno != EAGAIN || !r->timeout_ns) return -1;
+        r->stats.timeouts++;
+    }
+    return 0;
+}
+
+// --- Ring Implementation ---
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static inline uint64_t ring_rec_size(size_t len) {
+    return ((uint64_t)sizeof(shm_rec_t) + len + SHM_REC_ALIGN - 1) & ~(uint64_t)(SHM_REC_ALIGN - 1);
+}
+
+static inline uint64_t slot_seq_bytes(uint64_t count) {
+    return (count * sizeof(uint64_t) + SHM_CACHE_LINE - 1) & ~(uint64_t)(SHM_CACHE_LINE - 1);
+}
+
+// Largest power of two of slots that fits with its sequence words, or 0.
+static uint64_t slot_count_for(uint64_t capacity, uint32_t slot_size) {
+    uint64_t count = 0;
+    while (slot_seq_bytes(count ? 2 * count : 1) + (count ? 2 * count : 1) * slot_size <= capacity) {
+        count = count ? 2 * count : 1;
+    }
+    return count;
+}
+
+// slot_size 0 lays out a record ring, anything else a slot queue.
+static void ring_init(uint8_t *base, size_t shm_size, uint32_t slot_size) {
+    shm_ring_hdr_t *h = (shm_ring_hdr_t*)base;
+    memset(h, 0, sizeof(shm_ring_hdr_t));
+    h->magic = SHM_HDR_MAGIC;
+    h->version = SHM_HDR_VERSION;
+    h->capacity = (shm_size - SHM_HDR_SIZE) & ~(uint64_t)(SHM_REC_ALIGN - 1);
+    if (!slot_size) return;
+
+    uint64_t count = slot_count_for(h->capacity, slot_size);
+    h->slot_size = slot_size;
+    h->slot_count = (uint32_t)count;
+    _Atomic uint64_t *seq = (_Atomic uint64_t*)(base + SHM_HDR_SIZE);
+    for (uint64_t i = 0; i < count; i++) atomic_store_explicit(&seq[i], i, memory_order_relaxed);
+}
+
+// Puts the commit bitmap in front of a fresh record ring, in whole cache lines
+static void ring_init_commit(uint8_t *base) {
+    shm_ring_hdr_t *h = (shm_ring_hdr_t*)base;
+    uint64_t bits_per_byte = 8 * SHM_REC_ALIGN; // Record bytes one bitmap byte covers
+    uint64_t bytes = (h->capacity + bits_per_byte) / (bits_per_byte + 1);
+    bytes = (bytes + SHM_CACHE_LINE - 1) & ~(uint64_t)(SHM_CACHE_LINE - 1);
+
+    memset(base + SHM_HDR_SIZE, 0, bytes);
+    h->commit_bytes = (uint32_t)bytes;
+    h->capacity = (h->capacity - bytes) & ~(uint64_t)(SHM_REC_ALIGN - 1);
+}
+
+static int ring_attach(shm_ring_t *r, uint8_t *base, size_t shm_size, int efd_send, int efd_ack) {
+    shm_ring_hdr_t *h = (shm_ring_hdr_t*)base;
+    if (h->magic != SHM_HDR_MAGIC || h->version != SHM_HDR_VERSION) return -1;
+    if (h->capacity == 0 || h->capacity + h->commit_bytes > shm_size - SHM_HDR_SIZE) return -1;
+
+    r->hdr = h;
+    r->data = base + SHM_HDR_SIZE + h->commit_bytes;
+    r->capacity = h->capacity;
+    r->efd_send = efd_send;
+    r->efd_ack = efd_ack;
+    r->tail = atomic_load(&h->tail);
+    r->next_head = 0;
+    r->reserved = 0;
+    r->corrupt = 0;
+
+    r->slot_size = h->slot_size;
+    if (h->slot_size) {
+        uint64_t count = h->slot_count;
+        if (h->slot_size % SHM_CACHE_LINE != 0 || count == 0 || (count & (count - 1)) != 0) return -1;
+        if (slot_seq_bytes(count) + count * h->slot_size > h->capacity) return -1;
+        r->slot_mask = count - 1;
+        r->seq = (_Atomic uint64_t*)r->data;
+        r->slots = r->data + slot_seq_bytes(count);
+    }
+
+    r->commit = NULL;
+    if (h->commit_bytes) {
+        if (h->slot_size || h->commit_bytes % SHM_CACHE_LINE != 0) return -1;
+        if (h->capacity % SHM_REC_ALIGN != 0 || h->capacity > (uint64_t)h->commit_bytes * 8 * SHM_REC_ALIGN) return -1;
+        r->commit = (_Atomic uint64_t*)(base + SHM_HDR_SIZE);
+    }
+    return 0;
+}
+
+// The waiting flags double as shared futex words; their value says how to wake
+// the sleeper. A timeout_ns of 0 waits forever.
+static inline int futex_wait(_Atomic uint32_t *word, uint32_t val, uint64_t timeout_ns) {
+    struct timespec ts = { (time_t)(timeout_ns / 1000000000u), (long)(timeout_ns % 1000000000u) };
+    if (syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, val, timeout_ns ? &ts : NULL, NULL, 0) == 0 ||
+        errno != ETIMEDOUT) return 0;
+    errno = EAGAIN;
+    return -1;
+}
+
+// Wakes every sleeper: the producers of a multi-producer ring share one
+// waiting flag.
+static inline int futex_wake(_Atomic uint32_t *word) {
+    return syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0) == -1 ? -1 : 0;
+}
+
+// Producers of a multi-producer ring may sleep both ways at once, so the
+// flag is a mask of SHM_WAIT_* bits.
+static int ring_wake(shm_ring_t *r, _Atomic uint32_t *waiting, int efd, uint64_t val) {
+    if (atomic_load(waiting) == 0) return 0;
+
+    uint32_t kind = atomic_exchange(waiting, 0);
+    int ret = 0;
+    if ((kind & SHM_WAIT_EFD) && efd_signal(r->uring, efd, val) != 0) ret = -1;
+    if ((kind & SHM_WAIT_FUTEX) && futex_wake(waiting) != 0) ret = -1;
+    return ret;
+}
+
+static inline uint32_t ring_wait_kind(const shm_ring_t *r) {
+    return r->futex ? SHM_WAIT_FUTEX : SHM_WAIT_EFD;
+}
+
+// Blocks once the flag is published and the condition re-checked. Past the
+// deadline it fails with EAGAIN and leaves the flag armed.
+static int ring_sleep(shm_ring_t *r, _Atomic uint32_t *waiting, int efd, uint64_t deadline) {
+    uint64_t val, start = stats_clock();
+    int ret;
+    if (deadline && start >= deadline) {
+        errno = EAGAIN;
+        ret = -1;
+    } else if (r->futex) {
+        ret = futex_wait(waiting, SHM_WAIT_FUTEX, deadline ? deadline - start : 0);
+    } else {
+        ret = deadline ? efd_read_until(efd, &val, deadline) : efd_recv(r->uring, efd, &val);
+    }
+    stats_blocked(r, start);
+    if (ret != 0 && deadline && errno == EAGAIN) r->stats.timeouts++;
+    return ret;
+}
+
+// Makes every record written so far visible. count is what a sleeping
+// consumer reads from its eventfd: the number of frames published.
+static int ring_publish(shm_ring_t *r, uint64_t count) {
+    uint64_t start = stats_trace_clock(r);
+    atomic_store(&r->hdr->tail, r->tail);
+    int ret = ring_wake(r, &r->hdr->consumer_waiting, r->efd_send, count);
+    stats_stage(r, SHM_STAGE_SIGNAL, start);
+    SHM_PROBE(send_signal, r, count);
+    return ret;
+}
+
+// Producer: free bytes, the consumer's SHM_HEAD_BUSY claim masked out.
+static inline uint64_t ring_space(const shm_ring_t *r, memory_order order) {
+    return r->capacity - (r->tail - (atomic_load_explicit(&r->hdr->head, order) & ~SHM_HEAD_BUSY));
+}
+
+// SHM_OVERFLOW_DROP_OLDEST: moves head past the oldest records until need bytes
+// are free. Fails while the consumer holds SHM_HEAD_BUSY.
+static int ring_drop(shm_ring_t *r, uint64_t need) {
+    shm_ring_hdr_t *h = r->hdr;
+    uint64_t head = atomic_load(&h->head);
+
+    while (!(head & SHM_HEAD_BUSY)) {
+        uint64_t tail = atomic_load_explicit(&h->tail, memory_order_relaxed);
+        uint64_t pos = head, dropped = 0;
+        while (pos != tail && r->capacity - (r->tail - pos) < need) {
+            const shm_rec_t *rec = (const shm_rec_t*)(r->data + pos % r->capacity);
+            if (!(rec->flags & SHM_REC_PAD)) dropped++;
+            pos += ring_rec_size(rec->len);
+        }
+        if (atomic_compare_exchange_weak(&h->head, &head, pos)) {
+            r->stats.dropped += dropped;
+            return r->capacity - (r->tail - pos) >= need ? 0 : -1;
+        }
+    }
+    return -1;
+}
+
+// Waiters spin on the peer's index, then publish a flag, re-check and block;
+// the peer only signals when it sees the flag
+static int ring_wait_space(shm_ring_t *r, uint64_t need) {
+    shm_ring_hdr_t *h = r->hdr;
+
+    for (uint32_t i = 0; i < r->spin; i++) {
+        if (ring_space(r, memory_order_acquire) >= need) {
+            if (i) r->stats.spin_wakeups++;
+            return 0;
+        }
+        cpu_relax();
+    }
+
+    uint64_t deadline = deadline_after(r->timeout_ns);
+    while (1) {
+        if (ring_space(r, memory_order_acquire) >= need) return 0;
+
+        // Records of a half-built batch must be visible before we sleep,
+        // otherwise the consumer can never free the space we wait for.
+        if (atomic_load_explicit(&h->tail, memory_order_relaxed) != r->tail) {
+            if (ring_publish(r, 1) != 0) return -1;
+        }
+        if (r->overflow == SHM_OVERFLOW_DROP_OLDEST && ring_drop(r, need) == 0) return 0;
+
+        atomic_store(&h->producer_waiting, ring_wait_kind(r));
+        if (ring_space(r, memory_order_seq_cst) >= need) {
+            atomic_store(&h->producer_waiting, 0);
+            return 0;
+        }
+
+        if (ring_sleep(r, &h->producer_waiting, r->efd_ack, deadline) != 0) return -1;
+    }
+}
+
+// Consumer: whether the record at head is there to read (its commit bit, in a
+// multi-producer ring)
+static inline int ring_readable(const shm_ring_t *r, uint64_t head, memory_order order) {
+    if (!r->commit) return atomic_load_explicit(&r->hdr->tail, order) != head;
+    uint64_t unit = head % r->capacity / SHM_REC_ALIGN;
+    return (atomic_load_explicit(&r->commit[unit / 64], order) >> (unit % 64)) & 1;
+}
+
+static int ring_wait_data(shm_ring_t *r, uint64_t head) {
+    shm_ring_hdr_t *h = r->hdr;
+
+    for (uint32_t i = 0; i < r->spin; i++) {
+        if (ring_readable(r, head, memory_order_acquire)) {
+            if (i) r->stats.spin_wakeups++;
+            return 0;
+        }
+        cpu_relax();
+    }
+
+    while (1) {
+        if (ring_readable(r, head, memory_order_acquire)) return 0;
+
+        atomic_store(&h->consumer_waiting, ring_wait_kind(r));
+        if (ring_readable(r, head, memory_order_seq_cst)) {
+            atomic_store(&h->consumer_waiting, 0);
+            return 0;
+        }
+
+        if (ring_sleep(r, &h->consumer_waiting, r->efd_send, 0) != 0) return -1;
+    }
+}
+
+// Non-blocking waits. On EAGAIN the flag stays armed and the stale eventfd
+// count is drained, so a level-triggered poller settles.
+static int ring_try_space(shm_ring_t *r, uint64_t need) {
+    shm_ring_hdr_t *h = r->hdr;
+    uint64_t ack_val;
+
+    if (ring_space(r, memory_order_acquire) >= need) return 0;
+    if (r->overflow == SHM_OVERFLOW_DROP_OLDEST && ring_drop(r, need) == 0) return 0;
+    if (efd_try_read(r->efd_ack, &ack_val) < 0) return -1;
+
+    atomic_store(&h->producer_waiting, SHM_WAIT_EFD);
+    if (ring_space(r, memory_order_seq_cst) >= need) {
+        atomic_store(&h->producer_waiting, 0);
+        return 0;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+static int ring_try_data(shm_ring_t *r, uint64_t head) {
+    shm_ring_hdr_t *h = r->hdr;
+    uint64_t send_val;
+
+    if (ring_readable(r, head, memory_order_acquire)) return 0;
+    if (efd_try_read(r->efd_send, &send_val) < 0) return -1;
+
+    atomic_store(&h->consumer_waiting, SHM_WAIT_EFD);
+    if (ring_readable(r, head, memory_order_seq_cst)) {
+        atomic_store(&h->consumer_waiting, 0);
+        return 0;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+// Slot queues: same flags and eventfds as the record ring, but waits are on a
+// slot's sequence word instead of the peer's index
+static int slot_wait(shm_ring_t *r, uint64_t pos, uint64_t want, int producer, int block) {
+    shm_ring_hdr_t *h = r->hdr;
+    _Atomic uint64_t *seq = &r->seq[pos & r->slot_mask];
+    _Atomic uint32_t *waiting = producer ? &h->producer_waiting : &h->consumer_waiting;
+    int efd = producer ? r->efd_ack : r->efd_send;
+    uint64_t val;
+
+    if (atomic_load_explicit(seq, memory_order_acquire) == want) return 0;
+
+    if (!block || (producer && r->overflow == SHM_OVERFLOW_FAIL)) {
+        if (efd_try_read(efd, &val) < 0) return -1;
+        atomic_store(waiting, SHM_WAIT_EFD);
+        if (atomic_load(seq) == want) {
+            atomic_store(waiting, 0);
+            return 0;
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < r->spin; i++) {
+        cpu_relax();
+        if (atomic_load_explicit(seq, memory_order_acquire) == want) {
+            r->stats.spin_wakeups++;
+            return 0;
+        }
+    }
+
+    uint64_t deadline = producer ? deadline_after(r->timeout_ns) : 0;
+    while (1) {
+        // Same as ring_wait_space: filled slots must be announced first
+        if (producer && atomic_load_explicit(&h->tail, memory_order_relaxed) != r->tail) {
+            if (ring_publish(r, 1) != 0) return -1;
+        }
+
+        atomic_store(waiting, ring_wait_kind(r));
+        if (atomic_load(seq) == want) {
+            atomic_store(waiting, 0);
+            return 0;
+        }
+
+        if (ring_sleep(r, waiting, efd, deadline) != 0) return -1;
+        if (atomic_load_explicit(seq, memory_order_acquire) == want) return 0;
+    }
+}
+
+static inline uint8_t* slot_ptr(const shm_ring_t *r, uint64_t pos) {
+    return r->slots + (pos & r->slot_mask) * r->slot_size;
+}
+
+// Slots from pos on whose sequence word holds pos + bias, at least the first
+// one (already waited for), at most max and never past the end of the array.
+static int slot_run(const shm_ring_t *r, uint64_t pos, uint64_t bias, int max) {
+    uint64_t room = r->slot_mask + 1 - (pos & r->slot_mask);
+    int n = 1;
+    while (n < max && (uint64_t)n < room &&
+           atomic_load_explicit(&r->seq[(pos + n) & r->slot_mask], memory_order_acquire) == pos + n + bias) n++;
+    return n;
+}
+
+static uint8_t* slot_reserve(shm_ring_t *r, int max, int block, int *n) {
+    if (max < 1) max = 1;
+    r->send_start = stats_start(r);
+    if (slot_wait(r, r->tail, r->tail, 1, block) != 0) return NULL;
+
+    r->reserved_pos = r->tail;
+    r->reserved_len = (size_t)slot_run(r, r->tail, 0, max);
+    r->reserved = 1;
+    *n = (int)r->reserved_len;
+    return slot_ptr(r, r->tail);
+}
+
+// Hands the first n reserved slots to the consumer, without waking it.
+static int slot_fill(shm_ring_t *r, int n) {
+    if (!r->reserved || n < 1 || (size_t)n > r->reserved_len) return -1;
+
+    for (int i = 0; i < n; i++) {
+        uint64_t pos = r->reserved_pos + (uint64_t)i;
+        atomic_store_explicit(&r->seq[pos & r->slot_mask], pos + 1, memory_order_release);
+    }
+    r->reserved = 0;
+    r->tail = r->reserved_pos + (uint64_t)n;
+    r->stats.msgs += (uint64_t)n;
+    r->stats.bytes += (uint64_t)n * r->slot_size;
+    return 0;
+}
+
+static int slot_commit(shm_ring_t *r, int n) {
+    if (slot_fill(r, n) != 0) return -1;
+    if (ring_publish(r, (uint64_t)n) != 0) return -1;
+    stats_latency(r, r->send_start);
+    return 0;
+}
+
+static const uint8_t* slot_peek(shm_ring_t *r, int max, int block, int *n) {
+    uint64_t head = atomic_load_explicit(&r->hdr->head, memory_order_relaxed);
+    uint64_t start = block ? stats_start(r) : 0;
+    if (max < 1) max = 1;
+    if (slot_wait(r, head, head + 1, 0, block) != 0) return NULL;
+
+    *n = slot_run(r, head, 1, max);
+    r->next_head = head + (uint64_t)*n;
+    r->stats.msgs += (uint64_t)*n;
+    r->stats.bytes += (uint64_t)*n * r->slot_size;
+    stats_latency(r, start);
+    return slot_ptr(r, head);
+}
+
+static int slot_release(shm_ring_t *r) {
+    shm_ring_hdr_t *h = r->hdr;
+    uint64_t count = r->slot_mask + 1;
+    for (uint64_t pos = atomic_load_explicit(&h->head, memory_order_relaxed); pos != r->next_head; pos++) {
+        atomic_store_explicit(&r->seq[pos & r->slot_mask], pos + count, memory_order_release);
+    }
+    atomic_store(&h->head, r->next_head);
+    return ring_wake(r, &h->producer_waiting, r->efd_ack, 1);
+}
+
+// Producer: bytes of shm_trace_t appended to each record
+static inline size_t ring_trace_bytes(const shm_ring_t *r) {
+    int trace = (r->stats_flags & SHM_STATS_TRACE) && r->peer_trace && !r->slot_size && !r->commit;
+    return trace ? sizeof(shm_trace_t) : 0;
+}
+
+// A record up to half the capacity always fits once the ring drains
+static inline int ring_fits(const shm_ring_t *r, size_t len) {
+    if (r->slot_size) return len <= r->slot_size;
+    return ring_rec_size(len + ring_trace_bytes(r)) <= r->capacity / 2;
+}
+
+static inline size_t ring_max_payload(uint64_t capacity) {
+    return (size_t)(((capacity / 2) & ~(uint64_t)(SHM_REC_ALIGN - 1)) - sizeof(shm_rec_t));
+}
+
+// Multi-producer rings: the shared tail is the only producer index, and a
+// record is handed over by its commit bit alone
+static inline void mp_mark(shm_ring_t *r, uint64_t pos) {
+    uint64_t unit = pos % r->capacity / SHM_REC_ALIGN;
+    atomic_fetch_or(&r->commit[unit / 64], 1ull << (unit % 64));
+}
+
+static void mp_pad(shm_ring_t *r, uint64_t pos, uint64_t size) {
+    shm_rec_t *pad_rec = (shm_rec_t*)(r->data + pos % r->capacity);
+    pad_rec->len = (uint32_t)(size - sizeof(shm_rec_t));
+    pad_rec->flags = SHM_REC_PAD;
+    mp_mark(r, pos);
+}
+
+// Waits for the consumer to move head. Blocked producers share the flag and
+// sleep on it as a futex, since an eventfd count would wake only one.
+static int mp_wait_head(shm_ring_t *r, uint64_t head, int block, uint64_t deadline) {
+    shm_ring_hdr_t *h = r->hdr;
+
+    if (!block) {
+        uint64_t ack_val;
+        if (efd_try_read(r->efd_ack, &ack_val) < 0) return -1;
+        atomic_fetch_or(&h->producer_waiting, SHM_WAIT_EFD);
+        if (atomic_load(&h->head) != head) return 0;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < r->spin; i++) {
+        if (atomic_load_explicit(&h->head, memory_order_acquire) != head) {
+            if (i) stats_add(&r->stats.spin_wakeups, 1);
+            return 0;
+        }
+        cpu_relax();
+    }
+
+    while (1) {
+        uint32_t armed = atomic_fetch_or(&h->producer_waiting, SHM_WAIT_FUTEX) | SHM_WAIT_FUTEX;
+        if (atomic_load(&h->head) != head) return 0;
+
+        uint64_t start = stats_clock();
+        int ret;
+        if (deadline && start >= deadline) {
+            errno = EAGAIN;
+            ret = -1;
+        } else {
+            ret = futex_wait(&h->producer_waiting, armed, deadline ? deadline - start : 0);
+        }
+        stats_add(&r->stats.blocks, 1);
+        stats_add(&r->stats.blocked_ns, stats_clock() - start);
+        if (ret != 0) {
+            if (deadline && errno == EAGAIN) stats_add(&r->stats.timeouts, 1);
+            return -1;
+        }
+    }
+}
+
+// Claims need bytes (plus any wrap padding) at the tail with a CAS, once the
+// space is known to be free. *pos is where the record goes.
+static int mp_claim(shm_ring_t *r, uint64_t need, int block, uint64_t *pos) {
+    shm_ring_hdr_t *h = r->hdr;
+    if (r->overflow == SHM_OVERFLOW_FAIL) block = 0;
+    uint64_t deadline = block ? deadline_after(r->timeout_ns) : 0;
+    uint64_t tail = atomic_load_explicit(&h->tail, memory_order_relaxed);
+    uint64_t pad;
+
+    while (1) {
+        uint64_t off = tail % r->capacity;
+        pad = (r->capacity - off < need) ? r->capacity - off : 0;
+        uint64_t head = atomic_load_explicit(&h->head, memory_order_acquire);
+
+        // A stale tail only underestimates the space, and fails the CAS
+        if (r->capacity - (tail - head) < pad + need) {
+            if (mp_wait_head(r, head, block, deadline) != 0) return -1;
+            tail = atomic_load_explicit(&h->tail, memory_order_relaxed);
+        } else if (atomic_compare_exchange_weak(&h->tail, &tail, tail + pad + need)) {
+            break;
+        }
+    }
+
+    if (pad) mp_pad(r, tail, pad);
+    *pos = tail + pad;
+    return 0;
+}
+
+// Frames the record claimed at pos for claim bytes, pads what a shorter
+// len leaves of the claim, and hands both to the consumer.
+static int mp_commit(shm_ring_t *r, uint64_t pos, uint64_t claim, size_t len, uint32_t flags) {
+    uint64_t size = ring_rec_size(len);
+    if (size < claim) mp_pad(r, pos + size, claim - size);
+
+    shm_rec_t *rec = (shm_rec_t*)(r->data + pos % r->capacity);
+    rec->len = (uint32_t)len;
+    rec->flags = flags;
+    mp_mark(r, pos);
+    stats_add(&r->stats.msgs, 1);
+    stats_add(&r->stats.bytes, len);
+    return ring_wake(r, &r->hdr->consumer_waiting, r->efd_send, 1);
+}
+
+// Claims a record of len payload bytes, to be passed to mp_commit with
+// its *pos.
+static uint8_t* mp_reserve(shm_ring_t *r, size_t len, int block, uint64_t *pos) {
+    if (!ring_fits(r, len)) {
+        stats_add(&r->stats.too_large, 1);
+        errno = EMSGSIZE;
+        return NULL;
+    }
+    if (mp_claim(r, ring_rec_size(len), block, pos) != 0) return NULL;
+    return r->data + *pos % r->capacity + sizeof(shm_rec_t);
+}
+
+static int mp_send(shm_ring_t *r, const uint8_t *data, size_t len, int block) {
+    uint64_t pos;
+    uint8_t *dst = mp_reserve(r, len, block, &pos);
+    if (!dst) return -1;
+    shm_copy(dst, data, len);
+    return mp_commit(r, pos, ring_rec_size(len), len, 0);
+}
+
+// Lends len contiguous payload bytes at the tail, waiting while the ring is full
+// (unless !block or the overflow policy says otherwise). Published by commit.
+static uint8_t* ring_reserve(shm_ring_t *r, size_t len, int block) {
+    if (!ring_fits(r, len)) return stats_too_large(r);
+    if (r->overflow == SHM_OVERFLOW_FAIL) block = 0;
+    if (r->slot_size) {
+        int n;
+        return slot_reserve(r, 1, block, &n);
+    }
+    // The claim would live in the shared ring, so only whole sends are
+    // multi-producer safe
+    if (r->commit) {
+        errno = EINVAL;
+        return NULL;
+    }
+    r->send_start = stats_start(r);
+    SHM_PROBE(send_reserve, r, len);
+
+    uint64_t need = ring_rec_size(len + ring_trace_bytes(r));
+
+    uint64_t off = r->tail % r->capacity;
+    uint64_t pad = (r->capacity - off < need) ? r->capacity - off : 0;
+
+    if ((block ? ring_wait_space(r, pad + need) : ring_try_space(r, pad + need)) != 0) return NULL;
+
+    uint64_t pos = r->tail;
+    if (pad) {
+        shm_rec_t *pad_rec = (shm_rec_t*)(r->data + off);
+        pad_rec->len = (uint32_t)(pad - sizeof(shm_rec_t));
+        pad_rec->flags = SHM_REC_PAD;
+        pos += pad;
+    }
+
+    r->reserved_pos = pos;
+    r->reserved_len = len;
+    r->reserved = 1;
+    return r->data + pos % r->capacity + sizeof(shm_rec_t);
+}
+
+// Frames the reserved record, which may be shorter than the reservation,
+// and appends it to the local tail without publishing it.
+static int ring_fill(shm_ring_t *r, size_t len, uint32_t flags) {
+    if (r->slot_size) return len <= r->slot_size ? slot_fill(r, 1) : -1;
+    if (!r->reserved || len > r->reserved_len) return -1;
+
+    shm_rec_t *rec = (shm_rec_t*)(r->data + r->reserved_pos % r->capacity);
+    size_t framed = len;
+    if (ring_trace_bytes(r)) {
+        shm_trace_t trace = { r->send_start, stats_stage(r, SHM_STAGE_COPY, r->send_start) };
+        memcpy((uint8_t*)(rec + 1) + len, &trace, sizeof(trace));
+        framed += sizeof(trace);
+        flags |= SHM_REC_TRACE;
+    }
+    rec->len = (uint32_t)framed;
+    rec->flags = flags;
+    r->reserved = 0;
+    r->tail = r->reserved_pos + ring_rec_size(framed);
+    stats_count(r, len);
+    SHM_PROBE(send_commit, r, len);
+    return 0;
+}
+
+static int ring_commit(shm_ring_t *r, size_t len) {
+    if (ring_fill(r, len, 0) != 0) return -1;
+    if (ring_publish(r, 1) != 0) return -1;
+    stats_latency(r, r->send_start);
+    return 0;
+}
+
+static inline int ring_compresses(const shm_ring_t *r, size_t len) {
+    return r->compress_min && len >= r->compress_min && !r->slot_size;
+}
+
+// Compresses into a reserved record without publishing it; a message that
+// does not compress is copied as is
+static int ring_fill_lz4(shm_ring_t *r, const uint8_t *data, size_t len, int block) {
+    size_t room = ring_max_payload(r->capacity) - ring_trace_bytes(r);
+    if (room > len) room = len;
+    uint8_t *dst = ring_reserve(r, room, block);
+    if (!dst) return -1;
+
+    size_t n = lz4_frame(dst, room, data, len);
+    if (n) return ring_fill(r, n, SHM_REC_LZ4);
+    if (len <= room) {
+        shm_copy(dst, data, len);
+        return ring_fill(r, len, 0);
+    }
+    r->reserved = 0;
+    stats_too_large(r);
+    return -1;
+}
+
+static int ring_send_lz4(shm_ring_t *r, const uint8_t *data, size_t len, int block) {
+    if (ring_fill_lz4(r, data, len, block) != 0) return -1;
+    if (ring_publish(r, 1) != 0) return -1;
+    stats_latency(r, r->send_start);
+    return 0;
+}
+
+// Writes all messages and publishes them with a single tail update, so a
+// sleeping consumer is woken at most once for the whole batch.
+static int ring_send_batch(shm_ring_t *r, const struct iovec *msgs, int n) {
+    for (int i = 0; i < n; i++) {
+        if (!ring_fits(r, msgs[i].iov_len)) {
+            stats_too_large(r);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        int ret = 0;
+        if (ring_compresses(r, msgs[i].iov_len)) {
+            ret = ring_fill_lz4(r, (const uint8_t*)msgs[i].iov_base, msgs[i].iov_len, 1);
+        } else {
+            uint8_t *dst = ring_reserve(r, msgs[i].iov_len, 1);
+            if (dst) {
+                shm_copy(dst, (const uint8_t*)msgs[i].iov_base, msgs[i].iov_len);
+                ring_fill(r, msgs[i].iov_len, 0);
+            } else {
+                ret = -1;
+            }
+        }
+
+        // Out of room under the overflow policy: the messages before this
+        // one are sent anyway
+        if (ret != 0) {
+            int err = errno;
+            if (i > 0) ring_publish(r, (uint64_t)i);
+            errno = err;
+            return -1;
+        }
+    }
+    return ring_publish(r, (uint64_t)n);
+}
+
+// Chunk size for streamed messages. Each chunk is a quarter of the ring, so
+// the producer can fill one chunk while the consumer still copies another.
+static inline size_t ring_stream_chunk(const shm_ring_t *r) {
+    if (r->slot_size) return r->slot_size;
+    return (ring_max_payload(r->capacity) / 2) & ~(size_t)(SHM_REC_ALIGN - 1);
+}
+
+// Splits a message of any size into SHM_REC_MORE fragments. Each fragment
+// is published on its own so the consumer starts copying right away.
+static int ring_send_stream(shm_ring_t *r, const uint8_t *data, size_t len) {
+    size_t chunk = ring_stream_chunk(r);
+
+    // Slots have no room for fragment flags
+    if (r->slot_size && len > chunk) {
+        stats_too_large(r);
+        return -1;
+    }
+    // A dropped fragment would splice two messages together
+    if (r->overflow == SHM_OVERFLOW_DROP_OLDEST && len > chunk) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    do {
+        size_t n = len > chunk ? chunk : len;
+        uint8_t *dst = ring_reserve(r, n, 1);
+        if (!dst) return -1;
+        shm_copy(dst, data, n);
+        ring_fill(r, n, n < len ? SHM_REC_MORE : 0);
+        if (ring_publish(r, 1) != 0) return -1;
+        data += n;
+        len -= n;
+    } while (len > 0);
+
+    return 0;
+}
+
+// Lends up to max available records in place (waiting for one if block),
+// until ring_release
+// Consumer: releases a record that cannot be lent, so the producer is not
+// stuck behind it, and fails with EBADMSG
+static int ring_drop_record(shm_ring_t *r, uint64_t head, uint64_t size) {
+    if (r->commit) {
+        uint64_t unit = head % r->capacity / SHM_REC_ALIGN;
+        atomic_fetch_and_explicit(&r->commit[unit / 64], ~(1ull << (unit % 64)), memory_order_relaxed);
+    }
+    atomic_store(&r->hdr->head, head + size);
+    ring_wake(r, &r->hdr->producer_waiting, r->efd_ack, 1);
+    errno = EBADMSG;
+    return -1;
+}
+
+static int ring_peek_batch(shm_ring_t *r, struct iovec *msgs, int max, int block) {
+    if (r->slot_size) {
+        int n;
+        const uint8_t *slot = slot_peek(r, max, block, &n);
+        if (!slot) return -1;
+        for (int i = 0; i < n; i++) {
+            msgs[i].iov_base = (void*)(slot + (size_t)i * r->slot_size);
+            msgs[i].iov_len = r->slot_size;
+        }
+        r->lent_ns = stats_trace_clock(r);
+        SHM_PROBE(recv_lent, r, n);
+        return n;
+    }
+
+    if (r->corrupt) {
+        errno = EBADMSG;
+        return -1;
+    }
+    shm_ring_hdr_t *h = r->hdr;
+    uint64_t head = atomic_load_explicit(&h->head, memory_order_relaxed);
+    uint64_t start = block ? stats_start(r) : 0, lent = 0;
+    int n = 0;
+
+    while (n == 0) {
+        if ((block ? ring_wait_data(r, head) : ring_try_data(r, head)) != 0) return -1;
+        // Claim the records, unless the producer has dropped them meanwhile
+        if (h->drop_oldest && !atomic_compare_exchange_strong(&h->head, &head, head | SHM_HEAD_BUSY)) continue;
+
+        uint64_t tail = atomic_load_explicit(&h->tail, memory_order_acquire);
+        while (head != tail && n < max) {
+            // Claimed, but still being written by its producer
+            if (r->commit && !ring_readable(r, head, memory_order_acquire)) break;
+
+            uint64_t off = head % r->capacity;
+            const shm_rec_t *rec = (const shm_rec_t*)(r->data + off);
+            uint64_t size = ring_rec_size(rec->len);
+            int bad_size = size > tail - head || off + size > r->capacity;
+            if (bad_size || ((rec->flags & SHM_REC_TRACE) && rec->len < sizeof(shm_trace_t))) {
+                // Lend what came before it; the next call reports it
+                if (n > 0) break;
+                fprintf(stderr, "Corrupt ring record at %lu\n", head);
+                if (!bad_size) return ring_drop_record(r, head, size);
+                // Nothing to skip to: give the claim back, so the producer
+                // can still drop and reclaim, and fail every read from now on
+                if (h->drop_oldest) atomic_store(&h->head, head);
+                r->corrupt = 1;
+                errno = EBADMSG;
+                return -1;
+            }
+
+            // Fragments of a streamed message are always lent one at a time,
+            // and so are compressed records, from the decompression buffer
+            int frag = (rec->flags & SHM_REC_MORE) != 0;
+            int lz4 = (rec->flags & SHM_REC_LZ4) != 0;
+            if ((frag || lz4) && n > 0) break;
+
+            // The bit goes before the head moves on and the space is reused
+            if (r->commit) {
+                uint64_t unit = off / SHM_REC_ALIGN;
+                atomic_fetch_and_explicit(&r->commit[unit / 64], ~(1ull << (unit % 64)), memory_order_relaxed);
+            }
+
+            size_t rec_len = rec->len;
+            if (rec->flags & SHM_REC_TRACE) {
+                shm_trace_t trace;
+                rec_len -= sizeof(trace);
+                memcpy(&trace, (const uint8_t*)(rec + 1) + rec_len, sizeof(trace));
+                if (!lent) lent = stats_trace_clock(r);
+                if (lent && trace.commit_ns && lent > trace.commit_ns) {
+                    hist_record(&r->stats.stage_ns[SHM_STAGE_WAKE], lent - trace.commit_ns);
+                }
+            }
+
+            if (lz4) {
+                const uint8_t *data;
+                size_t len;
+                if (lz4_unframe(r, (const uint8_t*)(rec + 1), rec_len, &data, &len) != 0) {
+                    return ring_drop_record(r, head, size);
+                }
+                msgs[n].iov_base = (void*)data;
+                msgs[n].iov_len = len;
+                stats_count(r, rec_len);
+                n++;
+            } else if (!(rec->flags & SHM_REC_PAD)) {
+                msgs[n].iov_base = (void*)(rec + 1);
+                msgs[n].iov_len = rec_len;
+                stats_count(r, rec_len);
+                n++;
+            }
+            head += size;
+            if (frag || lz4) break;
+        }
+        // Only padding: give it back, so the producer is free to drop again
+        if (n == 0 && h->drop_oldest) atomic_store(&h->head, head);
+    }
+
+    r->next_head = head;
+    r->lent_ns = lent ? lent : stats_trace_clock(r);
+    stats_latency(r, start);
+    SHM_PROBE(recv_lent, r, n);
+    return n;
+}
+
+static int ring_peek(shm_ring_t *r, const uint8_t **data, size_t *len, int block) {
+    struct iovec msg;
+    if (ring_peek_batch(r, &msg, 1, block) != 1) return -1;
+    *data = (const uint8_t*)msg.iov_base;
+    *len = msg.iov_len;
+    return 0;
+}
+
+static int ring_release(shm_ring_t *r) {
+    stats_end_read(r);
+    if (r->slot_size) return slot_release(r);
+    shm_ring_hdr_t *h = r->hdr;
+    atomic_store(&h->head, r->next_head);
+    return ring_wake(r, &h->producer_waiting, r->efd_ack, 1);
+}
+
+// True when a record lent by ring_peek is followed by more of its message.
+// Decompressed messages are lent from a buffer and are always whole.
+static inline int ring_is_fragment(const shm_ring_t *r, const uint8_t *data) {
+    if (data == r->lz4_buf) return 0;
+    return (((const shm_rec_t*)data - 1)->flags & SHM_REC_MORE) != 0;
+}
+
+// Copies the rest of a streamed message whose first fragment is peeked into
+// *buf, releasing each fragment as it goes; *len is the total length
+static int ring_read_stream(shm_ring_t *r, const uint8_t *data, size_t len, shm_buf_pool_t *pool,
+                            uint8_t **buf, size_t *cap, size_t *total) {
+    size_t used = 0;
+    int more;
+
+    while (1) {
+        if (used + len > *cap) {
+            size_t new_cap = *cap ? *cap : len;
+            while (new_cap < used + len) new_cap *= 2;
+            uint8_t *grown = pool ? pool_realloc(pool, *buf, used, new_cap) : (uint8_t*)realloc(*buf, new_cap);
+            if (!grown) return -1;
+            *buf = grown;
+            *cap = new_cap;
+        }
+        memcpy(*buf + used, data, len);
+        used += len;
+
+        more = ring_is_fragment(r, data);
+        if (ring_release(r) != 0) return -1;
+        if (!more) break;
+        if (ring_peek(r, &data, &len, 1) != 0) return -1;
+    }
+
+    *total = used;
+    return 0;
+}
+
+// Producer: punches the data area of an empty ring out of its memfd
+static int ring_trim(shm_ring_t *r, int fd, size_t size, unsigned mem_flags) {
+    // Another producer may claim the space while it is punched
+    if (r->slot_size || r->commit) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (r->reserved || ring_space(r, memory_order_acquire) != r->capacity) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return shm_punch(fd, SHM_HDR_SIZE, size, mem_flags);
+}
+
+static int ring_set_overflow(shm_ring_t *r, shm_overflow_t overflow, int timeout_ms) {
+    if (overflow != SHM_OVERFLOW_BLOCK && overflow != SHM_OVERFLOW_FAIL && overflow != SHM_OVERFLOW_DROP_OLDEST) return -1;
+    if (timeout_ms < -1) return -1;
+    if (overflow == SHM_OVERFLOW_BLOCK && timeout_ms == 0) overflow = SHM_OVERFLOW_FAIL;
+    r->overflow = overflow;
+    r->timeout_ns = (overflow == SHM_OVERFLOW_BLOCK && timeout_ms > 0) ? (uint64_t)timeout_ms * 1000000u : 0;
+    return 0;
+}
+
+// Producer: what the next reservations can take without waiting.
+static size_t ring_credit(const shm_ring_t *r) {
+    if (r->slot_size) {
+        uint64_t used = r->tail - atomic_load_explicit(&r->hdr->head, memory_order_acquire);
+        return (size_t)((r->slot_mask + 1 - used) * r->slot_size);
+    }
+    if (r->commit) {
+        uint64_t head = atomic_load_explicit(&r->hdr->head, memory_order_acquire);
+        return (size_t)(r->capacity - (atomic_load_explicit(&r->hdr->tail, memory_order_relaxed) - head));
+    }
+    return (size_t)ring_space(r, memory_order_acquire);
+}
+
+// --- FD Passing ---
+
+#define MEMFD_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+
+typedef union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int))];
+} sock_ctl_t;
+
+static int sock_pass(int sock, int fd, uint64_t tag) {
+    if (sock == -1) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    sock_ctl_t ctl;
+    memset(&ctl, 0, sizeof(ctl));
+    struct iovec iov = { .iov_base = &tag, .iov_len = sizeof(tag) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf) };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    // MSG_NOSIGNAL: a dead peer is an error, not a SIGPIPE
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(tag) ? 0 : -1;
+}
+
+// Returns the passed FD, close-on-exec, or -1 (EAGAIN with MSG_DONTWAIT
+// when nothing is queued, EPROTO for anything but one FD and a tag).
+static int sock_take(int sock, uint64_t *tag, int flags) {
+    if (sock == -1) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    sock_ctl_t ctl;
+    struct iovec iov = { .iov_base = tag, .iov_len = sizeof(*tag) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf) };
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | flags);
+    if (n == -1) return -1;
+
+    int fd = -1;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(int))) memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    if (n != (ssize_t)sizeof(*tag) || fd == -1 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        if (fd != -1) close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    return fd;
+}
+
+// Closes every FD queued on sock.
+static int sock_drain(int sock) {
+    uint64_t tag;
+    int fd;
+    while ((fd = sock_take(sock, &tag, MSG_DONTWAIT)) != -1 || errno == EPROTO) {
+        if (fd != -1) close(fd);
+    }
+    return errno == EAGAIN ? 0 : -1;
+}
+
+int shm_memfd_create(size_t len) {
+    int fd = memfd_create("efdstream_bulk", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) return -1;
+    if (ftruncate(fd, (off_t)len) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int memfd_pass(int sock, int fd) {
+    struct stat st;
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals == -1 || fstat(fd, &st) != 0) return -1;
+    if ((seals & MEMFD_SEALS) != MEMFD_SEALS && fcntl(fd, F_ADD_SEALS, MEMFD_SEALS) != 0) return -1;
+    return sock_pass(sock, fd, (uint64_t)st.st_size);
+}
+
+// The seals keep the sender from changing the pages under our mapping or
+// truncating them, which would make our reads fault with SIGBUS.
+static int memfd_take(int sock, const uint8_t **data, size_t *len) {
+    uint64_t size;
+    int fd = sock_take(sock, &size, 0);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals == -1 || (seals & MEMFD_SEALS) != MEMFD_SEALS || fstat(fd, &st) != 0 || (uint64_t)st.st_size != size) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+
+    uint8_t *ptr = size ? shm_map(fd, (size_t)size, PROT_READ, 0) : NULL;
+    close(fd);
+    if (ptr == MAP_FAILED) return -1;
+    *data = ptr;
+    *len = (size_t)size;
+    return 0;
+}
+
+void shm_memfd_release(const uint8_t *data, size_t len) {
+    if (data) munmap((void*)data, len);
+}
 
 // --- Parent Implementation ---
 
-shm_parent_t* shm_parent_new(const char *child_path, size_t shm_size) {
-    shm_parent_t *p = (shm_parent_t*)malloc(sizeof(shm_parent_t));
-    if (!p) return NULL;
-    memset(p, 0, sizeof(shm_parent_t));
-    p->child_path = strdup(child_path);
-    p->shm_size = shm_size;
-    return p;
+// Ring and slots modes both keep a header and a ring in each memfd; only
+// record framing (fragments) is specific to SHM_MODE_RING.
+static inline int mode_has_ring(shm_mode_t mode) {
+    return mode == SHM_MODE_RING || mode == SHM_MODE_SLOTS;
+}
+
+static inline uint32_t parent_slot_size(const shm_parent_t *p) {
+    return p->mode == SHM_MODE_SLOTS ? p->slot_size : 0;
+}
+
+static void parent_init(shm_parent_t *p, size_t shm_size) {
+    memset(p, 0, sizeof(shm_parent_t));
+    p->shm_size = shm_size;
+    p->mode = SHM_MODE_STANDARD;
+    p->lane_count = 1;
+
+    p->efd_p2c_send = p->efd_p2c_ack = p->memfd_p2c = -1;
+    p->efd_c2p_send = p->efd_c2p_ack = p->memfd_c2p = -1;
+    p->numa_node = -1;
+    p->sock_fd = p->sock_child_fd = -1;
+    p->slot_size = SHM_CACHE_LINE;
+    p->features = SHM_FEATURES;
+}
+
+shm_parent_t* shm_parent_new(const char *child_path, size_t shm_size) {
+    shm_parent_t *p = (shm_parent_t*)malloc(sizeof(shm_parent_t));
+    if (!p) return NULL;
+    parent_init(p, shm_size);
+    p->child_path = strdup(child_path);
+    return p;
+}
+
+int shm_parent_set_mode(shm_parent_t *p, shm_mode_t mode) {
+    if (p->child_pid > 0) return -1;
+    if (mode_has_ring(mode) && p->shm_size <= SHM_HDR_SIZE + 2 * sizeof(shm_rec_t)) return -1;
+    if (mode == SHM_MODE_AUTO && p->shm_size < sizeof(shm_hello_t)) return -1;
+    if (mode != SHM_MODE_STANDARD && mode != SHM_MODE_RING && mode != SHM_MODE_SLOTS && mode != SHM_MODE_AUTO) return -1;
+    p->mode = mode;
+    return 0;
+}
+
+int shm_parent_set_slot_size(shm_parent_t *p, size_t slot_size) {
+    if (p->child_pid > 0) return -1;
+    if (slot_size == 0 || slot_size > p->shm_size) return -1;
+    p->slot_size = (uint32_t)((slot_size + SHM_CACHE_LINE - 1) & ~(size_t)(SHM_CACHE_LINE - 1));
+    return 0;
+}
+
+int shm_parent_set_mem_flags(shm_parent_t *p, unsigned mem_flags) {
+    if (p->child_pid > 0) return -1;
+    p->mem_flags = mem_flags;
+    // hugetlbfs sizes must be a multiple of the huge page size
+    if (mem_flags & SHM_MEM_HUGETLB) {
+        p->shm_size = (p->shm_size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    }
+    return 0;
+}
+
+int shm_parent_set_nonblock(shm_parent_t *p, int nonblock) {
+    if (p->child_pid > 0) return -1;
+    p->nonblock = nonblock;
+    return 0;
+}
+
+int shm_parent_set_uring(shm_parent_t *p, unsigned uring_flags) {
+    if (p->child_pid > 0) return -1;
+    if (uring_flags && !uring_available(uring_flags)) return -1;
+    p->uring_flags = uring_flags;
+    return 0;
+}
+
+int shm_parent_set_lanes(shm_parent_t *p, int lanes) {
+    if (p->child_pid > 0) return -1;
+    if (lanes < 1 || lanes > SHM_MAX_LANES) return -1;
+    p->lane_count = lanes;
+    return 0;
+}
+
+size_t shm_parent_max_message(const shm_parent_t *p) {
+    if (p->mode == SHM_MODE_SLOTS) return p->slot_size;
+    if (p->mode == SHM_MODE_RING) {
+        return ring_max_payload((p->shm_size - SHM_HDR_SIZE) & ~(uint64_t)(SHM_REC_ALIGN - 1));
+    }
+    return p->shm_size;
+}
+
+unsigned shm_parent_peer_features(const shm_parent_t *p) {
+    return p->peer_features;
+}
+
+// Lays out both memfds of a lane as rings, empty.
+static int parent_init_rings(shm_parent_t *p) {
+    ring_init(p->shm_p2c_ptr, p->shm_size, parent_slot_size(p));
+    ring_init(p->shm_c2p_ptr, p->shm_size, parent_slot_size(p));
+    if (p->multi_producer) ring_init_commit(p->shm_c2p_ptr);
+    if (ring_attach(&p->ring_p2c, p->shm_p2c_ptr, p->shm_size, p->efd_p2c_send, p->efd_p2c_ack) != 0) return -1;
+    if (ring_attach(&p->ring_c2p, p->shm_c2p_ptr, p->shm_size, p->efd_c2p_send, p->efd_c2p_ack) != 0) return -1;
+    p->ring_p2c.hdr->mem_flags = p->mem_flags;
+    p->ring_p2c.hdr->features = p->features;
+    p->ring_p2c.peer_trace = (p->features & SHM_FEAT_TRACE) != 0;
+    p->ring_p2c.hdr->drop_oldest = p->ring_p2c.overflow == SHM_OVERFLOW_DROP_OLDEST;
+    return 0;
+}
+
+// Creates the six resources of one lane and, in ring mode, its ring headers
+static uint8_t* parent_map(shm_parent_t *p, int fd) {
+    if (p->numa_node < 0) return shm_map(fd, p->shm_size, PROT_READ | PROT_WRITE, p->mem_flags);
+
+    uint8_t *ptr = shm_map(fd, p->shm_size, PROT_READ | PROT_WRITE, p->mem_flags & ~SHM_MEM_POPULATE);
+    if (ptr == MAP_FAILED) return ptr;
+    if (shm_bind_node(ptr, p->shm_size, p->numa_node) != 0) {
+        munmap(ptr, p->shm_size);
+        return MAP_FAILED;
+    }
+    shm_advise(ptr, p->shm_size, p->mem_flags & SHM_MEM_POPULATE, 1);
+    return ptr;
+}
+
+static int parent_create_lane(shm_parent_t *p) {
+    unsigned memfd_flags = (p->mem_flags & SHM_MEM_HUGETLB) ? MFD_HUGETLB | MFD_HUGE_2MB : 0;
+    // O_NONBLOCK is shared with the child, so only set it on what we read
+    int efd_flags = p->nonblock ? EFD_NONBLOCK : 0;
+
+    // 1. Create P2C resources
+    p->efd_p2c_send = eventfd(0, 0);
+    if (p->efd_p2c_send == -1) return -1;
+    p->efd_p2c_ack = eventfd(0, efd_flags);
+    if (p->efd_p2c_ack == -1) return -1;
+    p->memfd_p2c = memfd_create("efdstream_shm_p2c", memfd_flags);
+    if (p->memfd_p2c == -1) return -1;
+    if (ftruncate(p->memfd_p2c, p->shm_size) == -1) return -1;
+    p->shm_p2c_ptr = parent_map(p, p->memfd_p2c);
+    if (p->shm_p2c_ptr == MAP_FAILED) return -1;
+
+    // 2. Create C2P resources
+    p->efd_c2p_send = eventfd(0, efd_flags);
+    if (p->efd_c2p_send == -1) return -1;
+    p->efd_c2p_ack = eventfd(0, 0);
+    if (p->efd_c2p_ack == -1) return -1;
+    p->memfd_c2p = memfd_create("efdstream_shm_c2p", memfd_flags);
+    if (p->memfd_c2p == -1) return -1;
+    if (ftruncate(p->memfd_c2p, p->shm_size) == -1) return -1;
+    p->shm_c2p_ptr = parent_map(p, p->memfd_c2p);
+    if (p->shm_c2p_ptr == MAP_FAILED) return -1;
+    p->c2p_size = p->shm_size;
+
+    // Ring headers must be in place before the child maps the regions
+    if (mode_has_ring(p->mode) && parent_init_rings(p) != 0) return -1;
+    return 0;
+}
+
+static void parent_release_lane(shm_parent_t *p) {
+    uring_detach(&p->ring_p2c, &p->ring_c2p);
+    free(p->ring_p2c.lz4_buf);
+    free(p->ring_c2p.lz4_buf);
+
+    if (p->shm_p2c_ptr && p->shm_p2c_ptr != MAP_FAILED) munmap(p->shm_p2c_ptr, p->shm_size);
+    if (p->shm_c2p_ptr && p->shm_c2p_ptr != MAP_FAILED) munmap(p->shm_c2p_ptr, p->c2p_size);
+    
+    if (p->efd_p2c_send != -1) close(p->efd_p2c_send);
+    if (p->efd_p2c_ack != -1) close(p->efd_p2c_ack);
+    if (p->memfd_p2c != -1) close(p->memfd_p2c);
+    
+    if (p->efd_c2p_send != -1) close(p->efd_c2p_send);
+    if (p->efd_c2p_ack != -1) close(p->efd_c2p_ack);
+    if (p->memfd_c2p != -1) close(p->memfd_c2p);
+
+    if (p->sock_fd != -1) close(p->sock_fd);
+    if (p->sock_child_fd != -1) close(p->sock_child_fd);
+}
+
+// Everything set through shm_parent_set_* that a lane or a standby shares
+// with the parent it belongs to. Lane count and buffer pool are not copied.
+static void parent_copy_config(shm_parent_t *dst, const shm_parent_t *src) {
+    dst->mode = src->mode;
+    dst->features = src->features;
+    dst->peer_features = src->peer_features;
+    dst->slot_size = src->slot_size;
+    dst->spawn = src->spawn;
+    dst->mem_flags = src->mem_flags;
+    dst->uring_flags = src->uring_flags;
+    dst->numa_node = src->numa_node;
+    dst->nonblock = src->nonblock;
+    dst->fd_passing = src->fd_passing;
+    dst->multi_producer = src->multi_producer;
+    memcpy(dst->parent_cpus, src->parent_cpus, sizeof(dst->parent_cpus));
+    memcpy(dst->child_cpus, src->child_cpus, sizeof(dst->child_cpus));
+    dst->ring_p2c.spin = src->ring_p2c.spin;
+    dst->ring_c2p.spin = src->ring_c2p.spin;
+    dst->ring_p2c.futex = src->ring_p2c.futex;
+    dst->ring_c2p.futex = src->ring_c2p.futex;
+    dst->ring_p2c.stats_flags = src->ring_p2c.stats_flags;
+    dst->ring_c2p.stats_flags = src->ring_c2p.stats_flags;
+    dst->ring_p2c.compress_min = src->ring_p2c.compress_min;
+    dst->ring_p2c.overflow = src->ring_p2c.overflow;
+    dst->ring_p2c.timeout_ns = src->ring_p2c.timeout_ns;
+}
+
+static int parent_create_lanes(shm_parent_t *p) {
+    // Extra lanes need the ring header to tell the child about them. In
+    // auto mode that is checked once the mode is known.
+    if (p->lane_count > 1 && !mode_has_ring(p->mode) && p->mode != SHM_MODE_AUTO) return -1;
+
+    if (parent_create_lane(p) != 0) return -1;
+    if (p->lane_count == 1) return 0;
+
+    p->lanes = (shm_parent_t**)calloc((size_t)p->lane_count - 1, sizeof(shm_parent_t*));
+    if (!p->lanes) return -1;
+
+    for (int i = 1; i < p->lane_count; i++) {
+        shm_parent_t *l = (shm_parent_t*)malloc(sizeof(shm_parent_t));
+        if (!l) return -1;
+        parent_init(l, p->shm_size);
+        parent_copy_config(l, p);
+        p->lanes[i - 1] = l;
+        if (parent_create_lane(l) != 0) return -1;
+    }
+
+    if (mode_has_ring(p->mode)) p->ring_p2c.hdr->lanes = (uint32_t)p->lane_count;
+    return 0;
+}
+
+static int parent_attach_urings(shm_parent_t *p) {
+    int wq_fd = -1;
+    for (int i = 0; i < p->lane_count; i++) {
+        shm_parent_t *l = shm_parent_lane(p, i);
+        if (uring_attach(&l->ring_p2c, l->efd_p2c_send, l->efd_p2c_ack,
+                         &l->ring_c2p, l->efd_c2p_send, l->efd_c2p_ack, p->uring_flags, &wq_fd) != 0) return -1;
+    }
+    return 0;
+}
+
+static int cpus_to_mask(uint64_t *mask, const int *cpus, int n) {
+    memset(mask, 0, SHM_MAX_CPUS / 8);
+    for (int i = 0; i < n; i++) {
+        if (cpus[i] < 0 || cpus[i] >= SHM_MAX_CPUS) return -1;
+        mask[cpus[i] / 64] |= 1ull << (cpus[i] % 64);
+    }
+    return 0;
+}
+
+// Returns 0 for an empty mask, which means no pinning.
+static int mask_to_set(const uint64_t *mask, cpu_set_t *set) {
+    int n = 0;
+    CPU_ZERO(set);
+    for (int cpu = 0; cpu < SHM_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+        if (mask[cpu / 64] & (1ull << (cpu % 64))) {
+            CPU_SET(cpu, set);
+            n++;
+        }
+    }
+    return n;
+}
+
+int shm_parent_set_affinity(shm_parent_t *p, const int *parent_cpus, int n_parent,
+                            const int *child_cpus, int n_child) {
+    if (p->child_pid > 0) return -1;
+    uint64_t parent_mask[SHM_MAX_CPUS / 64], child_mask[SHM_MAX_CPUS / 64];
+    if (cpus_to_mask(parent_mask, parent_cpus, parent_cpus ? n_parent : 0) != 0 ||
+        cpus_to_mask(child_mask, child_cpus, child_cpus ? n_child : 0) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(p->parent_cpus, parent_mask, sizeof(parent_mask));
+    memcpy(p->child_cpus, child_mask, sizeof(child_mask));
+    return 0;
+}
+
+int shm_parent_set_numa_node(shm_parent_t *p, int node) {
+    if (p->child_pid > 0) return -1;
+    if (node >= SHM_MAX_NUMA_NODES) {
+        errno = EINVAL;
+        return -1;
+    }
+    p->numa_node = node < 0 ? -1 : node;
+    return 0;
+}
+
+// Upper bound on what parent_child_fds returns
+#define CHILD_MAX_FDS (6 * SHM_MAX_LANES + SHM_BCAST_FDS + SHM_SOCK_FDS)
+
+// Lane i's FDs in the order the child finds them at 3 + 6i .. 8 + 6i,
+// then those of the broadcast it reads.
+static int parent_child_fds(shm_parent_t *p, int *fds) {
+    int n = 6 * p->lane_count;
+    for (int i = 0; i < p->lane_count; i++) {
+        shm_parent_t *l = shm_parent_lane(p, i);
+        fds[6 * i + 0] = l->efd_p2c_send;
+        fds[6 * i + 1] = l->efd_p2c_ack;
+        fds[6 * i + 2] = l->memfd_p2c;
+        fds[6 * i + 3] = l->efd_c2p_send;
+        fds[6 * i + 4] = l->efd_c2p_ack;
+        fds[6 * i + 5] = l->memfd_c2p;
+    }
+    if (p->bcast) {
+        const shm_bcast_peer_t *r = &p->bcast->readers[p->bcast_reader];
+        fds[n++] = r->ring.efd_send;
+        fds[n++] = r->ring.efd_ack;
+        fds[n++] = p->bcast->memfd;
+        fds[n++] = r->memfd_cursor;
+    }
+    if (p->sock_child_fd != -1) fds[n++] = p->sock_child_fd;
+    return n;
+}
+
+// Everything from first up, with a loop for kernels before close_range.
+static void close_fds_from(int first) {
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, (unsigned)first, ~0u, 0) == 0) return;
+#endif
+    long max = sysconf(_SC_OPEN_MAX);
+    for (long fd = first; fd < max; fd++) close((int)fd);
+}
+
+static int parent_spawn_fork(shm_parent_t *p, char **args, int *fds, int nfds,
+                             const cpu_set_t *child_set, int pin_child) {
+    pid_t pid = fork();
+    if (pid == -1) return -1;
+    if (pid > 0) {
+        p->child_pid = pid;
+        return 0;
+    }
+
+    // Child process: sources are moved above the targets before the dup2s
+    for (int i = 0; i < nfds; i++) {
+        fds[i] = fcntl(fds[i], F_DUPFD, 3 + nfds);
+        if (fds[i] == -1) _exit(1);
+    }
+    for (int i = 0; i < nfds; i++) {
+        if (dup2(fds[i], 3 + i) == -1) _exit(1);
+    }
+    close_fds_from(3 + nfds);
+
+    // The mask survives exec
+    if (pin_child && sched_setaffinity(0, sizeof(*child_set), child_set) != 0) {
+        perror("sched_setaffinity failed");
+        _exit(1);
+    }
+
+    execv(p->child_path, args);
+    perror("execv failed");
+    _exit(1);
+}
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+#define HAVE_SPAWN_CLOSEFROM 1
+#endif
+
+#ifdef HAVE_SPAWN_CLOSEFROM
+// tmp holds close-on-exec copies of the child's FDs above the target range
+static int spawn_with_actions(shm_parent_t *p, char **args, const int *tmp, int nfds) {
+    posix_spawn_file_actions_t fa;
+    if (posix_spawn_file_actions_init(&fa) != 0) return -1;
+
+    int err = 0;
+    for (int i = 0; i < nfds && err == 0; i++) {
+        err = posix_spawn_file_actions_adddup2(&fa, tmp[i], 3 + i);
+    }
+    if (err == 0) err = posix_spawn_file_actions_addclosefrom_np(&fa, 3 + nfds);
+
+    pid_t pid;
+    if (err == 0) err = posix_spawn(&pid, p->child_path, &fa, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    p->child_pid = pid;
+    return 0;
+}
+#endif
+
+// posix_spawn shares the address space until exec and reports exec failures
+static int parent_spawn_posix(shm_parent_t *p, char **args, int *fds, int nfds,
+                              const cpu_set_t *child_set, int pin_child) {
+#ifdef HAVE_SPAWN_CLOSEFROM
+    int tmp[CHILD_MAX_FDS];
+    int n = 0, ret = -1;
+    cpu_set_t saved;
+
+    while (n < nfds && (tmp[n] = fcntl(fds[n], F_DUPFD_CLOEXEC, 3 + nfds)) != -1) n++;
+
+    // The child inherits the mask of the spawning thread, which gets its own
+    // back right away
+    if (n == nfds && (!pin_child || (sched_getaffinity(0, sizeof(saved), &saved) == 0 &&
+                                     sched_setaffinity(0, sizeof(*child_set), child_set) == 0))) {
+        ret = spawn_with_actions(p, args, tmp, nfds);
+        if (pin_child) sched_setaffinity(0, sizeof(saved), &saved);
+    }
+
+    for (int i = 0; i < n; i++) close(tmp[i]);
+    return ret;
+#else
+    // No way to close the inherited FDs without running code in the child
+    return parent_spawn_fork(p, args, fds, nfds, child_set, pin_child);
+#endif
+}
+
+int shm_parent_set_spawn(shm_parent_t *p, shm_spawn_t spawn) {
+    if (p->child_pid > 0) return -1;
+    if (spawn != SHM_SPAWN_POSIX && spawn != SHM_SPAWN_FORK) return -1;
+    p->spawn = spawn;
+    return 0;
+}
+
+// Starts a child on the lanes as they are, fresh or reset.
+static int parent_spawn_child(shm_parent_t *p) {
+    // Built up front, a forked child runs nothing but syscalls
+    cpu_set_t parent_set, child_set;
+    int pin_parent = mask_to_set(p->parent_cpus, &parent_set);
+    int pin_child = mask_to_set(p->child_cpus, &child_set);
+
+    int fds[CHILD_MAX_FDS];
+    int nfds = parent_child_fds(p, fds);
+
+    char shm_size_str[32], bcast_str[16], sock_str[16];
+    sprintf(shm_size_str, "%zu", p->shm_size);
+
+    // Prepare args
+    // We pass the flags just for compatibility, even though we use fixed FDs.
+    char *args[22] = {
+        p->child_path,
+        "-mode", "child",
+        "-fd-p2c-send", "3",
+        "-fd-p2c-ack", "4",
+        "-fd-p2c-shm", "5",
+        "-fd-c2p-send", "6",
+        "-fd-c2p-ack", "7",
+        "-fd-c2p-shm", "8",
+    };
+
+    // Only the FDs after the lanes move around, so only those are looked up
+    int argn = 15, fd = 3 + 6 * p->lane_count;
+    if (p->bcast) {
+        sprintf(bcast_str, "%d", fd);
+        args[argn++] = "-fd-bcast";
+        args[argn++] = bcast_str;
+        fd += SHM_BCAST_FDS;
+    }
+    if (p->sock_child_fd != -1) {
+        sprintf(sock_str, "%d", fd);
+        args[argn++] = "-fd-sock";
+        args[argn++] = sock_str;
+    }
+    args[argn++] = "-shm-size";
+    args[argn++] = shm_size_str;
+    args[argn] = NULL;
+
+    // 3. Spawn
+    int ret = p->spawn == SHM_SPAWN_FORK ? parent_spawn_fork(p, args, fds, nfds, &child_set, pin_child)
+                                         : parent_spawn_posix(p, args, fds, nfds, &child_set, pin_child);
+    if (ret != 0) return -1;
+
+    // Only now, or the child would inherit the parent's mask
+    if (pin_parent && sched_setaffinity(0, sizeof(parent_set), &parent_set) != 0) return -1;
+    return 0;
+}
+
+int shm_parent_set_standby(shm_parent_t *p, int standby) {
+    // The standby would need a cursor of its own
+    if (p->child_pid > 0 || (standby && p->bcast)) return -1;
+    p->keep_standby = standby;
+    return 0;
+}
+
+int shm_parent_set_fd_passing(shm_parent_t *p, int enable) {
+    if (p->child_pid > 0) return -1;
+    p->fd_passing = enable;
+    return 0;
+}
+
+int shm_parent_set_multi_producer(shm_parent_t *p, int enable) {
+    if (p->child_pid > 0) return -1;
+    p->multi_producer = enable;
+    return 0;
+}
+
+static int parent_create_socket(shm_parent_t *p) {
+    if (!p->fd_passing) return 0;
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) return -1;
+    p->sock_fd = sv[0];
+    p->sock_child_fd = sv[1];
+    return 0;
+}
+
+// A complete second parent with the same settings, started on its own FDs.
+static shm_parent_t* parent_new_standby(const shm_parent_t *p) {
+    shm_parent_t *s = shm_parent_new(p->child_path, p->shm_size);
+    if (!s) return NULL;
+    parent_copy_config(s, p);
+    s->lane_count = p->lane_count;
+    if (shm_parent_start(s) != 0) {
+        shm_parent_close(s);
+        return NULL;
+    }
+    return s;
+}
+
+// SHM_MODE_AUTO: 1 with the child's hello in *reply, 0 for a child without the
+// handshake
+static int parent_await_hello(shm_parent_t *p, shm_hello_t *reply) {
+    struct pollfd pfd = { .fd = p->efd_c2p_send, .events = POLLIN };
+    int ret;
+    while (1) {
+        ret = poll(&pfd, 1, SHM_HELLO_TIMEOUT_MS);
+        if (ret == -1 && errno == EINTR) continue;
+        if (ret != 0) break;
+
+        if (hello_cas((shm_hello_t*)p->shm_p2c_ptr, SHM_HELLO_CLOSED)) return 0;
+        siginfo_t info = { 0 };
+        if (waitid(P_PID, (id_t)p->child_pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid) {
+            errno = ECHILD;
+            return -1;
+        }
+    }
+    if (ret < 0) return -1;
+
+    uint64_t val;
+    if (efd_read(p->efd_c2p_send, &val) != 0) return -1;
+    if (!(val & SHM_SIG_HELLO)) {
+        // An older child's first message: put its signal back for the reader
+        return efd_signal(NULL, p->efd_c2p_send, val) == 0 ? 0 : -1;
+    }
+
+    memcpy(reply, p->shm_c2p_ptr, sizeof(*reply));
+    if (!hello_valid(reply)) {
+        errno = EPROTO;
+        return -1;
+    }
+    return 1;
+}
+
+// SHM_MODE_AUTO: lays the lanes out for the best common mode and lets the child go on
+static int parent_negotiate(shm_parent_t *p) {
+    shm_hello_t reply;
+    int answered = parent_await_hello(p, &reply);
+    if (answered < 0) return -1;
+
+    unsigned peer = answered ? reply.features : 0;
+    unsigned common = p->features & peer;
+    int ring = answered && (common & SHM_FEAT_RING) && reply.hdr_version == SHM_HDR_VERSION &&
+               reply.shm_size == p->shm_size && p->shm_size > SHM_HDR_SIZE + 2 * sizeof(shm_rec_t);
+    if ((p->lane_count > 1 && (!ring || !(common & SHM_FEAT_LANES))) ||
+        (p->multi_producer && (!ring || !(common & SHM_FEAT_MULTI_PRODUCER)))) {
+        errno = EPROTONOSUPPORT;
+        return -1;
+    }
+
+    for (int i = 0; i < p->lane_count; i++) {
+        shm_parent_t *l = shm_parent_lane(p, i);
+        l->mode = ring ? SHM_MODE_RING : SHM_MODE_STANDARD;
+        l->features = common;
+        l->peer_features = peer;
+        // Nothing the child could not decode or would not wake us from
+        if (!(common & SHM_FEAT_LZ4)) l->ring_p2c.compress_min = 0;
+        if (!(common & SHM_FEAT_FUTEX)) l->ring_p2c.futex = l->ring_c2p.futex = 0;
+        if (ring && parent_init_rings(l) != 0) return -1;
+    }
+    if (ring) p->ring_p2c.hdr->lanes = (uint32_t)p->lane_count;
+    else memset(p->shm_p2c_ptr, 0, sizeof(shm_hello_t));
+
+    // The eventfd write orders the layout before the child reads it. The
+    // ack keeps the first message's length from adding up with ours.
+    if (!answered) return 0;
+    uint64_t ack_val;
+    return efd_signal_wait(NULL, p->efd_p2c_send, SHM_SIG_HELLO, p->efd_p2c_ack, &ack_val);
+}
+
+int shm_parent_start(shm_parent_t *p) {
+    // Slots keep no record frames to pad a claim with
+    if (p->multi_producer && p->mode != SHM_MODE_RING && p->mode != SHM_MODE_AUTO) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (parent_create_lanes(p) != 0 || parent_create_socket(p) != 0) return -1;
+    if (p->mode == SHM_MODE_AUTO) {
+        hello_fill(p->shm_p2c_ptr, p->shm_size);
+        // The handshake goes straight to the eventfds, before any io_uring
+        if (parent_spawn_child(p) != 0 || parent_negotiate(p) != 0) return -1;
+        if (p->uring_flags && parent_attach_urings(p) != 0) return -1;
+    } else {
+        if (p->uring_flags && parent_attach_urings(p) != 0) return -1;
+        if (parent_spawn_child(p) != 0) return -1;
+    }
+
+    if (p->keep_standby) {
+        p->standby = parent_new_standby(p);
+        if (!p->standby) return -1;
+    }
+    return 0;
+}
+
+static void parent_stop_child(shm_parent_t *p) {
+    if (p->child_pid > 0) {
+        kill(p->child_pid, SIGTERM);
+        waitpid(p->child_pid, NULL, 0);
+    }
+    p->child_pid = 0;
+}
+
+static int fd_set_nonblock(int fd, int nonblock) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1) return -1;
+    flags = nonblock ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+    return fcntl(fd, F_SETFL, flags) == -1 ? -1 : 0;
+}
+
+// Puts a lane back in the state start left it in, keeping its memfds,
+// mappings and eventfds: counters drained, rings empty.
+static int parent_reset_lane(shm_parent_t *p) {
+    int efds[4] = { p->efd_p2c_send, p->efd_p2c_ack, p->efd_c2p_send, p->efd_c2p_ack };
+    uint64_t val;
+    for (int i = 0; i < 4; i++) {
+        if (efd_try_read(efds[i], &val) < 0) return -1;
+    }
+
+    // The old child may have set O_NONBLOCK on the eventfds it reads, and
+    // the flag lives in the file description the next child inherits
+    if (fd_set_nonblock(p->efd_p2c_send, 0) != 0 || fd_set_nonblock(p->efd_c2p_ack, 0) != 0) return -1;
+    p->p2c_pending = 0;
+
+    // FDs passed either way would otherwise be seen by the next child
+    if (p->sock_fd != -1 && (sock_drain(p->sock_fd) != 0 || sock_drain(p->sock_child_fd) != 0)) return -1;
+
+    if (mode_has_ring(p->mode)) {
+        uint32_t lanes = p->ring_p2c.hdr->lanes;
+        if (parent_init_rings(p) != 0) return -1;
+        p->ring_p2c.hdr->lanes = lanes;
+    } else {
+        // The last message must not look like a header to the next child
+        memset(p->shm_p2c_ptr, 0, sizeof(shm_hello_t));
+    }
+    return 0;
+}
+
+// Resets every lane and starts a new child on them, with fresh io_uring instances
+static int parent_rearm(shm_parent_t *p) {
+    for (int i = 0; i < p->lane_count; i++) {
+        shm_parent_t *l = shm_parent_lane(p, i);
+        uring_detach(&l->ring_p2c, &l->ring_c2p);
+        if (parent_reset_lane(l) != 0) return -1;
+    }
+    if (p->uring_flags && parent_attach_urings(p) != 0) return -1;
+    return parent_spawn_child(p);
+}
+
+#define SWAP(a, b) do { __typeof__(a) swap_tmp_ = (a); (a) = (b); (b) = swap_tmp_; } while (0)
+
+// Exchanges the channel resources of two lanes, leaving settings and
+// counters where they are.
+static void parent_swap_channel(shm_parent_t *a, shm_parent_t *b) {
+    SWAP(a->efd_p2c_send, b->efd_p2c_send);
+    SWAP(a->efd_p2c_ack, b->efd_p2c_ack);
+    SWAP(a->memfd_p2c, b->memfd_p2c);
+    SWAP(a->shm_p2c_ptr, b->shm_p2c_ptr);
+    SWAP(a->efd_c2p_send, b->efd_c2p_send);
+    SWAP(a->efd_c2p_ack, b->efd_c2p_ack);
+    SWAP(a->memfd_c2p, b->memfd_c2p);
+    SWAP(a->shm_c2p_ptr, b->shm_c2p_ptr);
+    SWAP(a->c2p_size, b->c2p_size);
+    SWAP(a->p2c_pending, b->p2c_pending);
+    SWAP(a->sock_fd, b->sock_fd);
+    SWAP(a->sock_child_fd, b->sock_child_fd);
+    SWAP(a->ring_p2c, b->ring_p2c);
+    SWAP(a->ring_c2p, b->ring_c2p);
+    SWAP(a->ring_p2c.stats, b->ring_p2c.stats);
+    SWAP(a->ring_c2p.stats, b->ring_c2p.stats);
+}
+
+int shm_parent_restart(shm_parent_t *p) {
+    if (p->child_pid <= 0) return -1;
+    parent_stop_child(p);
+
+    if (!p->standby) return parent_rearm(p);
+
+    // Failover: the standby's lanes and child become ours, and the old
+    // lanes are recycled for the next standby
+    shm_parent_t *s = p->standby;
+    for (int i = 0; i < p->lane_count; i++) {
+        parent_swap_channel(shm_parent_lane(p, i), shm_parent_lane(s, i));
+    }
+    SWAP(p->child_pid, s->child_pid);
+
+    if (parent_rearm(s) != 0) {
+        // We are running again, only without a standby
+        shm_parent_close(s);
+        p->standby = NULL;
+    }
+    return 0;
+}
+
+shm_parent_t* shm_parent_lane(shm_parent_t *p, int lane) {
+    if (lane == 0) return p;
+    if (lane < 0 || lane >= p->lane_count || !p->lanes) return NULL;
+    return p->lanes[lane - 1];
+}
+
+int shm_parent_recv_fd(const shm_parent_t *p) {
+    return p->efd_c2p_send;
+}
+
+int shm_parent_send_fd(const shm_parent_t *p) {
+    return p->efd_p2c_ack;
+}
+
+int shm_parent_pass_fd(shm_parent_t *p, int fd, uint64_t tag) {
+    return sock_pass(p->sock_fd, fd, tag);
+}
+
+int shm_parent_take_fd(shm_parent_t *p, uint64_t *tag) {
+    return sock_take(p->sock_fd, tag, 0);
+}
+
+int shm_parent_fd_socket(const shm_parent_t *p) {
+    return p->sock_fd;
+}
+
+int shm_parent_send_memfd(shm_parent_t *p, int memfd) {
+    return memfd_pass(p->sock_fd, memfd);
+}
+
+int shm_parent_recv_memfd(shm_parent_t *p, const uint8_t **data, size_t *len) {
+    return memfd_take(p->sock_fd, data, len);
+}
+
+// Standard mode: a try_send leaves its ack outstanding, and it has to be
+// collected before the P2C region can be written again.
+static int parent_settle(shm_parent_t *p, int block) {
+    if (!p->p2c_pending) return 0;
+
+    uint64_t ack_val;
+    if (stats_efd_wait(&p->ring_p2c, p->efd_p2c_ack, &ack_val, block) != 0) return -1;
+    p->p2c_pending = 0;
+    return 0;
+}
+
+uint8_t* shm_parent_send_reserve(shm_parent_t *p, size_t len) {
+    if (mode_has_ring(p->mode)) return ring_reserve(&p->ring_p2c, len, 1);
+
+    if (len > p->shm_size) return stats_too_large(&p->ring_p2c);
+    p->ring_p2c.send_start = stats_start(&p->ring_p2c);
+    SHM_PROBE(send_reserve, &p->ring_p2c, len);
+    if (parent_settle(p, 1) != 0) return NULL;
+    return p->shm_p2c_ptr;
+}
+
+int shm_parent_send_commit(shm_parent_t *p, size_t len) {
+    if (mode_has_ring(p->mode)) return ring_commit(&p->ring_p2c, len);
+
+    if (len > p->shm_size) return -1;
+    stats_stage(&p->ring_p2c, SHM_STAGE_COPY, p->ring_p2c.send_start);
+    SHM_PROBE(send_commit, &p->ring_p2c, len);
+
+    // Signal Length and wait for ACK
+    if (stats_efd_signal_wait(&p->ring_p2c, p->efd_p2c_send, (uint64_t)len, p->efd_p2c_ack, &p->p2c_pending) != 0) return -1;
+
+    stats_count(&p->ring_p2c, len);
+    stats_latency(&p->ring_p2c, p->ring_p2c.send_start);
+    return 0;
+}
+
+// Standard mode: the frame goes at offset 0, signalled with SHM_SIG_LZ4.
+// Returns 1, having sent nothing, if the message does not compress.
+static int parent_send_lz4(shm_parent_t *p, const uint8_t *data, size_t len, int block) {
+    shm_ring_t *r = &p->ring_p2c;
+    uint64_t start = stats_start(r);
+    if (parent_settle(p, block) != 0) return -1;
+
+    size_t n = lz4_frame(p->shm_p2c_ptr, p->shm_size, data, len);
+    if (n == 0) return 1;
+
+    if (block) {
+        if (stats_efd_signal_wait(r, p->efd_p2c_send, (uint64_t)n | SHM_SIG_LZ4, p->efd_p2c_ack, &p->p2c_pending) != 0) return -1;
+    } else {
+        if (efd_signal(r->uring, p->efd_p2c_send, (uint64_t)n | SHM_SIG_LZ4) != 0) return -1;
+        p->p2c_pending = 1;
+    }
+    stats_count(r, n);
+    stats_latency(r, start);
+    return 0;
+}
+
+int shm_parent_send_data(shm_parent_t *p, const uint8_t *data, size_t len) {
+    if (ring_compresses(&p->ring_p2c, len)) {
+        if (mode_has_ring(p->mode)) return ring_send_lz4(&p->ring_p2c, data, len, 1);
+        int rc = parent_send_lz4(p, data, len, 1);
+        if (rc <= 0) return rc;
+    }
+
+    uint8_t *dst = shm_parent_send_reserve(p, len);
+    if (!dst) return -1;
+
+    // Write to SHM
+    shm_copy(dst, data, len);
+
+    return shm_parent_send_commit(p, len);
+}
+
+int shm_parent_try_send(shm_parent_t *p, const uint8_t *data, size_t len) {
+    if (ring_compresses(&p->ring_p2c, len)) {
+        if (mode_has_ring(p->mode)) return ring_send_lz4(&p->ring_p2c, data, len, 0);
+        int rc = parent_send_lz4(p, data, len, 0);
+        if (rc <= 0) return rc;
+    }
+
+    if (mode_has_ring(p->mode)) {
+        uint8_t *dst = ring_reserve(&p->ring_p2c, len, 0);
+        if (!dst) return -1;
+        shm_copy(dst, data, len);
+        return ring_commit(&p->ring_p2c, len);
+    }
+
+    if (len > p->shm_size) {
+        stats_too_large(&p->ring_p2c);
+        return -1;
+    }
+    uint64_t start = stats_start(&p->ring_p2c);
+    if (parent_settle(p, 0) != 0) return -1;
+
+    shm_copy(p->shm_p2c_ptr, data, len);
+    uint64_t copied = stats_stage(&p->ring_p2c, SHM_STAGE_COPY, start);
+
+    // The ack is collected by the next send
+    if (efd_signal(p->ring_p2c.uring, p->efd_p2c_send, (uint64_t)len) != 0) return -1;
+    stats_stage(&p->ring_p2c, SHM_STAGE_SIGNAL, copied);
+    SHM_PROBE(send_signal, &p->ring_p2c, len);
+    p->p2c_pending = 1;
+    stats_count(&p->ring_p2c, len);
+    stats_latency(&p->ring_p2c, start);
+    return 0;
+}
+
+int shm_parent_send_stream(shm_parent_t *p, const uint8_t *data, size_t len) {
+    if (mode_has_ring(p->mode)) return ring_send_stream(&p->ring_p2c, data, len);
+
+    // No framing in the standard protocol, so no room for fragments
+    return shm_parent_send_data(p, data, len);
+}
+
+int shm_parent_send_batch(shm_parent_t *p, const struct iovec *msgs, int n) {
+    if (mode_has_ring(p->mode)) return ring_send_batch(&p->ring_p2c, msgs, n);
+
+    // The standard protocol has one message per signal
+    for (int i = 0; i < n; i++) {
+        if (shm_parent_send_data(p, (const uint8_t*)msgs[i].iov_base, msgs[i].iov_len) != 0) return -1;
+    }
+    return 0;
+}
+
+uint8_t* shm_parent_slot_reserve(shm_parent_t *p, int max, int *n) {
+    if (p->mode != SHM_MODE_SLOTS) return NULL;
+    return slot_reserve(&p->ring_p2c, max, 1, n);
+}
+
+int shm_parent_slot_commit(shm_parent_t *p, int n) {
+    if (p->mode != SHM_MODE_SLOTS) return -1;
+    return slot_commit(&p->ring_p2c, n);
+}
+
+const uint8_t* shm_parent_slot_peek(shm_parent_t *p, int max, int *n) {
+    if (p->mode != SHM_MODE_SLOTS) return NULL;
+    return slot_peek(&p->ring_c2p, max, 1, n);
+}
+
+size_t shm_parent_slot_size(const shm_parent_t *p) {
+    return parent_slot_size(p);
+}
+
+static int parent_read_begin(shm_parent_t *p, const uint8_t **data, size_t *len, int block) {
+    if (mode_has_ring(p->mode)) return ring_peek(&p->ring_c2p, data, len, block);
+
+    // Wait for Signal
+    uint64_t len_val, start = block ? stats_start(&p->ring_c2p) : 0;
+    if (stats_efd_wait(&p->ring_c2p, p->efd_c2p_send, &len_val, block) != 0) return -1;
+    // A child that ignored SHM_HELLO_CLOSED and answered the handshake late
+    if (len_val & SHM_SIG_HELLO) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    // A child that followed a resize may send more than we have mapped
+    uint64_t wire = len_val & ~SHM_SIG_LZ4;
+    if (wire > p->c2p_size && shm_remap(p->memfd_c2p, &p->shm_c2p_ptr, &p->c2p_size, (size_t)wire,
+                                        PROT_READ | PROT_WRITE, p->mem_flags) != 0) {
+        return efd_reject(p->ring_c2p.uring, p->efd_c2p_ack);
+    }
+
+    *data = p->shm_c2p_ptr;
+    *len = (size_t)wire;
+    if ((len_val & SHM_SIG_LZ4) && lz4_unframe(&p->ring_c2p, p->shm_c2p_ptr, (size_t)wire, data, len) != 0) {
+        return efd_reject(p->ring_c2p.uring, p->efd_c2p_ack);
+    }
+    stats_count(&p->ring_c2p, (size_t)wire);
+    stats_latency(&p->ring_c2p, start);
+    p->ring_c2p.lent_ns = stats_trace_clock(&p->ring_c2p);
+    SHM_PROBE(recv_lent, &p->ring_c2p, wire);
+    return 0;
+}
+
+int shm_parent_read_begin(shm_parent_t *p, const uint8_t **data, size_t *len) {
+    return parent_read_begin(p, data, len, 1);
+}
+
+int shm_parent_try_recv(shm_parent_t *p, const uint8_t **data, size_t *len) {
+    return parent_read_begin(p, data, len, 0);
+}
+
+int shm_parent_read_batch_begin(shm_parent_t *p, struct iovec *msgs, int max) {
+    if (max < 1) return -1;
+    if (mode_has_ring(p->mode)) return ring_peek_batch(&p->ring_c2p, msgs, max, 1);
+
+    const uint8_t *data;
+    size_t len;
+    if (shm_parent_read_begin(p, &data, &len) != 0) return -1;
+    msgs[0].iov_base = (void*)data;
+    msgs[0].iov_len = len;
+    return 1;
+}
+
+int shm_parent_read_end(shm_parent_t *p) {
+    if (mode_has_ring(p->mode)) return ring_release(&p->ring_c2p);
+    stats_end_read(&p->ring_c2p);
+
+    // Send ACK
+    if (efd_signal(p->ring_c2p.uring, p->efd_c2p_ack, 1) != 0) return -1;
+
+    return 0;
+}
+
+static void parent_free_buffer(shm_parent_t *p, uint8_t *buf) {
+    if (p->buf_pool) shm_buffer_release(buf);
+    else free(buf);
+}
+
+int shm_parent_set_buffer_pool(shm_parent_t *p, int per_class) {
+    if (p->buf_pool) pool_close(p->buf_pool);
+    p->buf_pool = NULL;
+    if (per_class <= 0) return 0;
+
+    p->buf_pool = pool_new(per_class);
+    return p->buf_pool ? 0 : -1;
+}
+
+uint8_t* shm_parent_read_data(shm_parent_t *p, size_t *len) {
+    const uint8_t *src;
+    if (shm_parent_read_begin(p, &src, len) != 0) return NULL;
+
+    if (p->mode == SHM_MODE_RING && ring_is_fragment(&p->ring_c2p, src)) {
+        uint8_t *buf = NULL;
+        size_t cap = 0;
+        if (ring_read_stream(&p->ring_c2p, src, *len, p->buf_pool, &buf, &cap, len) != 0) {
+            parent_free_buffer(p, buf);
+            return NULL;
+        }
+        return buf;
+    }
+
+    // malloc(0) may return NULL, which would look like an error
+    uint8_t *data = p->buf_pool ? pool_alloc(p->buf_pool, *len) : (uint8_t*)malloc(*len ? *len : 1);
+    if (!data) return NULL;
+
+    // Read from SHM
+    memcpy(data, src, *len);
+
+    if (shm_parent_read_end(p) != 0) {
+        parent_free_buffer(p, data);
+        return NULL;
+    }
+
+    return data;
+}
+
+// Grows the memfds of a lane and its P2C mapping. The C2P mapping belongs
+// to the receiving thread and follows in parent_read_begin.
+static int parent_grow_lane(shm_parent_t *p, size_t shm_size) {
+    if (ftruncate(p->memfd_p2c, (off_t)shm_size) == -1) return -1;
+    if (ftruncate(p->memfd_c2p, (off_t)shm_size) == -1) return -1;
+
+    unsigned mem_flags = p->numa_node < 0 ? p->mem_flags : p->mem_flags & ~SHM_MEM_POPULATE;
+    if (shm_remap(p->memfd_p2c, &p->shm_p2c_ptr, &p->shm_size, shm_size, PROT_READ | PROT_WRITE, mem_flags) != 0) return -1;
+    if (p->numa_node < 0) return 0;
+
+    // The policy covers what was mapped when it was set, so both memfds
+    // need it for the new range before anyone faults it in
+    if (shm_bind_node(p->shm_p2c_ptr, p->shm_size, p->numa_node) != 0) return -1;
+    shm_advise(p->shm_p2c_ptr, p->shm_size, p->mem_flags & SHM_MEM_POPULATE, 1);
+    uint8_t *c2p = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, p->memfd_c2p, 0);
+    if (c2p == MAP_FAILED) return -1;
+    int rc = shm_bind_node(c2p, shm_size, p->numa_node);
+    munmap(c2p, shm_size);
+    return rc;
+}
+
+int shm_parent_resize(shm_parent_t *p, size_t shm_size) {
+    if (p->child_pid <= 0) return -1;
+    // A ring's capacity is part of its layout, and a child negotiated
+    // without the feature would drop the longer messages
+    if (p->mode != SHM_MODE_STANDARD || !(p->features & SHM_FEAT_RESIZE)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (p->mem_flags & SHM_MEM_HUGETLB) shm_size = (shm_size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    if (shm_size < p->shm_size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The child needs no signal: a length beyond its mapping tells it to
+    // look at the memfd size again
+    if (shm_size > p->shm_size && parent_grow_lane(p, shm_size) != 0) return -1;
+    return p->standby ? shm_parent_resize(p->standby, shm_size) : 0;
+}
+
+int shm_parent_trim(shm_parent_t *p) {
+    if (mode_has_ring(p->mode)) return ring_trim(&p->ring_p2c, p->memfd_p2c, p->shm_size, p->mem_flags);
+
+    // The child is done with the region once the last send is acked
+    if (parent_settle(p, 0) != 0) return -1;
+    return shm_punch(p->memfd_p2c, 0, p->shm_size, p->mem_flags);
+}
+
+void shm_parent_set_spin(shm_parent_t *p, uint32_t spin) {
+    p->ring_p2c.spin = spin;
+    p->ring_c2p.spin = spin;
+}
+
+int shm_parent_set_compress(shm_parent_t *p, size_t min_size) {
+    // Slots are fixed-size and would not get any smaller, and a child
+    // negotiated without LZ4 could not decode the messages
+    if (min_size && (p->mode == SHM_MODE_SLOTS || !(p->features & SHM_FEAT_LZ4))) return -1;
+    p->ring_p2c.compress_min = min_size;
+    return 0;
+}
+
+int shm_parent_set_overflow(shm_parent_t *p, shm_overflow_t overflow, int timeout_ms) {
+    // The consumer only claims what it reads in a ring that says so in its
+    // header, which start writes
+    if (overflow == SHM_OVERFLOW_DROP_OLDEST && p->mode != SHM_MODE_RING) return -1;
+    if (overflow == SHM_OVERFLOW_DROP_OLDEST && p->child_pid > 0 && !p->ring_p2c.hdr->drop_oldest) return -1;
+    return ring_set_overflow(&p->ring_p2c, overflow, timeout_ms);
+}
+
+size_t shm_parent_send_credit(shm_parent_t *p) {
+    if (mode_has_ring(p->mode)) return ring_credit(&p->ring_p2c);
+
+    // Collects an ack that came back since the last send
+    return parent_settle(p, 0) == 0 ? p->shm_size : 0;
+}
+
+void shm_parent_set_futex(shm_parent_t *p, int futex) {
+    p->ring_p2c.futex = futex;
+    p->ring_c2p.futex = futex;
+}
+
+void shm_parent_set_stats(shm_parent_t *p, unsigned flags) {
+    p->ring_p2c.stats_flags = flags;
+    p->ring_c2p.stats_flags = flags;
+}
+
+void shm_parent_get_stats(const shm_parent_t *p, shm_stats_t *out) {
+    out->send = p->ring_p2c.stats;
+    out->recv = p->ring_c2p.stats;
+}
+
+void shm_parent_reset_stats(shm_parent_t *p) {
+    memset(&p->ring_p2c.stats, 0, sizeof(shm_dir_stats_t));
+    memset(&p->ring_c2p.stats, 0, sizeof(shm_dir_stats_t));
+}
+
+void shm_parent_close(shm_parent_t *p) {
+    if (p->standby) shm_parent_close(p->standby);
+    parent_release_lane(p);
+    shm_parent_set_buffer_pool(p, 0);
+
+    if (p->lanes) {
+        for (int i = 0; i < p->lane_count - 1; i++) {
+            if (!p->lanes[i]) continue;
+            parent_release_lane(p->lanes[i]);
+            shm_parent_set_buffer_pool(p->lanes[i], 0);
+            free(p->lanes[i]);
+        }
+        free(p->lanes);
+    }
+
+    parent_stop_child(p);
+    free(p->child_path);
+    free(p);
+}
+
+// --- Pool Implementation ---
+
+shm_pool_t* shm_pool_new(const char *child_path, size_t shm_size, int workers) {
+    if (workers < 1) return NULL;
+
+    shm_pool_t *pool = (shm_pool_t*)calloc(1, sizeof(shm_pool_t));
+    if (!pool) return NULL;
+    pool->count = workers;
+    pool->workers = (shm_parent_t**)calloc((size_t)workers, sizeof(shm_parent_t*));
+    pool->inflight = (int*)calloc((size_t)workers, sizeof(int));
+    pool->pfds = (struct pollfd*)calloc((size_t)workers, sizeof(struct pollfd));
+    if (!pool->workers || !pool->inflight || !pool->pfds) {
+        shm_pool_close(pool);
+        return NULL;
+    }
+
+    for (int i = 0; i < workers; i++) {
+        pool->workers[i] = shm_parent_new(child_path, shm_size);
+        if (!pool->workers[i]) {
+            shm_pool_close(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+shm_parent_t* shm_pool_worker(shm_pool_t *pool, int worker) {
+    if (worker < 0 || worker >= pool->count) return NULL;
+    return pool->workers[worker];
+}
+
+int shm_pool_start(shm_pool_t *pool) {
+    for (int i = 0; i < pool->count; i++) {
+        if (shm_parent_start(pool->workers[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+// Offers the message to workers by outstanding requests, starting after the
+// last one used so equal loads rotate
+static int pool_try_dispatch(shm_pool_t *pool, const uint8_t *data, size_t len) {
+    int n = pool->count;
+    uint8_t tried[n];
+    memset(tried, 0, (size_t)n);
+
+    for (int attempt = 0; attempt < n; attempt++) {
+        int best = -1;
+        for (int k = 0; k < n; k++) {
+            int i = (pool->next + k) % n;
+            if (!tried[i] && (best == -1 || pool->inflight[i] < pool->inflight[best])) best = i;
+        }
+        tried[best] = 1;
+
+        if (shm_parent_try_send(pool->workers[best], data, len) == 0) {
+            pool->inflight[best]++;
+            pool->next = (best + 1) % n;
+            return best;
+        }
+        if (errno != EAGAIN) return -1;
+    }
+
+    errno = EAGAIN;
+    return -1;
+}
+
+// Polls the pool until the deadline set on the first call (*deadline 0), then
+// fails with EAGAIN
+static int pool_poll(shm_pool_t *pool, uint64_t *deadline, int timeout_ms) {
+    int ms = timeout_ms;
+    if (timeout_ms >= 0) {
+        uint64_t now = stats_clock();
+        if (!*deadline) {
+            *deadline = now + (uint64_t)timeout_ms * 1000000u;
+        } else if (now >= *deadline) {
+            errno = EAGAIN;
+            return -1;
+        }
+        ms = (int)((*deadline - now + 999999) / 1000000);
+    }
+    int ret = poll(pool->pfds, (nfds_t)pool->count, ms);
+    if (ret == -1) return -1;
+    if (ret == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+int shm_pool_dispatch(shm_pool_t *pool, const uint8_t *data, size_t len, int timeout_ms) {
+    uint64_t deadline = 0;
+    while (1) {
+        int worker = pool_try_dispatch(pool, data, len);
+        if (worker >= 0 || errno != EAGAIN) return worker;
+
+        // Every worker is busy: sleep until one of them frees capacity
+        for (int i = 0; i < pool->count; i++) {
+            pool->pfds[i].fd = shm_parent_send_fd(pool->workers[i]);
+            pool->pfds[i].events = POLLIN;
+        }
+        if (pool_poll(pool, &deadline, timeout_ms) != 0) return -1;
+    }
+}
+
+int shm_pool_recv(shm_pool_t *pool, const uint8_t **data, size_t *len, int timeout_ms) {
+    uint64_t deadline = 0;
+    while (1) {
+        for (int k = 0; k < pool->count; k++) {
+            int i = (pool->next_recv + k) % pool->count;
+            if (shm_parent_try_recv(pool->workers[i], data, len) == 0) {
+                pool->next_recv = (i + 1) % pool->count;
+                return i;
+            }
+            if (errno != EAGAIN) return -1;
+        }
+
+        for (int i = 0; i < pool->count; i++) {
+            pool->pfds[i].fd = shm_parent_recv_fd(pool->workers[i]);
+            pool->pfds[i].events = POLLIN;
+        }
+        if (pool_poll(pool, &deadline, timeout_ms) != 0) return -1;
+    }
+}
+
+int shm_pool_recv_end(shm_pool_t *pool, int worker) {
+    if (worker < 0 || worker >= pool->count) return -1;
+    if (pool->inflight[worker] > 0) pool->inflight[worker]--;
+    return shm_parent_read_end(pool->workers[worker]);
+}
+
+int shm_pool_inflight(const shm_pool_t *pool, int worker) {
+    if (worker < 0 || worker >= pool->count) return -1;
+    return pool->inflight[worker];
+}
+
+void shm_pool_close(shm_pool_t *pool) {
+    if (pool->workers) {
+        for (int i = 0; i < pool->count; i++) {
+            if (pool->workers[i]) shm_parent_close(pool->workers[i]);
+        }
+    }
+    free(pool->workers);
+    free(pool->inflight);
+    free(pool->pfds);
+    free(pool);
+}
+
+// --- Child Implementation ---
+
+// The parent in auto mode is waiting for our hello and lays the memfds out once it has it
+static int child_handshake(shm_child_t *c) {
+    shm_hello_t *h = (shm_hello_t*)c->shm_p2c_ptr;
+
+    // The claim is the only write to P2C outside a ring header; hugetlb
+    // mappings cannot be split below the huge page size
+    size_t rw = sizeof(shm_hello_t);
+    if (mprotect(h, rw, PROT_READ | PROT_WRITE) != 0) {
+        rw = c->shm_size;
+        if (mprotect(h, rw, PROT_READ | PROT_WRITE) != 0) return -1;
+    }
+    int claimed = hello_cas(h, SHM_HELLO_CLAIMED);
+    mprotect(h, rw, PROT_READ);
+    if (!claimed) return 0; // Too late, standard mode
+    if (h->version < 1) {
+        errno = EPROTO;
+        return -1;
+    }
+    c->peer_features = h->features;
+    hello_fill(c->shm_c2p_ptr, c->shm_size);
+
+    if (efd_signal(NULL, c->fd_c2p_send, SHM_SIG_HELLO) != 0) return -1;
+
+    // Nothing else comes through the P2C eventfd before the layout is done
+    uint64_t val;
+    if (efd_read(c->fd_p2c_send, &val) != 0) return -1;
+    if (!(val & SHM_SIG_HELLO)) {
+        errno = EPROTO;
+        return -1;
+    }
+    return efd_signal(NULL, c->fd_p2c_ack, 1);
+}
+
+// Maps the lane whose FDs start at fd_base (3 for lane 0).
+static int child_attach_lane(shm_child_t *c, size_t shm_size, int fd_base, unsigned mem_flags) {
+    memset(c, 0, sizeof(shm_child_t));
+    c->shm_size = shm_size;
+    c->lane_count = 1;
+    c->fd_sock = c->fd_bcast = -1;
+
+    // Fixed FDs
+    c->fd_p2c_send = fd_base;
+    c->fd_p2c_ack = fd_base + 1;
+    c->fd_p2c_shm = fd_base + 2;
+    c->fd_c2p_send = fd_base + 3;
+    c->fd_c2p_ack = fd_base + 4;
+    c->fd_c2p_shm = fd_base + 5;
+
+    // Mmap P2C (Read)
+    c->shm_p2c_ptr = shm_map(c->fd_p2c_shm, c->shm_size, PROT_READ, mem_flags);
+    if (c->shm_p2c_ptr == MAP_FAILED) {
+        c->shm_p2c_ptr = NULL;
+        return -1;
+    }
+
+    // Mmap C2P (Write)
+    c->c2p_size = shm_size;
+    c->shm_c2p_ptr = shm_map(c->fd_c2p_shm, c->c2p_size, PROT_READ | PROT_WRITE, mem_flags);
+    if (c->shm_c2p_ptr == MAP_FAILED) {
+        c->shm_c2p_ptr = NULL;
+        return -1;
+    }
+
+    // A parent in ring mode writes a header before starting us. The P2C ring
+    // is otherwise read-only, but the consumer index lives in its header.
+    c->mode = SHM_MODE_STANDARD;
+    if (c->shm_size >= sizeof(shm_hello_t) && ((shm_hello_t*)c->shm_p2c_ptr)->magic == SHM_HELLO_MAGIC &&
+        child_handshake(c) != 0) return -1;
+    if (c->shm_size > SHM_HDR_SIZE && ((shm_ring_hdr_t*)c->shm_p2c_ptr)->magic == SHM_HDR_MAGIC) {
+        // hugetlb mappings cannot be split below the huge page size
+        if (mprotect(c->shm_p2c_ptr, SHM_HDR_SIZE, PROT_READ | PROT_WRITE) != 0 &&
+            mprotect(c->shm_p2c_ptr, c->shm_size, PROT_READ | PROT_WRITE) != 0) return -1;
+        if (ring_attach(&c->ring_p2c, c->shm_p2c_ptr, c->shm_size, c->fd_p2c_send, c->fd_p2c_ack) != 0) return -1;
+        if (ring_attach(&c->ring_c2p, c->shm_c2p_ptr, c->shm_size, c->fd_c2p_send, c->fd_c2p_ack) != 0) return -1;
+        c->mode = c->ring_p2c.slot_size ? SHM_MODE_SLOTS : SHM_MODE_RING;
+        c->peer_features = c->ring_p2c.hdr->features;
+        c->ring_c2p.peer_trace = (c->peer_features & SHM_FEAT_TRACE) != 0;
+        if (c->mode == SHM_MODE_SLOTS) {
+            // The consumer also stamps the per-slot sequence words
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            size_t rw = (SHM_HDR_SIZE + slot_seq_bytes(c->ring_p2c.slot_mask + 1) + page - 1) & ~(page - 1);
+            if (mprotect(c->shm_p2c_ptr, rw, PROT_READ | PROT_WRITE) != 0 &&
+                mprotect(c->shm_p2c_ptr, c->shm_size, PROT_READ | PROT_WRITE) != 0) return -1;
+        }
+
+        // Apply the parent's hints that were not requested locally
+        unsigned hint = c->ring_p2c.hdr->mem_flags & ~mem_flags;
+        shm_advise(c->shm_p2c_ptr, c->shm_size, hint, 0);
+        shm_advise(c->shm_c2p_ptr, c->shm_size, hint, 1);
+    }
+    return 0;
+}
+
+// The parent passes the FDs after the lanes as -fd-bcast and -fd-sock in
+// the child's argv, which the library reads back from /proc.
+static void child_find_fds(shm_child_t *c) {
+    char buf[4096];
+    int fd = open("/proc/self/cmdline", O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return;
+    buf[n] = '\0';
+
+    for (char *arg = buf; arg < buf + n; arg += strlen(arg) + 1) {
+        char *val = arg + strlen(arg) + 1;
+        if (val >= buf + n) break;
+        if (strcmp(arg, "-fd-bcast") == 0) c->fd_bcast = atoi(val);
+        else if (strcmp(arg, "-fd-sock") == 0) c->fd_sock = atoi(val);
+    }
+}
+
+static void child_release_lane(shm_child_t *c) {
+    uring_detach(&c->ring_p2c, &c->ring_c2p);
+    free(c->stream_buf);
+    free(c->ring_p2c.lz4_buf);
+    free(c->ring_c2p.lz4_buf);
+    if (c->shm_p2c_ptr && c->shm_p2c_ptr != MAP_FAILED) munmap(c->shm_p2c_ptr, c->shm_size);
+    if (c->shm_c2p_ptr && c->shm_c2p_ptr != MAP_FAILED) munmap(c->shm_c2p_ptr, c->c2p_size);
+}
+
+shm_child_t* shm_child_new(size_t shm_size) {
+    return shm_child_new_ex(shm_size, 0);
+}
+
+shm_child_t* shm_child_new_ex(size_t shm_size, unsigned mem_flags) {
+    shm_child_t *c = (shm_child_t*)malloc(sizeof(shm_child_t));
+    if (!c) return NULL;
+
+    if (child_attach_lane(c, shm_size, 3, mem_flags) != 0) {
+        shm_child_close(c);
+        return NULL;
+    }
+
+    uint32_t lanes = mode_has_ring(c->mode) ? c->ring_p2c.hdr->lanes : 1;
+    if (lanes <= 1) {
+        child_find_fds(c);
+        return c;
+    }
+    if (lanes > SHM_MAX_LANES) {
+        shm_child_close(c);
+        return NULL;
+    }
+
+    c->lanes = (shm_child_t**)calloc(lanes - 1, sizeof(shm_child_t*));
+    if (!c->lanes) {
+        shm_child_close(c);
+        return NULL;
+    }
+    c->lane_count = (int)lanes;
+
+    for (int i = 1; i < c->lane_count; i++) {
+        shm_child_t *l = (shm_child_t*)malloc(sizeof(shm_child_t));
+        if (l) c->lanes[i - 1] = l;
+        if (!l || child_attach_lane(l, shm_size, 3 + 6 * i, mem_flags) != 0 || l->mode != c->mode) {
+            shm_child_close(c);
+            return NULL;
+        }
+    }
+
+    child_find_fds(c);
+    return c;
+}
+
+shm_child_t* shm_child_lane(shm_child_t *c, int lane) {
+    if (lane == 0) return c;
+    if (lane < 0 || lane >= c->lane_count || !c->lanes) return NULL;
+    return c->lanes[lane - 1];
+}
+
+int shm_child_set_nonblock(shm_child_t *c, int nonblock) {
+    for (int i = 0; i < c->lane_count; i++) {
+        shm_child_t *l = shm_child_lane(c, i);
+        // Only the FDs this side reads: the flag is shared with the parent
+        int fds[2] = { l->fd_p2c_send, l->fd_c2p_ack };
+        for (int j = 0; j < 2; j++) {
+            int flags = fcntl(fds[j], F_GETFL);
+            if (flags == -1) return -1;
+            flags = nonblock ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+            if (fcntl(fds[j], F_SETFL, flags) == -1) return -1;
+        }
+    }
+    return 0;
+}
+
+int shm_child_set_uring(shm_child_t *c, unsigned uring_flags) {
+    // One submission queue cannot take the wakeups of several threads
+    if (uring_flags && c->ring_c2p.commit) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    int wq_fd = -1;
+    for (int i = 0; i < c->lane_count; i++) {
+        shm_child_t *l = shm_child_lane(c, i);
+        uring_detach(&l->ring_p2c, &l->ring_c2p);
+    }
+    if (!uring_flags) return 0;
+
+    for (int i = 0; i < c->lane_count; i++) {
+        shm_child_t *l = shm_child_lane(c, i);
+        if (uring_attach(&l->ring_p2c, l->fd_p2c_send, l->fd_p2c_ack,
+                         &l->ring_c2p, l->fd_c2p_send, l->fd_c2p_ack, uring_flags, &wq_fd) != 0) {
+            // Fall back to plain syscalls everywhere
+            shm_child_set_uring(c, 0);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int shm_child_recv_fd(const shm_child_t *c) {
+    return c->fd_p2c_send;
+}
+
+int shm_child_send_fd(const shm_child_t *c) {
+    return c->fd_c2p_ack;
+}
+
+int shm_child_pass_fd(shm_child_t *c, int fd, uint64_t tag) {
+    return sock_pass(c->fd_sock, fd, tag);
+}
+
+int shm_child_take_fd(shm_child_t *c, uint64_t *tag) {
+    return sock_take(c->fd_sock, tag, 0);
+}
+
+int shm_child_fd_socket(const shm_child_t *c) {
+    return c->fd_sock;
+}
+
+int shm_child_send_memfd(shm_child_t *c, int memfd) {
+    return memfd_pass(c->fd_sock, memfd);
+}
+
+int shm_child_recv_memfd(shm_child_t *c, const uint8_t **data, size_t *len) {
+    return memfd_take(c->fd_sock, data, len);
+}
+
+// Lends the next message(s) from P2C; shm_child_read_end acks them.
+static int child_read_begin(shm_child_t *c, struct iovec *msgs, int max, int block) {
+    if (mode_has_ring(c->mode)) return ring_peek_batch(&c->ring_p2c, msgs, max, block);
+
+    uint64_t len_val, start = block ? stats_start(&c->ring_p2c) : 0;
+    if (stats_efd_wait(&c->ring_p2c, c->fd_p2c_send, &len_val, block) != 0) return -1;
+
+    // After a resize the first longer message makes us follow the memfd
+    uint64_t wire = len_val & ~SHM_SIG_LZ4;
+    if (wire > c->shm_size &&
+        shm_remap(c->fd_p2c_shm, &c->shm_p2c_ptr, &c->shm_size, (size_t)wire, PROT_READ, 0) != 0) {
+        fprintf(stderr, "Received length %lu exceeds SHM size\n", wire);
+        return efd_reject(c->ring_p2c.uring, c->fd_p2c_ack);
+    }
+
+    msgs[0].iov_base = c->shm_p2c_ptr;
+    msgs[0].iov_len = (size_t)wire;
+    if (len_val & SHM_SIG_LZ4) {
+        const uint8_t *data;
+        if (lz4_unframe(&c->ring_p2c, c->shm_p2c_ptr, (size_t)wire, &data, &msgs[0].iov_len) != 0) {
+            return efd_reject(c->ring_p2c.uring, c->fd_p2c_ack);
+        }
+        msgs[0].iov_base = (void*)data;
+    }
+    stats_count(&c->ring_p2c, (size_t)wire);
+    stats_latency(&c->ring_p2c, start);
+    c->ring_p2c.lent_ns = stats_trace_clock(&c->ring_p2c);
+    SHM_PROBE(recv_lent, &c->ring_p2c, wire);
+    return 1;
+}
+
+int shm_child_try_recv(shm_child_t *c, const uint8_t **data, size_t *len) {
+    struct iovec msg;
+    if (child_read_begin(c, &msg, 1, 0) != 1) return -1;
+    *data = (const uint8_t*)msg.iov_base;
+    *len = msg.iov_len;
+    return 0;
+}
+
+int shm_child_read_end(shm_child_t *c) {
+    if (mode_has_ring(c->mode)) return ring_release(&c->ring_p2c);
+    stats_end_read(&c->ring_p2c);
+
+    if (efd_signal(c->ring_p2c.uring, c->fd_p2c_ack, 1) != 0) return -1;
+    return 0;
+}
+
+// Reassembles a streamed message into c->stream_buf, which is kept for the
+// next one. msg is updated to point at the whole message.
+static int child_read_stream(shm_child_t *c, struct iovec *msg) {
+    size_t len;
+    if (ring_read_stream(&c->ring_p2c, (const uint8_t*)msg->iov_base, msg->iov_len,
+                         NULL, &c->stream_buf, &c->stream_cap, &len) != 0) return -1;
+    msg->iov_base = c->stream_buf;
+    msg->iov_len = len;
+    return 0;
+}
+
+static inline int child_is_fragment(const shm_child_t *c, const struct iovec *msg) {
+    return c->mode == SHM_MODE_RING && ring_is_fragment(&c->ring_p2c, (const uint8_t*)msg->iov_base);
+}
+
+// After a failed read: the message was dropped, and the next one can be read
+static inline int child_msg_dropped(const shm_child_t *c) {
+    return errno == EBADMSG && !c->ring_p2c.corrupt;
+}
+
+int shm_child_listen(shm_child_t *c, child_listen_cb handler) {
+    struct iovec msg;
+
+    while (1) {
+        if (child_read_begin(c, &msg, 1, 1) != 1) {
+            if (child_msg_dropped(c)) continue; // Already acked and reported
+            return -1;
+        }
+
+        // Fragments are already released once reassembled
+        if (child_is_fragment(c, &msg)) {
+            if (child_read_stream(c, &msg) != 0) return -1;
+            handler((const uint8_t*)msg.iov_base, msg.iov_len);
+            continue;
+        }
+
+        handler((const uint8_t*)msg.iov_base, msg.iov_len);
+        if (shm_child_read_end(c) != 0) return -1;
+    }
+    return 0;
+}
+
+int shm_child_listen_batch(shm_child_t *c, child_listen_batch_cb handler, int max) {
+    if (max < 1) return -1;
+
+    struct iovec *msgs = (struct iovec*)malloc(sizeof(struct iovec) * (size_t)max);
+    if (!msgs) return -1;
+
+    while (1) {
+        int n = child_read_begin(c, msgs, max, 1);
+        if (n < 1 && child_msg_dropped(c)) continue;
+        if (n < 1) break;
+
+        // A fragment always comes alone, see ring_peek_batch
+        if (child_is_fragment(c, &msgs[0])) {
+            if (child_read_stream(c, &msgs[0]) != 0) break;
+            handler(msgs, 1);
+            continue;
+        }
+
+        handler(msgs, n);
+        if (shm_child_read_end(c) != 0) break;
+    }
+
+    free(msgs);
+    return -1;
 }
 
-int shm_parent_start(shm_parent_t *p) {
-    // 1. Create P2C resources
-    p->efd_p2c_send = eventfd(0, 0);
-    if (p->efd_p2c_send == -1) return -1;
-    p->efd_p2c_ack = eventfd(0, 0);
-    if (p->efd_p2c_ack == -1) return -1;
-    p->memfd_p2c = memfd_create("efdstream_shm_p2c", 0);
-    if (p->memfd_p2c == -1) return -1;
-    if (ftruncate(p->memfd_p2c, p->shm_size) == -1) return -1;
-    p->shm_p2c_ptr = mmap(NULL, p->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, p->memfd_p2c, 0);
-    if (p->shm_p2c_ptr == MAP_FAILED) return -1;
+// Same as parent_settle, for the C2P ack.
+static int child_settle(shm_child_t *c, int block) {
+    if (!c->c2p_pending) return 0;
 
-    // 2. Create C2P resources
-    p->efd_c2p_send = eventfd(0, 0);
-    if (p->efd_c2p_send == -1) return -1;
-    p->efd_c2p_ack = eventfd(0, 0);
-    if (p->efd_c2p_ack == -1) return -1;
-    p->memfd_c2p = memfd_create("efdstream_shm_c2p", 0);
-    if (p->memfd_c2p == -1) return -1;
-    if (ftruncate(p->memfd_c2p, p->shm_size) == -1) return -1;
-    p->shm_c2p_ptr = mmap(NULL, p->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, p->memfd_c2p, 0);
-    if (p->shm_c2p_ptr == MAP_FAILED) return -1;
+    uint64_t ack_val;
+    if (stats_efd_wait(&c->ring_c2p, c->fd_c2p_ack, &ack_val, block) != 0) return -1;
+    c->c2p_pending = 0;
+    return 0;
+}
 
-    // 3. Fork and Exec
-    pid_t pid = fork();
-    if (pid == -1) {
-        return -1;
-    } else if (pid == 0) {
-        // Child process
-        // Map FDs to 3, 4, 5, 6, 7, 8
-        if (dup2(p->efd_p2c_send, 3) == -1) exit(1);
-        if (dup2(p->efd_p2c_ack, 4) == -1) exit(1);
-        if (dup2(p->memfd_p2c, 5) == -1) exit(1);
-        if (dup2(p->efd_c2p_send, 6) == -1) exit(1);
-        if (dup2(p->efd_c2p_ack, 7) == -1) exit(1);
-        if (dup2(p->memfd_c2p, 8) == -1) exit(1);
-
-        // Close originals if they are not the target FDs (to be safe, though dup2 handles overlap)
-        // In a real robust implementation, we should close all other FDs.
-        // For now, we rely on the fact that we just dup2'd what we need.
-
-        char shm_size_str[32];
-        sprintf(shm_size_str, "%zu", p->shm_size);
-
-        // Prepare args
-        // We pass the flags just for compatibility, even though we use fixed FDs.
-        char *args[] = {
-            p->child_path,
-            "-mode", "child",
-            "-fd-p2c-send", "3",
-            "-fd-p2c-ack", "4",
-            "-fd-p2c-shm", "5",
-            "-fd-c2p-send", "6",
-            "-fd-c2p-ack", "7",
-            "-fd-c2p-shm", "8",
-            "-shm-size", shm_size_str,
-            NULL
-        };
+// Standard mode: whether len fits in C2P, which the parent may have grown
+// since we mapped it.
+static int child_c2p_fits(shm_child_t *c, size_t len) {
+    if (len <= c->c2p_size) return 1;
+    return shm_remap(c->fd_c2p_shm, &c->shm_c2p_ptr, &c->c2p_size, len, PROT_READ | PROT_WRITE, 0) == 0;
+}
+
+uint8_t* shm_child_send_reserve(shm_child_t *c, size_t len) {
+    if (mode_has_ring(c->mode)) return ring_reserve(&c->ring_c2p, len, 1);
 
-        execv(p->child_path, args);
-        perror("execv failed");
-        exit(1);
+    if (!child_c2p_fits(c, len)) return stats_too_large(&c->ring_c2p);
+    c->ring_c2p.send_start = stats_start(&c->ring_c2p);
+    SHM_PROBE(send_reserve, &c->ring_c2p, len);
+    if (child_settle(c, 1) != 0) return NULL;
+    return c->shm_c2p_ptr;
+}
+
+int shm_child_send_commit(shm_child_t *c, size_t len) {
+    if (mode_has_ring(c->mode)) return ring_commit(&c->ring_c2p, len);
+
+    if (len > c->c2p_size) return -1;
+    stats_stage(&c->ring_c2p, SHM_STAGE_COPY, c->ring_c2p.send_start);
+    SHM_PROBE(send_commit, &c->ring_c2p, len);
+
+    // Signal and wait for ACK
+    if (stats_efd_signal_wait(&c->ring_c2p, c->fd_c2p_send, (uint64_t)len, c->fd_c2p_ack, &c->c2p_pending) != 0) return -1;
+
+    stats_count(&c->ring_c2p, len);
+    stats_latency(&c->ring_c2p, c->ring_c2p.send_start);
+    return 0;
+}
+
+// Same as parent_send_lz4, for C2P
+static int child_send_lz4(shm_child_t *c, const uint8_t *data, size_t len, int block) {
+    shm_ring_t *r = &c->ring_c2p;
+    uint64_t start = stats_start(r);
+    if (child_settle(c, block) != 0) return -1;
+
+    size_t n = lz4_frame(c->shm_c2p_ptr, c->c2p_size, data, len);
+    if (n == 0) return 1;
+
+    if (block) {
+        if (stats_efd_signal_wait(r, c->fd_c2p_send, (uint64_t)n | SHM_SIG_LZ4, c->fd_c2p_ack, &c->c2p_pending) != 0) return -1;
     } else {
-        // Parent process
-        p->child_pid = pid;
+        if (efd_signal(r->uring, c->fd_c2p_send, (uint64_t)n | SHM_SIG_LZ4) != 0) return -1;
+        c->c2p_pending = 1;
     }
-
+    stats_count(r, n);
+    stats_latency(r, start);
     return 0;
 }
 
-int shm_parent_send_data(shm_parent_t *p, const uint8_t *data, size_t len) {
-    if (len > p->shm_size) return -1;
+int shm_child_send_data(shm_child_t *c, const uint8_t *data, size_t len) {
+    if (c->ring_c2p.commit) return mp_send(&c->ring_c2p, data, len, 1);
+    if (ring_compresses(&c->ring_c2p, len)) {
+        if (mode_has_ring(c->mode)) return ring_send_lz4(&c->ring_c2p, data, len, 1);
+        int rc = child_send_lz4(c, data, len, 1);
+        if (rc <= 0) return rc;
+    }
+
+    uint8_t *dst = shm_child_send_reserve(c, len);
+    if (!dst) return -1;
 
     // Write to SHM
-    memcpy(p->shm_p2c_ptr, data, len);
+    shm_copy(dst, data, len);
 
-    // Signal Length
-    uint64_t len_val = (uint64_t)len;
-    if (write(p->efd_p2c_send, &len_val, 8) != 8) return -1;
+    return shm_child_send_commit(c, len);
+}
 
-    // Wait for ACK
-    uint64_t ack_val;
-    if (read(p->efd_p2c_ack, &ack_val, 8) != 8) return -1;
+int shm_child_try_send(shm_child_t *c, const uint8_t *data, size_t len) {
+    if (c->ring_c2p.commit) return mp_send(&c->ring_c2p, data, len, 0);
+    if (ring_compresses(&c->ring_c2p, len)) {
+        if (mode_has_ring(c->mode)) return ring_send_lz4(&c->ring_c2p, data, len, 0);
+        int rc = child_send_lz4(c, data, len, 0);
+        if (rc <= 0) return rc;
+    }
+
+    if (mode_has_ring(c->mode)) {
+        uint8_t *dst = ring_reserve(&c->ring_c2p, len, 0);
+        if (!dst) return -1;
+        shm_copy(dst, data, len);
+        return ring_commit(&c->ring_c2p, len);
+    }
+
+    if (!child_c2p_fits(c, len)) {
+        stats_too_large(&c->ring_c2p);
+        return -1;
+    }
+    uint64_t start = stats_start(&c->ring_c2p);
+    if (child_settle(c, 0) != 0) return -1;
+
+    shm_copy(c->shm_c2p_ptr, data, len);
+    uint64_t copied = stats_stage(&c->ring_c2p, SHM_STAGE_COPY, start);
 
+    if (efd_signal(c->ring_c2p.uring, c->fd_c2p_send, (uint64_t)len) != 0) return -1;
+    stats_stage(&c->ring_c2p, SHM_STAGE_SIGNAL, copied);
+    SHM_PROBE(send_signal, &c->ring_c2p, len);
+    c->c2p_pending = 1;
+    stats_count(&c->ring_c2p, len);
+    stats_latency(&c->ring_c2p, start);
     return 0;
 }
 
-uint8_t* shm_parent_read_data(shm_parent_t *p, size_t *len) {
-    // Wait for Signal
-    uint64_t len_val;
-    if (read(p->efd_c2p_send, &len_val, 8) != 8) return NULL;
+int shm_child_send_stream(shm_child_t *c, const uint8_t *data, size_t len) {
+    if (c->ring_c2p.commit) {
+        // Fragments from two threads would interleave
+        if (len > ring_stream_chunk(&c->ring_c2p)) {
+            errno = EINVAL;
+            return -1;
+        }
+        return mp_send(&c->ring_c2p, data, len, 1);
+    }
+    if (mode_has_ring(c->mode)) return ring_send_stream(&c->ring_c2p, data, len);
+    return shm_child_send_data(c, data, len);
+}
+
+int shm_child_send_batch(shm_child_t *c, const struct iovec *msgs, int n) {
+    if (c->ring_c2p.commit) {
+        for (int i = 0; i < n; i++) {
+            if (mp_send(&c->ring_c2p, (const uint8_t*)msgs[i].iov_base, msgs[i].iov_len, 1) != 0) return -1;
+        }
+        return 0;
+    }
+    if (mode_has_ring(c->mode)) return ring_send_batch(&c->ring_c2p, msgs, n);
 
-    if (len_val > p->shm_size) return NULL;
+    for (int i = 0; i < n; i++) {
+        if (shm_child_send_data(c, (const uint8_t*)msgs[i].iov_base, msgs[i].iov_len) != 0) return -1;
+    }
+    return 0;
+}
 
-    *len = (size_t)len_val;
-    uint8_t *data = (uint8_t*)malloc(*len);
-    if (!data) return NULL;
+uint8_t* shm_child_slot_reserve(shm_child_t *c, int max, int *n) {
+    if (c->mode != SHM_MODE_SLOTS) return NULL;
+    return slot_reserve(&c->ring_c2p, max, 1, n);
+}
 
-    // Read from SHM
-    memcpy(data, p->shm_c2p_ptr, *len);
+int shm_child_slot_commit(shm_child_t *c, int n) {
+    if (c->mode != SHM_MODE_SLOTS) return -1;
+    return slot_commit(&c->ring_c2p, n);
+}
 
-    // Send ACK
-    uint64_t ack_val = 1;
-    if (write(p->efd_c2p_ack, &ack_val, 8) != 8) {
-        free(data);
-        return NULL;
+const uint8_t* shm_child_slot_peek(shm_child_t *c, int max, int *n) {
+    if (c->mode != SHM_MODE_SLOTS) return NULL;
+    return slot_peek(&c->ring_p2c, max, 1, n);
+}
+
+unsigned shm_child_peer_features(const shm_child_t *c) {
+    return c->peer_features;
+}
+
+int shm_child_multi_producer(const shm_child_t *c) {
+    return c->ring_c2p.commit != NULL;
+}
+
+size_t shm_child_slot_size(const shm_child_t *c) {
+    return c->mode == SHM_MODE_SLOTS ? c->ring_p2c.slot_size : 0;
+}
+
+void shm_child_set_spin(shm_child_t *c, uint32_t spin) {
+    c->ring_p2c.spin = spin;
+    c->ring_c2p.spin = spin;
+}
+
+int shm_child_set_compress(shm_child_t *c, size_t min_size) {
+    int no_lz4 = c->peer_features && !(c->peer_features & SHM_FEAT_LZ4);
+    if (min_size && (c->mode == SHM_MODE_SLOTS || no_lz4 || c->ring_c2p.commit)) return -1;
+    c->ring_c2p.compress_min = min_size;
+    return 0;
+}
+
+int shm_child_set_overflow(shm_child_t *c, shm_overflow_t overflow, int timeout_ms) {
+    if (overflow == SHM_OVERFLOW_DROP_OLDEST) return -1;
+    return ring_set_overflow(&c->ring_c2p, overflow, timeout_ms);
+}
+
+size_t shm_child_send_credit(shm_child_t *c) {
+    if (mode_has_ring(c->mode)) return ring_credit(&c->ring_c2p);
+    return child_settle(c, 0) == 0 ? c->c2p_size : 0;
+}
+
+int shm_child_trim(shm_child_t *c) {
+    if (mode_has_ring(c->mode)) {
+        return ring_trim(&c->ring_c2p, c->fd_c2p_shm, c->c2p_size, c->ring_p2c.hdr->mem_flags);
     }
+    if (child_settle(c, 0) != 0) return -1;
+    return shm_punch(c->fd_c2p_shm, 0, c->c2p_size, 0);
+}
 
-    return data;
+void shm_child_set_futex(shm_child_t *c, int futex) {
+    c->ring_p2c.futex = futex;
+    c->ring_c2p.futex = futex;
 }
 
-void shm_parent_close(shm_parent_t *p) {
-    if (p->shm_p2c_ptr && p->shm_p2c_ptr != MAP_FAILED) munmap(p->shm_p2c_ptr, p->shm_size);
-    if (p->shm_c2p_ptr && p->shm_c2p_ptr != MAP_FAILED) munmap(p->shm_c2p_ptr, p->shm_size);
-    
-    if (p->efd_p2c_send != -1) close(p->efd_p2c_send);
-    if (p->efd_p2c_ack != -1) close(p->efd_p2c_ack);
-    if (p->memfd_p2c != -1) close(p->memfd_p2c);
-    
-    if (p->efd_c2p_send != -1) close(p->efd_c2p_send);
-    if (p->efd_c2p_ack != -1) close(p->efd_c2p_ack);
-    if (p->memfd_c2p != -1) close(p->memfd_c2p);
+void shm_child_set_stats(shm_child_t *c, unsigned flags) {
+    c->ring_p2c.stats_flags = flags;
+    c->ring_c2p.stats_flags = flags;
+}
 
-    if (p->child_pid > 0) {
-        kill(p->child_pid, SIGTERM);
-        waitpid(p->child_pid, NULL, 0);
+void shm_child_get_stats(const shm_child_t *c, shm_stats_t *out) {
+    out->send = c->ring_c2p.stats;
+    out->recv = c->ring_p2c.stats;
+}
+
+void shm_child_reset_stats(shm_child_t *c) {
+    memset(&c->ring_c2p.stats, 0, sizeof(shm_dir_stats_t));
+    memset(&c->ring_p2c.stats, 0, sizeof(shm_dir_stats_t));
+}
+
+void shm_child_close(shm_child_t *c) {
+    child_release_lane(c);
+
+    if (c->lanes) {
+        for (int i = 0; i < c->lane_count - 1; i++) {
+            if (!c->lanes[i]) continue;
+            child_release_lane(c->lanes[i]);
+            free(c->lanes[i]);
+        }
+        free(c->lanes);
     }
-    
-    free(p->child_path);
-    free(p);
+
+    free(c);
 }
 
-// --- Child Implementation ---
+// --- RPC Implementation ---
 
-shm_child_t* shm_child_new(size_t shm_size) {
-    shm_child_t *c = (shm_child_t*)malloc(sizeof(shm_child_t));
-    if (!c) return NULL;
-    memset(c, 0, sizeof(shm_child_t));
-    c->shm_size = shm_size;
+#define RPC_BATCH 64
 
-    // Fixed FDs
-    c->fd_p2c_send = 3;
-    c->fd_p2c_ack = 4;
-    c->fd_p2c_shm = 5;
-    c->fd_c2p_send = 6;
-    c->fd_c2p_ack = 7;
-    c->fd_c2p_shm = 8;
+static uint8_t* rpc_frame(uint8_t *dst, uint64_t id) {
+    memcpy(dst, &id, sizeof(id));
+    return dst + SHM_RPC_HDR_SIZE;
+}
 
-    // Mmap P2C (Read)
-    c->shm_p2c_ptr = mmap(NULL, c->shm_size, PROT_READ, MAP_SHARED, c->fd_p2c_shm, 0);
-    if (c->shm_p2c_ptr == MAP_FAILED) {
-        free(c);
+shm_rpc_t* shm_rpc_new(shm_parent_t *p, size_t max_inflight) {
+    shm_rpc_t *rpc = (shm_rpc_t*)calloc(1, sizeof(shm_rpc_t));
+    if (!rpc) return NULL;
+
+    // Power of two, so the slot of an ID is a mask away
+    size_t cap = 1;
+    while (cap < max_inflight) cap *= 2;
+
+    rpc->parent = p;
+    rpc->next_id = 1;
+    rpc->mask = cap - 1;
+    rpc->slots = (shm_rpc_slot_t*)calloc(cap, sizeof(shm_rpc_slot_t));
+    if (!rpc->slots) {
+        free(rpc);
         return NULL;
     }
+    return rpc;
+}
 
-    // Mmap C2P (Write)
-    c->shm_c2p_ptr = mmap(NULL, c->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd_c2p_shm, 0);
-    if (c->shm_c2p_ptr == MAP_FAILED) {
-        munmap(c->shm_p2c_ptr, c->shm_size);
-        free(c);
-        return NULL;
+static int rpc_complete(shm_rpc_t *rpc, const uint8_t *data, size_t len) {
+    if (len < SHM_RPC_HDR_SIZE) {
+        fprintf(stderr, "Short RPC reply of %zu bytes\n", len);
+        return 0;
     }
 
-    return c;
+    uint64_t id;
+    memcpy(&id, data, sizeof(id));
+    shm_rpc_slot_t *slot = &rpc->slots[id & rpc->mask];
+    if (!slot->busy || slot->id != id) {
+        fprintf(stderr, "RPC reply for unknown request %lu\n", id);
+        return 0;
+    }
+
+    shm_rpc_cb cb = slot->cb;
+    void *ctx = slot->ctx;
+    slot->busy = 0;
+    rpc->inflight--;
+    if (cb) cb(ctx, id, data + SHM_RPC_HDR_SIZE, len - SHM_RPC_HDR_SIZE);
+    return 1;
 }
 
-int shm_child_listen(shm_child_t *c, child_listen_cb handler) {
-    uint64_t len_val;
-    uint64_t ack_val = 1;
+int shm_rpc_poll(shm_rpc_t *rpc, int block) {
+    struct iovec msgs[RPC_BATCH];
+    int n;
+
+    // The replies being completed are still lent from the channel
+    if (rpc->polling) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (block) {
+        n = shm_parent_read_batch_begin(rpc->parent, msgs, RPC_BATCH);
+        if (n < 1) return -1;
+    } else {
+        const uint8_t *data;
+        size_t len;
+        if (shm_parent_try_recv(rpc->parent, &data, &len) != 0) return errno == EAGAIN ? 0 : -1;
+        msgs[0].iov_base = (void*)data;
+        msgs[0].iov_len = len;
+        n = 1;
+    }
+
+    int done = 0;
+    rpc->polling = 1;
+    for (int i = 0; i < n; i++) {
+        done += rpc_complete(rpc, (const uint8_t*)msgs[i].iov_base, msgs[i].iov_len);
+    }
+    rpc->polling = 0;
+    if (shm_parent_read_end(rpc->parent) != 0) return -1;
+    return done;
+}
+
+// Drains every reply that is already there.
+static int rpc_drain(shm_rpc_t *rpc) {
+    int total = 0, n;
+    while ((n = shm_rpc_poll(rpc, 0)) > 0) total += n;
+    return n < 0 ? -1 : total;
+}
+
+// Non-blocking reserve of the P2C slot. The child may be stuck sending a
+// reply we have not read, so the caller never blocks on the send side alone.
+static uint8_t* rpc_try_reserve(shm_parent_t *p, size_t len) {
+    if (mode_has_ring(p->mode)) return ring_reserve(&p->ring_p2c, len, 0);
+
+    if (len > p->shm_size) return stats_too_large(&p->ring_p2c);
+    if (parent_settle(p, 0) != 0) return NULL;
+    return p->shm_p2c_ptr;
+}
+
+static int rpc_commit(shm_parent_t *p, size_t len) {
+    if (mode_has_ring(p->mode)) return ring_commit(&p->ring_p2c, len);
+
+    // Pipelined: the ack is collected by the next call, see parent_settle
+    if (efd_signal(p->ring_p2c.uring, p->efd_p2c_send, (uint64_t)len) != 0) return -1;
+    p->p2c_pending = 1;
+    stats_count(&p->ring_p2c, len);
+    return 0;
+}
+
+// Waits for the channel to accept a frame, completing replies meanwhile.
+static uint8_t* rpc_reserve(shm_rpc_t *rpc, size_t len, shm_rpc_slot_t *slot) {
+    shm_parent_t *p = rpc->parent;
 
     while (1) {
-        if (read(c->fd_p2c_send, &len_val, 8) != 8) return -1;
-        
-        if (len_val > c->shm_size) {
-            fprintf(stderr, "Received length %lu exceeds SHM size\n", len_val);
-            continue;
+        // The table slot must be free too: an older call may still hold it
+        if (!slot->busy) {
+            uint8_t *dst = rpc_try_reserve(p, len);
+            if (dst) return dst;
+            if (errno != EAGAIN) return NULL;
         }
 
-        handler(c->shm_p2c_ptr, (size_t)len_val);
+        int n = rpc_drain(rpc);
+        if (n < 0) return NULL;
+        if (n > 0) continue;
 
-        if (write(c->fd_p2c_ack, &ack_val, 8) != 8) return -1;
+        struct pollfd pfds[2] = {
+            { .fd = shm_parent_recv_fd(p), .events = POLLIN },
+            { .fd = shm_parent_send_fd(p), .events = slot->busy ? 0 : POLLIN },
+        };
+        if (poll(pfds, 2, -1) == -1) return NULL;
+    }
+}
+
+int shm_rpc_call(shm_rpc_t *rpc, const uint8_t *data, size_t len,
+                 shm_rpc_cb cb, void *ctx, uint64_t *id_out) {
+    uint64_t id = rpc->next_id;
+    shm_rpc_slot_t *slot = &rpc->slots[id & rpc->mask];
+    if (rpc->polling) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    uint8_t *dst = rpc_reserve(rpc, SHM_RPC_HDR_SIZE + len, slot);
+    if (!dst) return -1;
+    shm_copy(rpc_frame(dst, id), data, len);
+
+    slot->id = id;
+    slot->cb = cb;
+    slot->ctx = ctx;
+    slot->busy = 1;
+    if (rpc_commit(rpc->parent, SHM_RPC_HDR_SIZE + len) != 0) {
+        slot->busy = 0;
+        return -1;
     }
+
+    rpc->next_id++;
+    rpc->inflight++;
+    if (id_out) *id_out = id;
     return 0;
 }
 
-int shm_child_send_data(shm_child_t *c, const uint8_t *data, size_t len) {
-    if (len > c->shm_size) return -1;
+int shm_rpc_wait(shm_rpc_t *rpc, uint64_t id) {
+    shm_rpc_slot_t *slot = &rpc->slots[id & rpc->mask];
+    while (slot->busy && slot->id == id) {
+        if (shm_rpc_poll(rpc, 1) < 0) return -1;
+    }
+    return 0;
+}
 
-    // Write to SHM
-    memcpy(c->shm_c2p_ptr, data, len);
+int shm_rpc_wait_all(shm_rpc_t *rpc) {
+    while (rpc->inflight > 0) {
+        if (shm_rpc_poll(rpc, 1) < 0) return -1;
+    }
+    return 0;
+}
 
-    // Signal
-    uint64_t len_val = (uint64_t)len;
-    if (write(c->fd_c2p_send, &len_val, 8) != 8) return -1;
+void shm_rpc_close(shm_rpc_t *rpc) {
+    free(rpc->slots);
+    free(rpc);
+}
 
-    // Wait for ACK
-    uint64_t ack_val;
-    if (read(c->fd_c2p_ack, &ack_val, 8) != 8) return -1;
+int shm_child_rpc_listen(shm_child_t *c, child_rpc_cb handler) {
+    struct iovec msgs[RPC_BATCH];
+
+    while (1) {
+        int n = child_read_begin(c, msgs, RPC_BATCH, 1);
+        if (n < 1 && child_msg_dropped(c)) continue;
+        if (n < 1) return -1;
+
+        int fragment = child_is_fragment(c, &msgs[0]);
+        if (fragment && child_read_stream(c, &msgs[0]) != 0) return -1;
+
+        for (int i = 0; i < n; i++) {
+            const uint8_t *data = (const uint8_t*)msgs[i].iov_base;
+            if (msgs[i].iov_len < SHM_RPC_HDR_SIZE) {
+                fprintf(stderr, "Short RPC request of %zu bytes\n", msgs[i].iov_len);
+                continue;
+            }
+            uint64_t id;
+            memcpy(&id, data, sizeof(id));
+            handler(id, data + SHM_RPC_HDR_SIZE, msgs[i].iov_len - SHM_RPC_HDR_SIZE);
+        }
+
+        if (!fragment && shm_child_read_end(c) != 0) return -1;
+    }
+}
+
+int shm_child_rpc_reply(shm_child_t *c, uint64_t id, const uint8_t *data, size_t len) {
+    // Worker threads may then reply at once, each with its own claim
+    if (c->ring_c2p.commit) {
+        uint64_t pos;
+        uint8_t *dst = mp_reserve(&c->ring_c2p, SHM_RPC_HDR_SIZE + len, 1, &pos);
+        if (!dst) return -1;
+        shm_copy(rpc_frame(dst, id), data, len);
+        return mp_commit(&c->ring_c2p, pos, ring_rec_size(SHM_RPC_HDR_SIZE + len), SHM_RPC_HDR_SIZE + len, 0);
+    }
+
+    uint8_t *dst = shm_child_send_reserve(c, SHM_RPC_HDR_SIZE + len);
+    if (!dst) return -1;
+    shm_copy(rpc_frame(dst, id), data, len);
+    return shm_child_send_commit(c, SHM_RPC_HDR_SIZE + len);
+}
 
+// --- Broadcast Implementation ---
+
+// Only magic and capacity of the data memfd's header are used; the indices
+// and waiting flags of each reader live in its cursor page.
+shm_bcast_t* shm_bcast_new(size_t shm_size) {
+    if (shm_size <= SHM_HDR_SIZE + 2 * sizeof(shm_rec_t)) return NULL;
+
+    shm_bcast_t *b = (shm_bcast_t*)calloc(1, sizeof(shm_bcast_t));
+    if (!b) return NULL;
+    b->shm_size = shm_size;
+    b->ptr = MAP_FAILED;
+
+    b->memfd = memfd_create("efdstream_bcast", 0);
+    if (b->memfd == -1 || ftruncate(b->memfd, shm_size) == -1 ||
+        (b->ptr = shm_map(b->memfd, shm_size, PROT_READ | PROT_WRITE, 0)) == MAP_FAILED) {
+        shm_bcast_close(b);
+        return NULL;
+    }
+    ring_init(b->ptr, shm_size, 0);
+    b->capacity = ((shm_ring_hdr_t*)b->ptr)->capacity;
+    return b;
+}
+
+static int bcast_create_reader(shm_bcast_t *b, shm_bcast_peer_t *r) {
+    int efd_send = -1, efd_ack = -1;
+    uint8_t *cursor = MAP_FAILED;
+
+    memset(r, 0, sizeof(*r));
+    r->memfd_cursor = memfd_create("efdstream_bcast_cursor", 0);
+    if (r->memfd_cursor != -1 && ftruncate(r->memfd_cursor, SHM_HDR_SIZE) == 0) {
+        cursor = shm_map(r->memfd_cursor, SHM_HDR_SIZE, PROT_READ | PROT_WRITE, 0);
+    }
+    if (cursor != MAP_FAILED) efd_send = eventfd(0, 0);
+    if (efd_send != -1) efd_ack = eventfd(0, 0);
+
+    if (efd_ack == -1 || ring_attach(&r->ring, b->ptr, b->shm_size, efd_send, efd_ack) != 0) {
+        if (efd_send != -1) close(efd_send);
+        if (efd_ack != -1) close(efd_ack);
+        if (cursor != MAP_FAILED) munmap(cursor, SHM_HDR_SIZE);
+        if (r->memfd_cursor != -1) close(r->memfd_cursor);
+        return -1;
+    }
+
+    // The reader begins at the current tail
+    shm_ring_hdr_t *h = (shm_ring_hdr_t*)cursor;
+    memset(h, 0, sizeof(shm_ring_hdr_t));
+    h->magic = SHM_HDR_MAGIC;
+    h->version = SHM_HDR_VERSION;
+    h->capacity = b->capacity;
+    atomic_store(&h->head, b->tail);
+    atomic_store(&h->tail, b->tail);
+    r->ring.hdr = h;
+    r->ring.tail = b->tail;
     return 0;
 }
 
-void shm_child_close(shm_child_t *c) {
-    if (c->shm_p2c_ptr && c->shm_p2c_ptr != MAP_FAILED) munmap(c->shm_p2c_ptr, c->shm_size);
-    if (c->shm_c2p_ptr && c->shm_c2p_ptr != MAP_FAILED) munmap(c->shm_c2p_ptr, c->shm_size);
-    free(c);
+int shm_bcast_add_reader(shm_bcast_t *b, shm_parent_t *p) {
+    if (p->child_pid > 0 || p->keep_standby || p->bcast) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    shm_bcast_peer_t *readers = (shm_bcast_peer_t*)realloc(b->readers, sizeof(shm_bcast_peer_t) * (size_t)(b->reader_count + 1));
+    if (!readers) return -1;
+    b->readers = readers;
+    if (bcast_create_reader(b, &readers[b->reader_count]) != 0) return -1;
+
+    p->bcast = b;
+    p->bcast_reader = b->reader_count++;
+    return 0;
+}
+
+// Reader heads only move forward, so once every reader has been seen with
+// room for the record, all of them still have it.
+static uint8_t* bcast_reserve(shm_bcast_t *b, size_t len, int block, uint64_t *pos) {
+    uint64_t need = ring_rec_size(len);
+    if (need > b->capacity / 2) {
+        errno = EMSGSIZE;
+        return NULL;
+    }
+
+    uint64_t off = b->tail % b->capacity;
+    uint64_t pad = (b->capacity - off < need) ? b->capacity - off : 0;
+    for (int i = 0; i < b->reader_count; i++) {
+        shm_ring_t *r = &b->readers[i].ring;
+        if ((block ? ring_wait_space(r, pad + need) : ring_try_space(r, pad + need)) != 0) return NULL;
+    }
+
+    uint8_t *data = b->ptr + SHM_HDR_SIZE;
+    if (pad) {
+        shm_rec_t *pad_rec = (shm_rec_t*)(data + off);
+        pad_rec->len = (uint32_t)(pad - sizeof(shm_rec_t));
+        pad_rec->flags = SHM_REC_PAD;
+    }
+    *pos = b->tail + pad;
+    return data + *pos % b->capacity + sizeof(shm_rec_t);
+}
+
+static int bcast_commit(shm_bcast_t *b, uint64_t pos, size_t len) {
+    shm_rec_t *rec = (shm_rec_t*)(b->ptr + SHM_HDR_SIZE + pos % b->capacity);
+    rec->len = (uint32_t)len;
+    rec->flags = 0;
+    b->tail = pos + ring_rec_size(len);
+
+    int ret = 0;
+    for (int i = 0; i < b->reader_count; i++) {
+        shm_ring_t *r = &b->readers[i].ring;
+        r->tail = b->tail;
+        stats_count(r, len);
+        if (ring_publish(r, 1) != 0) ret = -1;
+    }
+    return ret;
+}
+
+static int bcast_send(shm_bcast_t *b, const uint8_t *data, size_t len, int block) {
+    uint64_t pos;
+    uint8_t *dst = bcast_reserve(b, len, block, &pos);
+    if (!dst) return -1;
+    shm_copy(dst, data, len);
+    return bcast_commit(b, pos, len);
+}
+
+int shm_bcast_send(shm_bcast_t *b, const uint8_t *data, size_t len) {
+    return bcast_send(b, data, len, 1);
+}
+
+int shm_bcast_try_send(shm_bcast_t *b, const uint8_t *data, size_t len) {
+    return bcast_send(b, data, len, 0);
+}
+
+size_t shm_bcast_max_message(const shm_bcast_t *b) {
+    return ring_max_payload(b->capacity);
+}
+
+int shm_bcast_reader_count(const shm_bcast_t *b) {
+    return b->reader_count;
+}
+
+void shm_bcast_close(shm_bcast_t *b) {
+    for (int i = 0; i < b->reader_count; i++) {
+        shm_bcast_peer_t *r = &b->readers[i];
+        munmap(r->ring.hdr, SHM_HDR_SIZE);
+        close(r->memfd_cursor);
+        close(r->ring.efd_send);
+        close(r->ring.efd_ack);
+    }
+    free(b->readers);
+    if (b->ptr != MAP_FAILED) munmap(b->ptr, b->shm_size);
+    if (b->memfd != -1) close(b->memfd);
+    free(b);
+}
+
+// The data memfd is mapped read-only, like the P2C memfd of a lane; only
+// the cursor page is written.
+shm_bcast_reader_t* shm_child_bcast_open(shm_child_t *c) {
+    int fd_base = c->fd_bcast;
+    struct stat st;
+    if (fd_base == -1 || fstat(fd_base + 2, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size <= SHM_HDR_SIZE) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    shm_bcast_reader_t *r = (shm_bcast_reader_t*)calloc(1, sizeof(shm_bcast_reader_t));
+    if (!r) return NULL;
+    r->data_size = (size_t)st.st_size;
+    r->data_ptr = shm_map(fd_base + 2, r->data_size, PROT_READ, 0);
+    r->cursor_ptr = shm_map(fd_base + 3, SHM_HDR_SIZE, PROT_READ | PROT_WRITE, 0);
+
+    shm_ring_hdr_t *cursor = (shm_ring_hdr_t*)r->cursor_ptr;
+    if (r->data_ptr == MAP_FAILED || r->cursor_ptr == MAP_FAILED ||
+        ring_attach(&r->ring, r->data_ptr, r->data_size, fd_base, fd_base + 1) != 0 ||
+        cursor->magic != SHM_HDR_MAGIC || cursor->capacity != r->ring.capacity) {
+        shm_bcast_reader_close(r);
+        errno = ENOENT;
+        return NULL;
+    }
+    r->ring.hdr = cursor;
+    r->ring.tail = atomic_load(&cursor->tail);
+    return r;
+}
+
+int shm_bcast_read_begin(shm_bcast_reader_t *r, const uint8_t **data, size_t *len) {
+    return ring_peek(&r->ring, data, len, 1);
+}
+
+int shm_bcast_try_read_begin(shm_bcast_reader_t *r, const uint8_t **data, size_t *len) {
+    return ring_peek(&r->ring, data, len, 0);
+}
+
+int shm_bcast_read_end(shm_bcast_reader_t *r) {
+    return ring_release(&r->ring);
+}
+
+int shm_bcast_reader_fd(const shm_bcast_reader_t *r) {
+    return r->ring.efd_send;
+}
+
+void shm_bcast_reader_close(shm_bcast_reader_t *r) {
+    if (r->data_ptr && r->data_ptr != MAP_FAILED) munmap(r->data_ptr, r->data_size);
+    if (r->cursor_ptr && r->cursor_ptr != MAP_FAILED) munmap(r->cursor_ptr, SHM_HDR_SIZE);
+    free(r);
 }
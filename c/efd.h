@@ -3,11 +3,264 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+// Channel Modes
+// SHM_MODE_STANDARD: one message at offset 0, acked over an eventfd (the Go and Rust protocol)
+// SHM_MODE_RING:     SPSC ring of framed records behind a one-page header
+// SHM_MODE_SLOTS:    ring of fixed-size slots, each guarded by a sequence word
+// SHM_MODE_AUTO:     handshake at start, ring mode if the child supports it. A
+//                    child without it that stays silent delays start by SHM_HELLO_TIMEOUT_MS.
+typedef enum {
+    SHM_MODE_STANDARD = 0,
+    SHM_MODE_RING = 1,
+    SHM_MODE_SLOTS = 2,
+    SHM_MODE_AUTO = 3,
+} shm_mode_t;
+
+// How shm_parent_start creates the child; both close all other inherited FDs
+// SHM_SPAWN_POSIX: posix_spawn, no page table copy of a large parent
+// SHM_SPAWN_FORK:  fork and execv
+typedef enum {
+    SHM_SPAWN_POSIX = 0,
+    SHM_SPAWN_FORK = 1,
+} shm_spawn_t;
+
+// What a send does when the peer has not made room (full ring, or no ack yet)
+// SHM_OVERFLOW_BLOCK:       wait, up to the timeout if one is set (default)
+// SHM_OVERFLOW_FAIL:        fail at once with EAGAIN
+// SHM_OVERFLOW_DROP_OLDEST: ring mode, P2C only: discard the oldest unread messages
+typedef enum {
+    SHM_OVERFLOW_BLOCK = 0,
+    SHM_OVERFLOW_FAIL = 1,
+    SHM_OVERFLOW_DROP_OLDEST = 2,
+} shm_overflow_t;
+
+// Memory Options (shm_parent_set_mem_flags / shm_child_new_ex)
+#define SHM_MEM_HUGETLB 0x1u  // 2MB hugetlbfs pages; needs reserved huge pages
+#define SHM_MEM_POPULATE 0x2u // Pre-fault the whole mapping (MAP_POPULATE)
+#define SHM_MEM_THP 0x4u      // madvise(MADV_HUGEPAGE); needs shmem_enabled=advise
+
+// Copies of at least this many bytes use non-temporal stores, see shm_set_nt_copy_threshold
+#define SHM_NT_COPY_DEFAULT (1u << 20)
+
+// LZ4 frame: raw length (4 bytes LE), 4 zero bytes, one LZ4 block. Flagged with
+// SHM_SIG_LZ4 in the eventfd value in standard mode, SHM_REC_LZ4 in ring mode.
+#define SHM_LZ4_HDR_SIZE 8
+#define SHM_SIG_LZ4 (1ull << 62)
+
+// Features a side supports, exchanged by the handshake
+#define SHM_FEAT_RING 0x1u  // SHM_MODE_RING, streamed messages included
+#define SHM_FEAT_SLOTS 0x2u // SHM_MODE_SLOTS
+#define SHM_FEAT_LANES 0x4u // More than one lane
+#define SHM_FEAT_FUTEX 0x8u // SHM_WAIT_FUTEX in the waiting flags
+#define SHM_FEAT_LZ4 0x10u  // Decodes compressed messages
+#define SHM_FEAT_RESIZE 0x20u // Follows memfds grown by shm_parent_resize
+#define SHM_FEAT_MULTI_PRODUCER 0x40u // Sends C2P from several threads, see commit_bytes
+#define SHM_FEAT_TRACE 0x80u // Strips SHM_REC_TRACE stamps off records
+#define SHM_FEATURES (SHM_FEAT_RING | SHM_FEAT_SLOTS | SHM_FEAT_LANES | SHM_FEAT_FUTEX | SHM_FEAT_LZ4 | \
+                      SHM_FEAT_RESIZE | SHM_FEAT_MULTI_PRODUCER | SHM_FEAT_TRACE)
+
+// Handshake (SHM_MODE_AUTO), little endian. The parent writes a hello at P2C
+// offset 0. The child CASes its magic to SHM_HELLO_CLAIMED, writes its own hello
+// at C2P offset 0 and signals with SHM_SIG_HELLO; the parent answers the same way.
+// On timeout the parent CASes the magic to SHM_HELLO_CLOSED instead.
+#define SHM_HELLO_MAGIC 0x4f4c4548u // "HELO"
+#define SHM_HELLO_CLAIMED 0x444d4c43u // "CLMD"
+#define SHM_HELLO_CLOSED 0x54554853u // "SHUT"
+#define SHM_HELLO_VERSION 1
+#define SHM_SIG_HELLO (1ull << 61)
+#define SHM_HELLO_TIMEOUT_MS 1000
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;     // Handshake version of the writer
+    uint32_t features;    // SHM_FEAT_* the writer supports
+    uint32_t hdr_version; // SHM_HDR_VERSION the writer speaks, 0 for none
+    uint64_t shm_size;    // Size of every memfd, as the writer maps it
+} shm_hello_t;
+
+// io_uring Options (shm_parent_set_uring / shm_child_set_uring)
+#define SHM_URING_ENABLE 0x1u // Eventfd signals and waits go through io_uring
+#define SHM_URING_SQPOLL 0x2u // Kernel thread polls the submission queue
+
+// Placement limits (shm_parent_set_affinity / shm_parent_set_numa_node)
+#define SHM_MAX_CPUS 1024
+#define SHM_MAX_NUMA_NODES 1024
+
+// --- Ring Layout (shared with the peer) ---
+
+#define SHM_CACHE_LINE 64
+#define SHM_HDR_SIZE 4096
+#define SHM_HDR_MAGIC 0x53444645u // "EFDS"
+#define SHM_HDR_VERSION 1
+#define SHM_MAX_LANES 64
+
+// Header at offset 0 of each memfd in ring mode. Indices are free-running
+// byte positions, producer and consumer on separate cache lines.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    uint32_t lanes;     // Lane count, set in the P2C header of lane 0
+    uint32_t mem_flags; // SHM_MEM_* used by the parent, a hint for the child
+    uint32_t slot_size; // SHM_MODE_SLOTS: bytes per slot, 0 for a record ring
+    uint32_t slot_count; // A power of two
+    uint32_t features;  // SHM_FEAT_* the parent allows on this channel
+    uint32_t drop_oldest; // The producer may discard records, see SHM_HEAD_BUSY
+    uint32_t commit_bytes; // Commit bitmap ahead of the records, 0 for one producer
+    uint8_t _pad0[SHM_CACHE_LINE - 44];
+
+    // Written by the producer; the waiting flags (SHM_WAIT_*) double as futex words
+    _Atomic uint64_t tail;
+    _Atomic uint32_t producer_waiting;
+    uint8_t _pad1[SHM_CACHE_LINE - 12];
+
+    // Written by the consumer
+    _Atomic uint64_t head;
+    _Atomic uint32_t consumer_waiting;
+    uint8_t _pad2[SHM_CACHE_LINE - 12];
+} shm_ring_hdr_t;
+
+// Record frame, padded to SHM_REC_ALIGN. SHM_REC_PAD fills the end of the data area.
+typedef struct {
+    uint32_t len;
+    uint32_t flags;
+} shm_rec_t;
+
+// How a waiting side wants to be woken: an eventfd write or a FUTEX_WAKE
+#define SHM_WAIT_EFD 1u
+#define SHM_WAIT_FUTEX 2u
+
+#define SHM_REC_ALIGN 8
+#define SHM_REC_PAD 0x1u
+#define SHM_REC_MORE 0x2u // Fragment of a streamed message, more follow
+#define SHM_REC_LZ4 0x4u  // Payload is an LZ4 frame, see SHM_LZ4_HDR_SIZE
+#define SHM_REC_TRACE 0x8u // The last bytes of len are a shm_trace_t
+
+// With SHM_STATS_TRACE, CLOCK_MONOTONIC stamps appended to every record
+typedef struct {
+    uint64_t reserve_ns; // Space reserved, copy starts
+    uint64_t commit_ns;  // Copy done, about to publish
+} shm_trace_t;
+
+// drop_oldest rings: the consumer holds this bit in head while it reads,
+// and the producer only drops records while it is clear
+#define SHM_HEAD_BUSY (1ull << 63)
+
+// Slots mode: slot_count sequence words, then the slots. A slot's word is pos
+// while free, pos + 1 once filled, and pos + slot_count once consumed.
+
+// Multi-producer C2P: commit_bytes of bitmap ahead of the records, one bit per
+// SHM_REC_ALIGN bytes. Producers claim space with a CAS on tail and set their
+// record's bit when done; the consumer clears it before releasing the space.
+
+typedef struct shm_uring_s shm_uring_t;
+typedef struct shm_buf_pool_s shm_buf_pool_t;
+
+// Buffer pool size classes: powers of two from 64B up to 64MB
+#define SHM_POOL_MIN_SHIFT 6
+#define SHM_POOL_CLASSES 21
+
+// --- Statistics ---
+
+// Log-linear latency histogram in ns: each power of two is split into
+// SHM_HIST_SUB buckets (about 6% precision), up to 2^SHM_HIST_MAX_SHIFT.
+#define SHM_HIST_SUB_BITS 4
+#define SHM_HIST_SUB (1 << SHM_HIST_SUB_BITS)
+#define SHM_HIST_MAX_SHIFT 40
+#define SHM_HIST_BUCKETS ((SHM_HIST_MAX_SHIFT - SHM_HIST_SUB_BITS + 2) * SHM_HIST_SUB)
 
-// Parent Structure
 typedef struct {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint64_t buckets[SHM_HIST_BUCKETS];
+} shm_hist_t;
+
+// Stages timed with SHM_STATS_TRACE into stage_ns. Built with <sys/sdt.h>,
+// efd.c also fires a USDT probe (provider efdstream) at each stage.
+typedef enum {
+    SHM_STAGE_COPY,
+    SHM_STAGE_SIGNAL,
+    SHM_STAGE_WAKE,
+    SHM_STAGE_HANDLER,
+    SHM_STAGE_ACK,
+    SHM_STAGES
+} shm_stage_t;
+
+// Counters for one direction; a streamed message counts once per fragment
+typedef struct {
+    uint64_t msgs;
+    uint64_t bytes;
+    uint64_t too_large;    // Sends rejected because the message cannot fit
+    uint64_t spin_wakeups; // Waits that ended while spinning on the peer's index
+    uint64_t blocks;       // Waits that went to sleep (every ack in standard mode)
+    uint64_t blocked_ns;   // Time spent in those sleeps
+    uint64_t timeouts;     // Waits that ran out of the overflow timeout
+    uint64_t dropped;      // Messages discarded by SHM_OVERFLOW_DROP_OLDEST
+    // SHM_STATS_LATENCY: reserve to commit for sends, read_begin for receives
+    shm_hist_t latency_ns;
+    shm_hist_t stage_ns[SHM_STAGES];
+} shm_dir_stats_t;
+
+typedef struct {
+    shm_dir_stats_t send;
+    shm_dir_stats_t recv;
+} shm_stats_t;
+
+// Stats Options (shm_parent_set_stats / shm_child_set_stats)
+#define SHM_STATS_LATENCY 0x1u // Two clock reads per message for latency_ns
+#define SHM_STATS_TRACE 0x2u   // A few more per message for stage_ns, see shm_stage_t
+
+// Local view of one ring direction; standard mode uses only a few fields
+typedef struct {
+    shm_ring_hdr_t *hdr;
+    uint8_t *data;
+    uint64_t capacity;
+    int efd_send; // Producer wakes a waiting consumer
+    int efd_ack;  // Consumer wakes a waiting producer
+    uint32_t spin; // Polls of the peer's index before blocking
+    int futex;     // Sleep on the waiting flag instead of the eventfd
+    shm_uring_t *uring; // Eventfd I/O for this direction, NULL for syscalls
+
+    uint64_t tail;      // Producer: end of written records, published or not
+    uint64_t next_head; // Consumer: head after the records being read
+
+    // Producer: record handed out by reserve (slots mode: len is a slot count)
+    uint64_t reserved_pos;
+    size_t reserved_len;
+    int reserved;
+
+    // Slots mode only; slot_size is 0 for a record ring
+    uint32_t slot_size;
+    uint64_t slot_mask;
+    _Atomic uint64_t *seq;
+    uint8_t *slots;
+
+    _Atomic uint64_t *commit; // Multi-producer record ring: the commit bitmap
+
+    unsigned stats_flags; // SHM_STATS_*
+    uint64_t send_start;  // Clock at reserve, for the latency histogram
+    uint64_t lent_ns;     // Consumer: clock when the current read was lent
+    int peer_trace;       // Producer: the consumer strips SHM_REC_TRACE stamps
+    shm_dir_stats_t stats;
+
+    size_t compress_min; // Producer: smallest message worth compressing, 0 for off
+    shm_overflow_t overflow; // Producer: what a send does when there is no room
+    uint64_t timeout_ns;     // Producer: bound on SHM_OVERFLOW_BLOCK waits, 0 for none
+    uint8_t *lz4_buf;    // Consumer: the decompressed message being lent
+    size_t lz4_cap;
+    int corrupt;         // Consumer: a record could not be skipped, reads keep failing
+} shm_ring_t;
+
+// Parent Structure
+typedef struct shm_parent_s {
     char *child_path;
-    size_t shm_size;
+    size_t shm_size; // Size of both memfds and of the P2C mapping
+    size_t c2p_size; // Size of the C2P mapping, behind shm_size after a resize
 
     // Resources
     int efd_p2c_send;
@@ -21,11 +274,49 @@ typedef struct {
     uint8_t *shm_c2p_ptr;
 
     int child_pid;
+
+    shm_mode_t mode; // SHM_MODE_AUTO until start has negotiated
+    unsigned features;      // SHM_FEAT_* allowed on the channel
+    unsigned peer_features; // What the child announced, 0 if it did not
+    shm_spawn_t spawn;
+    uint32_t slot_size; // SHM_MODE_SLOTS
+    int multi_producer; // SHM_MODE_RING: C2P takes records from several threads
+    unsigned mem_flags;
+    unsigned uring_flags;
+    int nonblock;    // EFD_NONBLOCK on the eventfds this side reads
+    int p2c_pending; // Standard mode: a try_send has not been acked yet
+    shm_buf_pool_t *buf_pool; // Backs read_data buffers when set
+
+    // CPU masks applied by start, all zero to leave a side alone
+    uint64_t parent_cpus[SHM_MAX_CPUS / 64];
+    uint64_t child_cpus[SHM_MAX_CPUS / 64];
+    int numa_node; // Node the memfd pages are bound to, -1 for the default policy
+
+    // A second parent with its own lanes and an idle child, swapped in by restart
+    int keep_standby;
+    struct shm_parent_s *standby;
+
+    // Broadcast this child reads, passed after the lanes; not owned
+    struct shm_bcast_s *bcast;
+    int bcast_reader;
+
+    // FD passing (lane 0 only), -1 without it
+    int fd_passing;
+    int sock_fd;
+    int sock_child_fd;
+
+    shm_ring_t ring_p2c;
+    shm_ring_t ring_c2p;
+
+    // Lane 0 is this structure. lanes[i - 1] is lane i, owned by the parent.
+    int lane_count;
+    struct shm_parent_s **lanes;
 } shm_parent_t;
 
 // Child Structure
-typedef struct {
-    size_t shm_size;
+typedef struct shm_child_s {
+    size_t shm_size; // Size of the P2C mapping
+    size_t c2p_size; // Size of the C2P mapping; both grow after a resize
 
     // Fixed FDs
     int fd_p2c_send;
@@ -38,22 +329,317 @@ typedef struct {
 
     uint8_t *shm_p2c_ptr;
     uint8_t *shm_c2p_ptr;
+
+    // Detected from the P2C header at attach time
+    shm_mode_t mode;
+    unsigned peer_features; // SHM_FEAT_* the parent allows, 0 if unknown
+    shm_ring_t ring_p2c;
+    shm_ring_t ring_c2p;
+    int c2p_pending; // Standard mode: a try_send has not been acked yet
+    int fd_sock;     // FD passing socket (lane 0 only), -1 if there is none
+    int fd_bcast;    // First broadcast FD (lane 0 only), -1 if there is none
+
+    // Lanes announced by the parent; lanes[i - 1] is lane i
+    int lane_count;
+    struct shm_child_s **lanes;
+
+    // Reassembly buffer for streamed messages, reused between messages
+    uint8_t *stream_buf;
+    size_t stream_cap;
 } shm_child_t;
 
+// Worker Pool: one thread driving several children, each a full shm_parent_t
+typedef struct {
+    shm_parent_t **workers;
+    int count;
+    int *inflight; // Dispatched requests without a received reply
+    int next;      // Where the next dispatch starts looking, for fairness
+    int next_recv;
+    struct pollfd *pfds;
+} shm_pool_t;
+
+// RPC: every frame starts with a 64-bit request ID that the reply echoes
+#define SHM_RPC_HDR_SIZE 8
+
+typedef void (*shm_rpc_cb)(void *ctx, uint64_t id, const uint8_t *data, size_t len);
+
+typedef struct {
+    uint64_t id;
+    shm_rpc_cb cb;
+    void *ctx;
+    int busy;
+} shm_rpc_slot_t;
+
+typedef struct {
+    shm_parent_t *parent;
+    uint64_t next_id;
+    size_t inflight;
+    uint64_t mask;
+    shm_rpc_slot_t *slots;
+    int polling; // Inside a callback, where the channel is still lent
+} shm_rpc_t;
+
+// Broadcast: one record ring written once and mapped read-only by every reader
+// child, each with its own cursor page and eventfds. A reader gets send, ack,
+// data memfd and cursor memfd from the FD after -fd-bcast in its argv.
+#define SHM_BCAST_FDS 4
+
+// FD passing: a SOCK_SEQPACKET socketpair, each message one FD and an 8-byte
+// tag. The child's end is at the FD after -fd-sock in its argv.
+#define SHM_SOCK_FDS 1
+
+typedef struct {
+    shm_ring_t ring; // hdr is the cursor page, data the shared ring
+    int memfd_cursor;
+} shm_bcast_peer_t;
+
+typedef struct shm_bcast_s {
+    size_t shm_size;
+    int memfd;
+    uint8_t *ptr;
+    uint64_t capacity;
+    uint64_t tail;
+    int reader_count;
+    shm_bcast_peer_t *readers;
+} shm_bcast_t;
+
+// Child side of one broadcast
+typedef struct {
+    shm_ring_t ring;
+    uint8_t *data_ptr; // Read-only
+    size_t data_size;
+    uint8_t *cursor_ptr;
+} shm_bcast_reader_t;
+
 // Parent Functions
 shm_parent_t* shm_parent_new(const char *child_path, size_t shm_size);
+// Must be called before shm_parent_start. The child detects the mode itself.
+int shm_parent_set_mode(shm_parent_t *parent, shm_mode_t mode);
+// Slot size for SHM_MODE_SLOTS, rounded up to a cache line (default 64).
+int shm_parent_set_slot_size(shm_parent_t *parent, size_t slot_size);
+// Independent lanes (ring mode only); lane i uses FDs 3 + 6i .. 8 + 6i in the child.
+int shm_parent_set_lanes(shm_parent_t *parent, int lanes);
+// SHM_MEM_* flags for all memfds; SHM_MEM_HUGETLB rounds shm_size up to 2MB.
+int shm_parent_set_mem_flags(shm_parent_t *parent, unsigned mem_flags);
+// EFD_NONBLOCK on the eventfds the parent reads; the blocking calls still work.
+int shm_parent_set_nonblock(shm_parent_t *parent, int nonblock);
+// SHM_URING_* flags, 0 for plain syscalls. Fails if io_uring is not available.
+int shm_parent_set_uring(shm_parent_t *parent, unsigned uring_flags);
+// CPUs for the child (before exec) and the thread calling start; NULL leaves a side alone.
+int shm_parent_set_affinity(shm_parent_t *parent, const int *parent_cpus, int n_parent,
+                            const int *child_cpus, int n_child);
+// NUMA node every memfd page is bound to with mbind, -1 (the default) for none.
+int shm_parent_set_numa_node(shm_parent_t *parent, int node);
+// SHM_SPAWN_POSIX is the default.
+int shm_parent_set_spawn(shm_parent_t *parent, shm_spawn_t spawn);
+// Also starts an idle standby child that restart swaps in.
+int shm_parent_set_standby(shm_parent_t *parent, int standby);
+// Gives the channel an FD passing socket (see SHM_SOCK_FDS) at start.
+int shm_parent_set_fd_passing(shm_parent_t *parent, int enable);
+// Ring or auto mode: C2P of every lane takes records from several child threads.
+int shm_parent_set_multi_producer(shm_parent_t *parent, int enable);
 int shm_parent_start(shm_parent_t *parent);
+// Replaces the child (SIGTERM, then reaps it), with the standby if there is one.
+// Messages in flight are lost; no other thread may use the parent meanwhile.
+int shm_parent_restart(shm_parent_t *parent);
+// Standard mode: grows both memfds to shm_size while running; call from the sending
+// thread. ENOTSUP in ring or slots mode or for a child without SHM_FEAT_RESIZE.
+int shm_parent_resize(shm_parent_t *parent, size_t shm_size);
+// Frees the P2C pages while nothing is in flight; EAGAIN otherwise, ENOTSUP in slots mode.
+int shm_parent_trim(shm_parent_t *parent);
+// Lane i, lane 0 being the parent itself. Freed by shm_parent_close.
+shm_parent_t* shm_parent_lane(shm_parent_t *parent, int lane);
+// Largest message a single send accepts in the current mode.
+size_t shm_parent_max_message(const shm_parent_t *parent);
+// SHM_FEAT_* the child announced, 0 without a handshake.
+unsigned shm_parent_peer_features(const shm_parent_t *parent);
 int shm_parent_send_data(shm_parent_t *parent, const uint8_t *data, size_t len);
-// Returns allocated buffer, caller must free. len is output.
+// Zero-copy send: reserve lends len bytes of P2C, commit publishes them
+// (and in standard mode waits for the ack, like send_data).
+uint8_t* shm_parent_send_reserve(shm_parent_t *parent, size_t len);
+int shm_parent_send_commit(shm_parent_t *parent, size_t len);
+// Ring mode publishes all n with one tail update and at most one wakeup.
+int shm_parent_send_batch(shm_parent_t *parent, const struct iovec *msgs, int n);
+// SHM_MODE_SLOTS: reserve lends up to max contiguous free slots, commit publishes n.
+// The generic calls also work, but a message always arrives as a whole slot.
+uint8_t* shm_parent_slot_reserve(shm_parent_t *parent, int max, int *n);
+int shm_parent_slot_commit(shm_parent_t *parent, int n);
+// Lends up to max contiguous filled slots; shm_parent_read_end frees them.
+const uint8_t* shm_parent_slot_peek(shm_parent_t *parent, int max, int *n);
+size_t shm_parent_slot_size(const shm_parent_t *parent);
+// Any size: ring mode sends chunks of a quarter ring, standard mode is send_data.
+int shm_parent_send_stream(shm_parent_t *parent, const uint8_t *data, size_t len);
+// Returns allocated buffer, caller must free. len is output. Streams are reassembled.
 uint8_t* shm_parent_read_data(shm_parent_t *parent, size_t *len);
+// read_data buffers from size-classed free lists of up to per_class each, 0 for malloc.
+// Release them with shm_buffer_release, never free.
+int shm_parent_set_buffer_pool(shm_parent_t *parent, int per_class);
+void shm_buffer_release(void *buf);
+// Zero-copy receive: lends the next message until read_end, which acks it.
+// An undecodable message is acked and dropped: -1 with errno EBADMSG, as for a
+// ring record too corrupt to skip, which stays and fails every later read.
+int shm_parent_read_begin(shm_parent_t *parent, const uint8_t **data, size_t *len);
+// Lends up to max available messages (at least one); read_end releases them all.
+int shm_parent_read_batch_begin(shm_parent_t *parent, struct iovec *msgs, int max);
+int shm_parent_read_end(shm_parent_t *parent);
+// Ring mode only: poll the peer's index this many times before blocking (default 0).
+void shm_parent_set_spin(shm_parent_t *parent, uint32_t spin);
+// LZ4-compress sends of at least min_size bytes when smaller, 0 for off. Fails in slots mode.
+int shm_parent_set_compress(shm_parent_t *parent, size_t min_size);
+// Flow control for the blocking sends. timeout_ms bounds SHM_OVERFLOW_BLOCK waits
+// (-1 forever, 0 is SHM_OVERFLOW_FAIL); a send that runs out fails with EAGAIN.
+// SHM_OVERFLOW_DROP_OLDEST needs ring mode and must be set before start.
+int shm_parent_set_overflow(shm_parent_t *parent, shm_overflow_t overflow, int timeout_ms);
+// Bytes a send can take right now without waiting.
+size_t shm_parent_send_credit(shm_parent_t *parent);
+// Ring mode only: sleep with FUTEX_WAIT on the waiting flag instead of the eventfd.
+void shm_parent_set_futex(shm_parent_t *parent, int futex);
+// Event loop integration. POLLIN when try_recv, or a try_send that failed, may
+// succeed; wakeups can be spurious, so retry until EAGAIN.
+int shm_parent_recv_fd(const shm_parent_t *parent);
+int shm_parent_send_fd(const shm_parent_t *parent);
+// pass_fd sends a copy of fd with a tag, take_fd returns the next one the child
+// passed. ENOENT without FD passing or on a lane.
+int shm_parent_pass_fd(shm_parent_t *parent, int fd, uint64_t tag);
+int shm_parent_take_fd(shm_parent_t *parent, uint64_t *tag);
+int shm_parent_fd_socket(const shm_parent_t *parent);
+// send_memfd seals and passes a memfd from shm_memfd_create (EBUSY while it is
+// mapped writable); recv_memfd maps one read-only until shm_memfd_release.
+int shm_parent_send_memfd(shm_parent_t *parent, int memfd);
+int shm_parent_recv_memfd(shm_parent_t *parent, const uint8_t **data, size_t *len);
+// Non-blocking send_data: EAGAIN when there is no room.
+int shm_parent_try_send(shm_parent_t *parent, const uint8_t *data, size_t len);
+// Non-blocking read_begin: EAGAIN when nothing is queued.
+int shm_parent_try_recv(shm_parent_t *parent, const uint8_t **data, size_t *len);
+// SHM_STATS_* flags for this lane, inherited by lanes created by start.
+void shm_parent_set_stats(shm_parent_t *parent, unsigned flags);
+// Snapshot of this lane's counters, approximate while traffic flows.
+void shm_parent_get_stats(const shm_parent_t *parent, shm_stats_t *out);
+void shm_parent_reset_stats(shm_parent_t *parent);
 void shm_parent_close(shm_parent_t *parent);
 
+// Pool Functions
+shm_pool_t* shm_pool_new(const char *child_path, size_t shm_size, int workers);
+// Worker i, for shm_parent_set_* calls before shm_pool_start.
+shm_parent_t* shm_pool_worker(shm_pool_t *pool, int worker);
+int shm_pool_start(shm_pool_t *pool);
+// Sends to an idle worker, or the least loaded one with room, waiting up to
+// timeout_ms (-1 forever). Returns the worker, or -1 with EAGAIN on timeout.
+int shm_pool_dispatch(shm_pool_t *pool, const uint8_t *data, size_t len, int timeout_ms);
+// Lends the next reply from any worker; release it with shm_pool_recv_end.
+int shm_pool_recv(shm_pool_t *pool, const uint8_t **data, size_t *len, int timeout_ms);
+int shm_pool_recv_end(shm_pool_t *pool, int worker);
+int shm_pool_inflight(const shm_pool_t *pool, int worker);
+void shm_pool_close(shm_pool_t *pool);
+
+// RPC Functions (single thread per shm_rpc_t, on top of a started parent)
+// max_inflight is rounded up to a power of two.
+shm_rpc_t* shm_rpc_new(shm_parent_t *parent, size_t max_inflight);
+// cb runs from shm_rpc_poll once the reply arrives, with data valid during the
+// call. It must not call back into the same shm_rpc_t (EBUSY).
+int shm_rpc_call(shm_rpc_t *rpc, const uint8_t *data, size_t len,
+                 shm_rpc_cb cb, void *ctx, uint64_t *id_out);
+// Runs the callbacks of available replies (block waits for one); returns the count.
+int shm_rpc_poll(shm_rpc_t *rpc, int block);
+int shm_rpc_wait(shm_rpc_t *rpc, uint64_t id);
+int shm_rpc_wait_all(shm_rpc_t *rpc);
+// Does not close the parent.
+void shm_rpc_close(shm_rpc_t *rpc);
+
+// Broadcast Functions (single writer thread)
+shm_bcast_t* shm_bcast_new(size_t shm_size);
+// Makes the parent's child a reader, before start and without a standby.
+int shm_bcast_add_reader(shm_bcast_t *bcast, shm_parent_t *parent);
+// Copies the message into the ring once, waiting for readers to free space.
+int shm_bcast_send(shm_bcast_t *bcast, const uint8_t *data, size_t len);
+// Fails with EAGAIN instead of waiting.
+int shm_bcast_try_send(shm_bcast_t *bcast, const uint8_t *data, size_t len);
+size_t shm_bcast_max_message(const shm_bcast_t *bcast);
+int shm_bcast_reader_count(const shm_bcast_t *bcast);
+// Close after the parents of all readers.
+void shm_bcast_close(shm_bcast_t *bcast);
+
 // Child Functions
+// Detects ring mode from the header the parent wrote into the P2C memfd.
 shm_child_t* shm_child_new(size_t shm_size);
-// Callback type for listen
+// Maps with SHM_MEM_POPULATE / SHM_MEM_THP; hugetlb follows the parent's memfd.
+shm_child_t* shm_child_new_ex(size_t shm_size, unsigned mem_flags);
+// SHM_FEAT_* the parent allows, from its hello or ring header; 0 if unknown.
+unsigned shm_child_peer_features(const shm_child_t *child);
+// Same as shm_parent_lane, for the lanes the parent announced.
+shm_child_t* shm_child_lane(shm_child_t *child, int lane);
+// Callback type for listen; the buffer is only valid during the call
 typedef void (*child_listen_cb)(const uint8_t *data, size_t len);
 int shm_child_listen(shm_child_t *child, child_listen_cb handler);
+// Like listen, with up to max messages per call, acked together.
+typedef void (*child_listen_batch_cb)(const struct iovec *msgs, int n);
+int shm_child_listen_batch(shm_child_t *child, child_listen_batch_cb handler, int max);
+// RPC server loop; replies go through shm_child_rpc_reply, in any order.
+typedef void (*child_rpc_cb)(uint64_t id, const uint8_t *data, size_t len);
+int shm_child_rpc_listen(shm_child_t *child, child_rpc_cb handler);
+int shm_child_rpc_reply(shm_child_t *child, uint64_t id, const uint8_t *data, size_t len);
 int shm_child_send_data(shm_child_t *child, const uint8_t *data, size_t len);
+uint8_t* shm_child_send_reserve(shm_child_t *child, size_t len);
+int shm_child_send_commit(shm_child_t *child, size_t len);
+int shm_child_send_stream(shm_child_t *child, const uint8_t *data, size_t len);
+int shm_child_send_batch(shm_child_t *child, const struct iovec *msgs, int n);
+// 1 when several threads may send on this lane; send_reserve is then refused.
+int shm_child_multi_producer(const shm_child_t *child);
+// Same as the parent's slot functions; the slot size comes from the header.
+uint8_t* shm_child_slot_reserve(shm_child_t *child, int max, int *n);
+int shm_child_slot_commit(shm_child_t *child, int n);
+const uint8_t* shm_child_slot_peek(shm_child_t *child, int max, int *n);
+size_t shm_child_slot_size(const shm_child_t *child);
+void shm_child_set_spin(shm_child_t *child, uint32_t spin);
+int shm_child_set_compress(shm_child_t *child, size_t min_size);
+// Same as the parent functions, for C2P; no SHM_OVERFLOW_DROP_OLDEST.
+int shm_child_set_overflow(shm_child_t *child, shm_overflow_t overflow, int timeout_ms);
+size_t shm_child_send_credit(shm_child_t *child);
+void shm_child_set_futex(shm_child_t *child, int futex);
+// Same as shm_parent_trim, for the C2P memfd.
+int shm_child_trim(shm_child_t *child);
+// Same as the parent functions, for all lanes.
+int shm_child_set_nonblock(shm_child_t *child, int nonblock);
+// Same as shm_parent_set_uring, for all lanes. Call before using the child.
+int shm_child_set_uring(shm_child_t *child, unsigned uring_flags);
+int shm_child_recv_fd(const shm_child_t *child);
+int shm_child_send_fd(const shm_child_t *child);
+// Same as the parent's FD passing functions.
+int shm_child_pass_fd(shm_child_t *child, int fd, uint64_t tag);
+int shm_child_take_fd(shm_child_t *child, uint64_t *tag);
+int shm_child_fd_socket(const shm_child_t *child);
+int shm_child_send_memfd(shm_child_t *child, int memfd);
+int shm_child_recv_memfd(shm_child_t *child, const uint8_t **data, size_t *len);
+int shm_child_try_send(shm_child_t *child, const uint8_t *data, size_t len);
+int shm_child_try_recv(shm_child_t *child, const uint8_t **data, size_t *len);
+int shm_child_read_end(shm_child_t *child);
+// Same as the parent functions, per lane; send is C2P and recv is P2C.
+void shm_child_set_stats(shm_child_t *child, unsigned flags);
+void shm_child_get_stats(const shm_child_t *child, shm_stats_t *out);
+void shm_child_reset_stats(shm_child_t *child);
 void shm_child_close(shm_child_t *child);
 
+// Broadcast reader on the FDs after the child's lanes, or NULL with ENOENT.
+shm_bcast_reader_t* shm_child_bcast_open(shm_child_t *child);
+// Lends the next message in place (read-only) until shm_bcast_read_end.
+int shm_bcast_read_begin(shm_bcast_reader_t *reader, const uint8_t **data, size_t *len);
+// EAGAIN when nothing is queued.
+int shm_bcast_try_read_begin(shm_bcast_reader_t *reader, const uint8_t **data, size_t *len);
+int shm_bcast_read_end(shm_bcast_reader_t *reader);
+int shm_bcast_reader_fd(const shm_bcast_reader_t *reader);
+// Unmaps the broadcast; the FDs stay open like the lanes' FDs.
+void shm_bcast_reader_close(shm_bcast_reader_t *reader);
+
+// Process-wide non-temporal copy threshold, 0 for off; impl is avx512, avx2 or memcpy.
+void shm_set_nt_copy_threshold(size_t bytes);
+const char* shm_nt_copy_impl(void);
+
+// A sealable memfd of len bytes for send_memfd, or -1.
+int shm_memfd_create(size_t len);
+// Unmaps what recv_memfd mapped.
+void shm_memfd_release(const uint8_t *data, size_t len);
+
+// Smallest value that percentile percent of the samples do not exceed.
+uint64_t shm_hist_percentile(const shm_hist_t *hist, double percentile);
+
 #endif // EFD_H
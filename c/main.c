@@ -3,15 +3,56 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <pthread.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+// Both sides LZ4-compress sends of at least this many bytes, and repeat the
+// text of every demo message up to that size so it compresses. An
+// environment variable, since the parent does not pass its flags on.
+#define ENV_COMPRESS "EFDSTREAM_COMPRESS"
+#define MAX_DEMO_MSG 4096
+
+static size_t demo_compress(void) {
+    const char *env = getenv(ENV_COMPRESS);
+    return env ? strtoul(env, NULL, 10) : 0;
+}
 
-void run_parent(const char *child_path, size_t shm_size) {
+// The text alone, or followed by a space and repeated until min bytes
+static size_t demo_msg(char *buf, const char *text, size_t min) {
+    size_t n = strlen(text), len = 0;
+    if (min == 0) {
+        memcpy(buf, text, n);
+        return n;
+    }
+    while (len < min && len + n + 1 <= MAX_DEMO_MSG) {
+        memcpy(buf + len, text, n);
+        buf[len + n] = ' ';
+        len += n + 1;
+    }
+    return len;
+}
+
+void run_parent(const char *child_path, size_t shm_size, shm_mode_t channel_mode) {
     shm_parent_t *parent = shm_parent_new(child_path, shm_size);
     if (!parent) {
         fprintf(stderr, "Failed to create parent\n");
         exit(1);
     }
 
+    if (shm_parent_set_mode(parent, channel_mode) != 0) {
+        fprintf(stderr, "Unsupported channel mode for SHM size %zu\n", shm_size);
+        exit(1);
+    }
+
+    // Steady-state receives reuse the same buffer
+    shm_parent_set_buffer_pool(parent, 4);
+    size_t compress = demo_compress();
+    if (compress && shm_parent_set_compress(parent, compress) != 0) {
+        fprintf(stderr, "Failed to set compression\n");
+        exit(1);
+    }
+
     if (shm_parent_start(parent) != 0) {
         fprintf(stderr, "Failed to start parent\n");
         exit(1);
@@ -20,11 +61,12 @@ void run_parent(const char *child_path, size_t shm_size) {
     printf("[C Parent] Child started\n");
 
     for (int i = 0; i < 5; i++) {
-        char msg[64];
-        sprintf(msg, "Hello from C Parent %d", i);
-        printf("[C Parent] Sending: %s\n", msg);
+        char text[64], msg[MAX_DEMO_MSG];
+        sprintf(text, "Hello from C Parent %d", i);
+        size_t msg_len = demo_msg(msg, text, compress);
+        printf("[C Parent] Sending: %.*s\n", (int)msg_len, msg);
         
-        if (shm_parent_send_data(parent, (uint8_t*)msg, strlen(msg)) != 0) {
+        if (shm_parent_send_data(parent, (uint8_t*)msg, msg_len) != 0) {
             fprintf(stderr, "Communication error\n");
             break;
         }
@@ -33,10 +75,8 @@ void run_parent(const char *child_path, size_t shm_size) {
         size_t len;
         uint8_t *data = shm_parent_read_data(parent, &len);
         if (data) {
-            char *recv_msg = strndup((char*)data, len);
-            printf("[C Parent] Received: %s\n", recv_msg);
-            free(recv_msg);
-            free(data);
+            printf("[C Parent] Received: %.*s\n", (int)len, (char*)data);
+            shm_buffer_release(data);
         } else {
             fprintf(stderr, "Read error\n");
         }
@@ -47,28 +87,15 @@ void run_parent(const char *child_path, size_t shm_size) {
     shm_parent_close(parent);
 }
 
-// Thread for sending data from child
-void* child_sender_thread(void *arg) {
-    shm_child_t *child = (shm_child_t*)arg;
-    for (int i = 0; i < 5; i++) {
-        usleep(500000); // 500ms
-        char msg[64];
-        sprintf(msg, "Hello from C Child %d", i);
-        printf("[C Child] Sending: %s\n", msg);
-        
-        if (shm_child_send_data(child, (uint8_t*)msg, strlen(msg)) != 0) {
-            fprintf(stderr, "[C Child] Send error\n");
-            break;
-        }
-    }
-    return NULL;
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
 }
 
 void child_handler(const uint8_t *data, size_t len) {
-    char *msg = strndup((char*)data, len);
-    printf("[C Child] Received: %s\n", msg);
+    printf("[C Child] Received: %.*s\n", (int)len, (const char*)data);
     printf("[C Child] Sending ACK\n");
-    free(msg);
 }
 
 void run_child(size_t shm_size) {
@@ -79,22 +106,60 @@ void run_child(size_t shm_size) {
         fprintf(stderr, "Failed to create child\n");
         exit(1);
     }
+    size_t compress = demo_compress();
+    if (compress && shm_child_set_compress(child, compress) != 0) {
+        fprintf(stderr, "Failed to set compression\n");
+        exit(1);
+    }
 
-    // Create a separate sender instance for the thread because listen blocks
-    // In a real app, you might want to protect shared resources or use non-blocking I/O.
-    // Here, for simplicity, we create a second mapping or just share the struct if thread-safe.
-    // Our struct is mostly thread-safe for distinct operations (send vs listen) except if they share buffers.
-    // P2C and C2P are distinct, so it's okay to share 'child' pointer if we are careful.
-    // Listen uses P2C read / P2C ack write.
-    // Send uses C2P write / C2P ack read.
-    // They are independent.
+    // One poll loop drives both directions: incoming messages on the recv fd,
+    // and a message every 500ms, retried on the send fd when it would block.
+    int sent = 0, blocked = 0;
+    uint64_t next_send = now_ms() + 500;
+
+    while (1) {
+        struct pollfd pfds[2] = {
+            { .fd = shm_child_recv_fd(child), .events = POLLIN },
+            { .fd = shm_child_send_fd(child), .events = blocked ? POLLIN : 0 },
+        };
+
+        int timeout = -1;
+        if (sent < 5 && !blocked) {
+            uint64_t now = now_ms();
+            timeout = next_send > now ? (int)(next_send - now) : 0;
+        }
+        if (poll(pfds, 2, timeout) == -1) break;
 
-    pthread_t tid;
-    pthread_create(&tid, NULL, child_sender_thread, child);
+        const uint8_t *data;
+        size_t len;
+        while (shm_child_try_recv(child, &data, &len) == 0) {
+            child_handler(data, len);
+            if (shm_child_read_end(child) != 0) break;
+        }
+        if (errno != EAGAIN) {
+            fprintf(stderr, "[C Child] Receive error\n");
+            break;
+        }
 
-    shm_child_listen(child, child_handler);
+        if (sent < 5 && (blocked || now_ms() >= next_send)) {
+            char text[64], msg[MAX_DEMO_MSG];
+            sprintf(text, "Hello from C Child %d", sent);
+            size_t msg_len = demo_msg(msg, text, compress);
+            if (!blocked) printf("[C Child] Sending: %.*s\n", (int)msg_len, msg);
+
+            if (shm_child_try_send(child, (uint8_t*)msg, msg_len) == 0) {
+                sent++;
+                blocked = 0;
+                next_send = now_ms() + 500;
+            } else if (errno == EAGAIN) {
+                blocked = 1;
+            } else {
+                fprintf(stderr, "[C Child] Send error\n");
+                break;
+            }
+        }
+    }
 
-    pthread_join(tid, NULL);
     shm_child_close(child);
 }
 
@@ -102,6 +167,10 @@ int main(int argc, char *argv[]) {
     char *mode = "parent";
     char *child_path = "";
     size_t shm_size = 1024 * 1024;
+    shm_mode_t channel_mode = SHM_MODE_STANDARD;
+
+    // A child is killed when its parent is done, so keep no lines in a buffer
+    setvbuf(stdout, NULL, _IOLBF, 0);
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-mode") == 0 && i + 1 < argc) {
@@ -110,6 +179,11 @@ int main(int argc, char *argv[]) {
             child_path = argv[++i];
         } else if (strcmp(argv[i], "-shm-size") == 0 && i + 1 < argc) {
             shm_size = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-channel-mode") == 0 && i + 1 < argc) {
+            // Only meaningful for the parent; the child reads the mode from SHM.
+            const char *val = argv[++i];
+            channel_mode = strcmp(val, "ring") == 0 ? SHM_MODE_RING :
+                           strcmp(val, "auto") == 0 ? SHM_MODE_AUTO : SHM_MODE_STANDARD;
         }
     }
 
@@ -118,7 +192,7 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "Child path is required in parent mode\n");
             return 1;
         }
-        run_parent(child_path, shm_size);
+        run_parent(child_path, shm_size, channel_mode);
     } else {
         run_child(shm_size);
     }
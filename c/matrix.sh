@@ -0,0 +1,263 @@
+#!/usr/bin/env bash
+# Conformance and performance matrix over every C/Go/Rust parent-child
+# pairing. Each pairing first runs the demo exchange, whose messages must
+# all arrive intact both ways, in every channel mode and with compression
+# where both languages speak it, then a bench whose msgs/s and p50 are
+# compared to a recorded baseline. See "Conformance Matrix" in readme.md.
+set -u
+cd "$(dirname "$0")"
+
+GO_BIN=../go/efdstream_go
+RUST_BIN=../rust/target/release/efdstream
+BASELINE=matrix_baseline.tsv
+RESULTS=matrix_results.tsv
+THRESHOLD=20
+ITERS=10000
+REPEAT=3
+MAX_PAYLOAD=65536
+SHM_SIZE=1048576
+COMPRESS=256
+RECORD=0
+ONLY=
+
+usage() {
+    cat >&2 <<EOF
+Usage: $0 [options]
+  -record              Write the results to the baseline instead of comparing
+  -baseline FILE       Baseline to compare with (default $BASELINE)
+  -threshold PCT       Allowed msgs/s drop and p50 rise per case (default $THRESHOLD)
+  -only conformance|perf
+  -iters N             Messages per case (default $ITERS)
+  -repeat N            Runs per case, the best one counts (default $REPEAT)
+  -max-payload N       Largest payload (default $MAX_PAYLOAD)
+  -shm-size N          SHM size of every pairing (default $SHM_SIZE)
+  -compress N          Demo message size of the LZ4 conformance runs (default $COMPRESS)
+  -go PATH             Go binary (default $GO_BIN)
+  -rust PATH           Rust binary (default $RUST_BIN)
+EOF
+    exit 2
+}
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        -record) RECORD=1 ;;
+        -baseline) BASELINE=$2; shift ;;
+        -threshold) THRESHOLD=$2; shift ;;
+        -only) ONLY=$2; shift ;;
+        -iters) ITERS=$2; shift ;;
+        -repeat) REPEAT=$2; shift ;;
+        -max-payload) MAX_PAYLOAD=$2; shift ;;
+        -shm-size) SHM_SIZE=$2; shift ;;
+        -compress) COMPRESS=$2; shift ;;
+        -go) GO_BIN=$2; shift ;;
+        -rust) RUST_BIN=$2; shift ;;
+        *) usage ;;
+    esac
+    shift
+done
+
+LANGS="c go rust"
+
+bin() {
+    case "$1" in
+        c) echo ./efdstream_c ;;
+        go) echo "$GO_BIN" ;;
+        rust) echo "$RUST_BIN" ;;
+    esac
+}
+
+name() {
+    case "$1" in
+        c) echo C ;;
+        go) echo Go ;;
+        rust) echo Rust ;;
+    esac
+}
+
+for lang in $LANGS; do
+    if [ ! -x "$(bin "$lang")" ]; then
+        echo "[Matrix] $(bin "$lang") not found, build it first (see Build in readme.md)" >&2
+        exit 2
+    fi
+done
+if [ ! -x ./efdstream_bench ]; then
+    echo "[Matrix] ./efdstream_bench not found, run make efdstream_bench first" >&2
+    exit 2
+fi
+
+failed=0
+
+# A demo message as the demo binaries build it: with EFDSTREAM_COMPRESS
+# set, the text and a space, repeated up to that size so it compresses.
+demo_msg() {
+    local text=$1 min=$2 msg=
+    if [ "$min" -eq 0 ]; then
+        printf "%s" "$text"
+        return
+    fi
+    while [ ${#msg} -lt "$min" ]; do
+        msg+="$text "
+    done
+    printf "%s" "$msg"
+}
+
+# Why a pairing cannot run a case, or nothing if it can. Only C speaks ring
+# mode: Go and Rust parents have no -channel-mode, and their children only
+# read standard-mode messages. In auto mode a C parent hands every child the
+# handshake, which settles on standard mode for Go and Rust. Compression
+# works in every pairing.
+unsupported() {
+    local parent=$1 child=$2 mode=$3
+    if [ "$mode" = auto ] && [ "$parent" != c ]; then
+        echo "$(name "$parent") parents have no auto mode"
+    elif [ "$mode" = ring ] && [ "$parent" != c ]; then
+        echo "$(name "$parent") parents speak standard mode only"
+    elif [ "$mode" = ring ] && [ "$child" != c ]; then
+        echo "$(name "$child") children speak standard mode only"
+    fi
+}
+
+# The demo parent sends five messages and reads five from the child; both
+# sides print every message they receive, which must match exactly.
+conform() {
+    local parent=$1 child=$2 mode=$3 compress=$4 case=$3 why out i missing=0
+    [ "$compress" -gt 0 ] && case+="+lz4"
+    why=$(unsupported "$parent" "$child" "$mode")
+    if [ -n "$why" ]; then
+        printf "%-5s -> %-5s %-13s skip, %s\n" "$parent" "$child" "$case" "$why"
+        return
+    fi
+
+    local args=(-mode parent -child "$(bin "$child")" -shm-size "$SHM_SIZE")
+    [ "$mode" != standard ] && args+=(-channel-mode "$mode")
+    out=$(EFDSTREAM_COMPRESS=$compress timeout 60 "$(bin "$parent")" "${args[@]}" 2>&1)
+    for i in 0 1 2 3 4; do
+        grep -qxF "[$(name "$child") Child] Received: $(demo_msg "Hello from $(name "$parent") Parent $i" "$compress")" <<<"$out" || missing=$((missing + 1))
+        grep -qxF "[$(name "$parent") Parent] Received: $(demo_msg "Hello from $(name "$child") Child $i" "$compress")" <<<"$out" || missing=$((missing + 1))
+    done
+    if [ $missing -eq 0 ]; then
+        printf "%-5s -> %-5s %-13s ok\n" "$parent" "$child" "$case"
+    else
+        printf "%-5s -> %-5s %-13s FAILED, %d of 10 messages missing\n" "$parent" "$child" "$case" $missing
+        printf "%s\n" "$out" | sed 's/^/    /'
+        failed=1
+    fi
+}
+
+# Runs one bench command and appends its rows to RAW as
+# parent child mode api payload test msgs_per_s p50_us p99_us.
+perf() {
+    local parent=$1 child=$2 mode=$3 api=$4 out
+    shift 4
+    if ! out=$(timeout 600 "$@" 2>&1); then
+        echo "[Matrix] $parent -> $child $mode/$api failed:" >&2
+        printf "%s\n" "$out" | sed 's/^/    /' >&2
+        failed=1
+        return
+    fi
+    printf "%s\n" "$out" | awk -v p="$parent" -v c="$child" -v m="$mode" -v a="$api" \
+        'NF == 9 && $1 ~ /^[0-9]+$/ { print p "\t" c "\t" m "\t" a "\t" $2 "\t" $3 "\t" $5 "\t" $7 "\t" $8 }' >>"$RAW"
+}
+
+if [ "$ONLY" != perf ]; then
+    echo "# conformance"
+    for mode in standard ring auto; do
+        for compress in 0 "$COMPRESS"; do
+            for parent in $LANGS; do
+                for child in $LANGS; do
+                    conform "$parent" "$child" "$mode" "$compress"
+                done
+            done
+        done
+    done
+fi
+[ "$ONLY" = conformance ] && exit $failed
+
+RAW=$(mktemp)
+trap 'rm -f "$RAW"' EXIT
+BENCH_ARGS="-shm-sizes $SHM_SIZE -max-payload $MAX_PAYLOAD -iters $ITERS"
+
+# A C parent runs efdstream_bench. Its own child echoes and speaks ring
+# mode; foreign children only ack in standard mode, where batch and
+# zero-copy sends still take their own path through the library. Go and
+# Rust parents only have send_data in standard mode.
+perf_pass() {
+    local mode api parent child
+    for mode in standard ring; do
+        for api in data batch zc; do
+            perf c c $mode $api ./efdstream_bench -channel-mode $mode -api $api $BENCH_ARGS
+        done
+    done
+    for child in go rust; do
+        for api in data batch zc; do
+            perf c $child standard $api ./efdstream_bench -child "$(bin "$child")" -api $api $BENCH_ARGS
+        done
+    done
+    for parent in go rust; do
+        for child in $LANGS; do
+            perf $parent $child standard data "$(bin "$parent")" -mode parent -child "$(bin "$child")" \
+                -shm-size "$SHM_SIZE" -max-payload "$MAX_PAYLOAD" -iters "$ITERS"
+        done
+    done
+}
+
+for run in $(seq "$REPEAT"); do
+    perf_pass
+done
+
+# One host is rarely quiet for the whole matrix, so every case keeps its
+# best run: the highest msgs/s and the lowest percentiles
+printf "#parent\tchild\tmode\tapi\tpayload\ttest\tmsgs_per_s\tp50_us\tp99_us\n" >"$RESULTS"
+awk -F'\t' -v OFS='\t' '
+    {
+        key = $1 OFS $2 OFS $3 OFS $4 OFS $5 OFS $6
+        if (!(key in tput)) { order[n++] = key; tput[key] = $7; p50[key] = $8; p99[key] = $9; next }
+        if ($7 > tput[key]) tput[key] = $7
+        if ($8 < p50[key]) p50[key] = $8
+        if ($9 < p99[key]) p99[key] = $9
+    }
+    END { for (i = 0; i < n; i++) print order[i], tput[order[i]], p50[order[i]], p99[order[i]] }' "$RAW" >>"$RESULTS"
+
+if [ $RECORD -eq 1 ]; then
+    if [ $failed -ne 0 ]; then
+        echo "[Matrix] Not recording a baseline from a failed run" >&2
+        exit 1
+    fi
+    cp "$RESULTS" "$BASELINE"
+    echo "# recorded $(($(wc -l <"$RESULTS") - 1)) cases in $BASELINE"
+    exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+    echo "# no baseline in $BASELINE, record one with -record (make matrix-baseline)"
+    exit $failed
+fi
+
+echo "# performance against $BASELINE, threshold ${THRESHOLD}%"
+awk -F'\t' -v t="$THRESHOLD" '
+    FNR == NR { if ($1 !~ /^#/) { base_tput[$1 FS $2 FS $3 FS $4 FS $5 FS $6] = $7; base_p50[$1 FS $2 FS $3 FS $4 FS $5 FS $6] = $8 }; next }
+    $1 ~ /^#/ {
+        printf "%-5s %-5s %-8s %-5s %8s %-6s %12s %8s %9s %8s\n", "parent", "child", "mode", "api", "payload", "test", "msgs/s", "delta", "p50_us", "delta"
+        next
+    }
+    {
+        key = $1 FS $2 FS $3 FS $4 FS $5 FS $6
+        status = "new"
+        dt = dl = "-"
+        if (key in base_tput) {
+            status = "ok"
+            dt = sprintf("%+.1f%%", ($7 - base_tput[key]) / base_tput[key] * 100)
+            if (base_p50[key] > 0) dl = sprintf("%+.1f%%", ($8 - base_p50[key]) / base_p50[key] * 100)
+            # p50 rises below 1 us are within the clock and scheduler noise
+            if ($7 < base_tput[key] * (1 - t / 100) || ($8 > base_p50[key] * (1 + t / 100) && $8 - base_p50[key] >= 1)) {
+                status = "REGRESSED"
+                regressed++
+            }
+        }
+        printf "%-5s %-5s %-8s %-5s %8s %-6s %12.0f %8s %9.2f %8s %s\n", $1, $2, $3, $4, $5, $6, $7, dt, $8, dl, status
+    }
+    END {
+        if (regressed) { printf "# %d cases regressed by more than %s%%\n", regressed, t; exit 1 }
+    }' "$BASELINE" "$RESULTS" || failed=1
+
+exit $failed
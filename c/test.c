@@ -0,0 +1,867 @@
+#define _GNU_SOURCE
+#include "efd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+// Tests of the C library, run by make test. The binary is its own child:
+// each test starts it with shm_parent_start and names itself in ENV_TEST,
+// so the child runs the other half of the same test.
+#define ENV_TEST "EFDSTREAM_TEST"
+
+// Bound on every wait, so a test whose peer died fails instead of hanging
+#define TIMEOUT_MS 10000
+
+// One page of header and 4096 bytes of records
+#define RING_SHM (SHM_HDR_SIZE + 4096)
+#define MAX_MSG 65536
+
+#define CHECK(cond)                                                                        \
+    do {                                                                                   \
+        if (!(cond)) {                                                                     \
+            fprintf(stderr, "%s:%d: %s failed (%s)\n", __FILE__, __LINE__, #cond, strerror(errno)); \
+            return 1;                                                                      \
+        }                                                                                  \
+    } while (0)
+
+typedef struct {
+    const char *name;
+    int (*parent)(const char *self);
+    int (*child)(shm_child_t *c);
+    // Runs instead of child, without shm_child_new
+    int (*legacy)(size_t shm_size);
+} test_t;
+
+// Message i of a test: bytes that depend on both i and their offset, so a
+// message that is shifted, cut short or another one's shows up.
+static void fill(uint8_t *buf, size_t n, uint32_t i) {
+    for (size_t j = 0; j < n; j++) buf[j] = (uint8_t)(i * 131 + j * 7 + (j >> 8));
+}
+
+static int verify(const uint8_t *buf, size_t n, uint32_t i) {
+    for (size_t j = 0; j < n; j++) {
+        if (buf[j] != (uint8_t)(i * 131 + j * 7 + (j >> 8))) return 0;
+    }
+    return 1;
+}
+
+static int wait_readable(int fd) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int ret = poll(&pfd, 1, TIMEOUT_MS);
+    if (ret == 0) errno = ETIME;
+    return ret > 0 ? 0 : -1;
+}
+
+static shm_parent_t* new_parent(const char *self, size_t shm_size, shm_mode_t mode) {
+    shm_parent_t *p = shm_parent_new(self, shm_size);
+    if (!p) return NULL;
+    if (shm_parent_set_mode(p, mode) != 0 || shm_parent_set_overflow(p, SHM_OVERFLOW_BLOCK, TIMEOUT_MS) != 0) {
+        shm_parent_close(p);
+        return NULL;
+    }
+    return p;
+}
+
+// Copies the next message out and releases it
+static int parent_recv(shm_parent_t *p, uint8_t *buf, size_t cap, size_t *len) {
+    const uint8_t *data;
+    while (shm_parent_try_recv(p, &data, len) != 0) {
+        if (errno != EAGAIN || wait_readable(shm_parent_recv_fd(p)) != 0) return -1;
+    }
+    if (*len <= cap) memcpy(buf, data, *len);
+    if (shm_parent_read_end(p) != 0) return -1;
+    if (*len > cap) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return 0;
+}
+
+static int child_recv(shm_child_t *c, uint8_t *buf, size_t cap, size_t *len) {
+    const uint8_t *data;
+    while (shm_child_try_recv(c, &data, len) != 0) {
+        if (errno != EAGAIN || wait_readable(shm_child_recv_fd(c)) != 0) return -1;
+    }
+    if (*len <= cap) memcpy(buf, data, *len);
+    if (shm_child_read_end(c) != 0) return -1;
+    if (*len > cap) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return 0;
+}
+
+// Echoes every message until the parent closes the channel
+static int echo_child(shm_child_t *c) {
+    static uint8_t buf[MAX_MSG];
+    size_t n;
+    while (child_recv(c, buf, sizeof(buf), &n) == 0) {
+        if (shm_child_send_data(c, buf, n) != 0) return 1;
+    }
+    return 1;
+}
+
+// --- Record ring ---
+
+// Stop-and-wait echoes of random sizes up to the largest message: the
+// indices run far past the capacity, and records keep landing across the
+// end of the data area, where a pad record has to cover the rest.
+static int ring_wrap_parent(const char *self) {
+    static uint8_t buf[MAX_MSG], echo[MAX_MSG];
+    shm_parent_t *p = new_parent(self, RING_SHM, SHM_MODE_RING);
+    CHECK(p && shm_parent_start(p) == 0);
+    size_t max = shm_parent_max_message(p);
+    CHECK(max == 4096 / 2 - sizeof(shm_rec_t));
+
+    unsigned seed = 1;
+    for (uint32_t i = 0; i < 5000; i++) {
+        size_t n = i % 100 == 0 ? max : 1 + (size_t)rand_r(&seed) % max, len;
+        fill(buf, n, i);
+        CHECK(shm_parent_send_data(p, buf, n) == 0);
+        CHECK(parent_recv(p, echo, sizeof(echo), &len) == 0);
+        CHECK(len == n && verify(echo, n, i));
+    }
+    CHECK(p->ring_p2c.tail > 100 * p->ring_p2c.capacity);
+    CHECK(atomic_load(&p->ring_c2p.hdr->head) == atomic_load(&p->ring_c2p.hdr->tail));
+    shm_parent_close(p);
+    return 0;
+}
+
+// The child stops itself once attached, so the parent fills the ring while
+// nothing is consumed: records of FULL_LEN take exactly 128 bytes.
+#define FULL_LEN (128 - sizeof(shm_rec_t))
+
+static int ring_full_parent(const char *self) {
+    static uint8_t buf[MAX_MSG];
+    shm_parent_t *p = new_parent(self, RING_SHM, SHM_MODE_RING);
+    CHECK(p && shm_parent_start(p) == 0);
+    int status;
+    CHECK(waitpid(p->child_pid, &status, WUNTRACED) == p->child_pid && WIFSTOPPED(status));
+
+    // Empty: all of it is credit, and nothing comes back
+    const uint8_t *data;
+    size_t len;
+    CHECK(shm_parent_send_credit(p) == p->ring_p2c.capacity);
+    CHECK(shm_parent_try_recv(p, &data, &len) == -1 && errno == EAGAIN);
+
+    uint32_t sent = 0;
+    fill(buf, FULL_LEN, sent);
+    while (shm_parent_try_send(p, buf, FULL_LEN) == 0) fill(buf, FULL_LEN, ++sent);
+    CHECK(errno == EAGAIN);
+    CHECK(sent == p->ring_p2c.capacity / 128 && shm_parent_send_credit(p) == 0);
+    // Full: a blocking send gives up at its timeout
+    CHECK(shm_parent_set_overflow(p, SHM_OVERFLOW_BLOCK, 50) == 0);
+    CHECK(shm_parent_send_data(p, buf, 1) == -1 && errno == EAGAIN);
+    CHECK(shm_parent_set_overflow(p, SHM_OVERFLOW_BLOCK, TIMEOUT_MS) == 0);
+
+    CHECK(kill(p->child_pid, SIGCONT) == 0);
+    uint32_t count;
+    CHECK(parent_recv(p, (uint8_t*)&count, sizeof(count), &len) == 0 && len == sizeof(count));
+    CHECK(count == sent);
+    // The child has released everything before it answered
+    CHECK(shm_parent_send_credit(p) == p->ring_p2c.capacity);
+
+    // The largest message fits a ring that has just been emptied
+    size_t max = shm_parent_max_message(p);
+    fill(buf, max, sent);
+    CHECK(shm_parent_send_data(p, buf, max) == 0);
+    CHECK(shm_parent_send_data(p, buf, max + 1) == -1 && errno == EMSGSIZE);
+    CHECK(parent_recv(p, (uint8_t*)&count, sizeof(count), &len) == 0 && count == max);
+    shm_parent_close(p);
+    return 0;
+}
+
+static int ring_full_child(shm_child_t *c) {
+    static uint8_t buf[MAX_MSG];
+    raise(SIGSTOP);
+
+    const uint8_t *data;
+    size_t len;
+    uint32_t count = 0;
+    while (shm_child_try_recv(c, &data, &len) == 0) {
+        CHECK(len == FULL_LEN && verify(data, len, count));
+        CHECK(shm_child_read_end(c) == 0);
+        count++;
+    }
+    CHECK(errno == EAGAIN);
+    CHECK(shm_child_send_data(c, (uint8_t*)&count, sizeof(count)) == 0);
+
+    CHECK(child_recv(c, buf, sizeof(buf), &len) == 0 && verify(buf, len, count));
+    count = (uint32_t)len;
+    CHECK(shm_child_send_data(c, (uint8_t*)&count, sizeof(count)) == 0);
+    return echo_child(c);
+}
+
+// The child holds message 0 in place while the parent keeps sending:
+// nothing may be dropped or overwritten until it is released, and then
+// only the oldest unread messages go.
+#define DROP_MSGS 200
+#define DROP_LEN 100
+
+static int drop_oldest_parent(const char *self) {
+    uint8_t buf[MAX_MSG];
+    shm_parent_t *p = new_parent(self, RING_SHM, SHM_MODE_RING);
+    CHECK(p && shm_parent_set_overflow(p, SHM_OVERFLOW_DROP_OLDEST, 0) == 0 && shm_parent_start(p) == 0);
+
+    size_t len;
+    for (uint32_t i = 0; i <= DROP_MSGS; i++) {
+        memcpy(buf, &i, sizeof(i));
+        fill(buf + sizeof(i), DROP_LEN - sizeof(i), i);
+        CHECK(shm_parent_send_data(p, buf, DROP_LEN) == 0);
+        if (i == 0) CHECK(parent_recv(p, buf, sizeof(buf), &len) == 0 && len == 1);
+    }
+
+    uint32_t got;
+    CHECK(parent_recv(p, (uint8_t*)&got, sizeof(got), &len) == 0 && len == sizeof(got));
+    shm_stats_t st;
+    shm_parent_get_stats(p, &st);
+    CHECK(st.send.dropped > 0 && got + st.send.dropped == DROP_MSGS);
+    shm_parent_close(p);
+    return 0;
+}
+
+// The sequence number of an intact message, or -1
+static int64_t drop_oldest_seq(const uint8_t *data, size_t len) {
+    uint32_t seq;
+    if (len != DROP_LEN) return -1;
+    memcpy(&seq, data, sizeof(seq));
+    return verify(data + sizeof(seq), len - sizeof(seq), seq) ? (int64_t)seq : -1;
+}
+
+static int drop_oldest_child(shm_child_t *c) {
+    uint8_t buf[MAX_MSG];
+    const uint8_t *data;
+    size_t len;
+    while (shm_child_try_recv(c, &data, &len) != 0) {
+        CHECK(errno == EAGAIN && wait_readable(shm_child_recv_fd(c)) == 0);
+    }
+    CHECK(shm_child_send_data(c, (const uint8_t*)"H", 1) == 0);
+
+    // The parent fills the ring behind the held message, then has to wait
+    usleep(200000);
+    CHECK(drop_oldest_seq(data, len) == 0);
+    CHECK(shm_child_read_end(c) == 0);
+    // and drops the oldest of the rest while nobody reads
+    usleep(100000);
+
+    uint32_t got = 0;
+    int64_t last = 0;
+    while (last < DROP_MSGS) {
+        CHECK(child_recv(c, buf, sizeof(buf), &len) == 0);
+        int64_t seq = drop_oldest_seq(buf, len);
+        CHECK(seq > last);
+        last = seq;
+        got++;
+    }
+    CHECK(shm_child_send_data(c, (uint8_t*)&got, sizeof(got)) == 0);
+    return echo_child(c);
+}
+
+// Records spoilt before the stopped child reads them: one too short for
+// the trace stamp its flags announce is dropped, one whose length runs past
+// the tail cannot be skipped. Both fail with EBADMSG and give the claim on
+// head back, so a drop-oldest producer is never stuck behind them.
+static int corrupt_record_parent(const char *self) {
+    uint8_t buf[64];
+    shm_parent_t *p = new_parent(self, RING_SHM, SHM_MODE_RING);
+    CHECK(p && shm_parent_set_overflow(p, SHM_OVERFLOW_DROP_OLDEST, 0) == 0 && shm_parent_start(p) == 0);
+    int status;
+    CHECK(waitpid(p->child_pid, &status, WUNTRACED) == p->child_pid && WIFSTOPPED(status));
+
+    for (uint32_t i = 0; i < 3; i++) {
+        shm_rec_t *rec = (shm_rec_t*)(p->ring_p2c.data + p->ring_p2c.tail % p->ring_p2c.capacity);
+        fill(buf, sizeof(buf), i);
+        CHECK(shm_parent_send_data(p, buf, 8) == 0);
+        if (i == 0) rec->flags |= SHM_REC_TRACE;
+        if (i == 2) rec->len = (uint32_t)p->ring_p2c.capacity;
+    }
+    CHECK(kill(p->child_pid, SIGCONT) == 0);
+
+    size_t len;
+    CHECK(parent_recv(p, buf, sizeof(buf), &len) == 0 && len == 2 && memcmp(buf, "ok", 2) == 0);
+    CHECK(!(atomic_load(&p->ring_p2c.hdr->head) & SHM_HEAD_BUSY));
+    shm_parent_close(p);
+    return 0;
+}
+
+static int corrupt_record_child(shm_child_t *c) {
+    raise(SIGSTOP);
+    const uint8_t *data;
+    size_t len;
+    CHECK(shm_child_try_recv(c, &data, &len) == -1 && errno == EBADMSG);
+    CHECK(shm_child_try_recv(c, &data, &len) == 0 && len == 8 && verify(data, len, 1));
+    CHECK(shm_child_read_end(c) == 0);
+    for (int k = 0; k < 2; k++) {
+        errno = EAGAIN;
+        CHECK(shm_child_try_recv(c, &data, &len) == -1 && errno == EBADMSG);
+        CHECK(!(atomic_load(&c->ring_p2c.hdr->head) & SHM_HEAD_BUSY));
+    }
+    CHECK(shm_child_send_data(c, (const uint8_t*)"ok", 2) == 0);
+    while (1) pause();
+}
+
+// --- Slots ---
+
+#define SLOT_MSGS 100000
+
+// A slot's sequence word is reused on every lap: pos + 1 while slot pos is
+// filled, pos + slot_count once it is free for the next lap
+static void slot_put(uint8_t *slot, size_t size, uint32_t i) {
+    memcpy(slot, &i, sizeof(i));
+    fill(slot + sizeof(i), size - sizeof(i), i);
+}
+
+static int slots_seq_parent(const char *self) {
+    uint8_t buf[MAX_MSG];
+    shm_parent_t *p = new_parent(self, RING_SHM, SHM_MODE_SLOTS);
+    CHECK(p && shm_parent_start(p) == 0);
+    int status;
+    CHECK(waitpid(p->child_pid, &status, WUNTRACED) == p->child_pid && WIFSTOPPED(status));
+
+    const shm_ring_t *r = &p->ring_p2c;
+    uint64_t count = r->slot_mask + 1;
+    size_t size = shm_parent_slot_size(p);
+    CHECK(count == 32 && size == SHM_CACHE_LINE);
+
+    // First lap, while the child is stopped: each slot's word says filled
+    uint32_t sent = 0;
+    while (sent < count) {
+        int n;
+        uint8_t *slot = shm_parent_slot_reserve(p, (int)(count - sent), &n);
+        CHECK(slot && n >= 1 && sent + (uint32_t)n <= count);
+        for (int i = 0; i < n; i++) slot_put(slot + (size_t)i * size, size, sent + (uint32_t)i);
+        CHECK(shm_parent_slot_commit(p, n) == 0);
+        sent += (uint32_t)n;
+    }
+    CHECK(shm_parent_send_credit(p) == 0);
+    for (uint64_t k = 0; k < count; k++) CHECK(atomic_load(&r->seq[k]) == k + 1);
+    CHECK(kill(p->child_pid, SIGCONT) == 0);
+
+    // Then many laps, in runs that start and end anywhere in the array
+    unsigned seed = 1;
+    while (sent < SLOT_MSGS) {
+        int max = 1 + rand_r(&seed) % 7, n;
+        if ((uint32_t)max > SLOT_MSGS - sent) max = (int)(SLOT_MSGS - sent);
+        uint8_t *slot = shm_parent_slot_reserve(p, max, &n);
+        CHECK(slot && n >= 1 && n <= max);
+        for (int i = 0; i < n; i++) slot_put(slot + (size_t)i * size, size, sent + (uint32_t)i);
+        CHECK(shm_parent_slot_commit(p, n) == 0);
+        sent += (uint32_t)n;
+    }
+
+    size_t len;
+    uint32_t got;
+    CHECK(parent_recv(p, buf, sizeof(buf), &len) == 0 && len == size);
+    memcpy(&got, buf, sizeof(got));
+    CHECK(got == SLOT_MSGS);
+    // Every word was last freed for the lap after the final one
+    for (uint64_t k = 0; k < count; k++) {
+        uint64_t seq = atomic_load(&r->seq[k]);
+        CHECK(seq % count == k && seq >= SLOT_MSGS && seq < SLOT_MSGS + count);
+    }
+    shm_parent_close(p);
+    return 0;
+}
+
+static int slots_seq_child(shm_child_t *c) {
+    raise(SIGSTOP);
+    size_t size = shm_child_slot_size(c);
+    uint32_t next = 0;
+    while (next < SLOT_MSGS) {
+        int n;
+        const uint8_t *slot = shm_child_slot_peek(c, 5, &n);
+        CHECK(slot && n >= 1 && n <= 5);
+        for (int i = 0; i < n; i++, next++) {
+            const uint8_t *s = slot + (size_t)i * size;
+            uint32_t seq;
+            memcpy(&seq, s, sizeof(seq));
+            CHECK(seq == next && verify(s + sizeof(seq), size - sizeof(seq), seq));
+        }
+        CHECK(shm_child_read_end(c) == 0);
+    }
+    CHECK(shm_child_send_data(c, (uint8_t*)&next, sizeof(next)) == 0);
+    return echo_child(c);
+}
+
+// --- Multi-producer C2P ---
+
+#define MP_THREADS 4
+#define MP_MSGS 20000
+#define MP_BATCH 4
+
+// Message seq of producer t: the pair, then bytes that depend on both
+typedef struct {
+    uint32_t thread;
+    uint32_t seq;
+} mp_hdr_t;
+
+static size_t mp_put(uint8_t *buf, uint32_t t, uint32_t seq, unsigned *seed) {
+    size_t n = sizeof(mp_hdr_t) + (size_t)rand_r(seed) % 300;
+    mp_hdr_t hdr = { t, seq };
+    memcpy(buf, &hdr, sizeof(hdr));
+    fill(buf + sizeof(hdr), n - sizeof(hdr), t << 24 | seq);
+    return n;
+}
+
+static int mp_parent(const char *self) {
+    static uint8_t buf[MAX_MSG];
+    shm_parent_t *p = new_parent(self, RING_SHM, SHM_MODE_RING);
+    CHECK(p && shm_parent_set_multi_producer(p, 1) == 0 && shm_parent_start(p) == 0);
+
+    // Records of several producers interleave, but each one's keep its order
+    uint32_t next[MP_THREADS] = { 0 };
+    for (int i = 0; i < MP_THREADS * MP_MSGS; i++) {
+        size_t len;
+        mp_hdr_t hdr;
+        CHECK(parent_recv(p, buf, sizeof(buf), &len) == 0 && len >= sizeof(hdr));
+        memcpy(&hdr, buf, sizeof(hdr));
+        CHECK(hdr.thread < MP_THREADS && hdr.seq == next[hdr.thread]);
+        CHECK(verify(buf + sizeof(hdr), len - sizeof(hdr), hdr.thread << 24 | hdr.seq));
+        next[hdr.thread]++;
+    }
+    const uint8_t *data;
+    size_t len;
+    CHECK(shm_parent_try_recv(p, &data, &len) == -1 && errno == EAGAIN);
+    shm_parent_close(p);
+    return 0;
+}
+
+typedef struct {
+    shm_child_t *c;
+    uint32_t thread;
+    int failed;
+} mp_thread_t;
+
+// Every whole send is safe to share: producers take turns between
+// send_data, send_batch and a try_send that retries
+static void *mp_producer(void *arg) {
+    mp_thread_t *t = (mp_thread_t*)arg;
+    uint8_t buf[MP_BATCH][512];
+    struct iovec msgs[MP_BATCH];
+    unsigned seed = t->thread + 1;
+
+    for (uint32_t seq = 0; seq < MP_MSGS && !t->failed;) {
+        switch (t->thread % 3) {
+        case 0:
+            t->failed = shm_child_send_data(t->c, buf[0], mp_put(buf[0], t->thread, seq, &seed)) != 0;
+            seq++;
+            break;
+        case 1: {
+            int n = MP_MSGS - seq < MP_BATCH ? (int)(MP_MSGS - seq) : MP_BATCH;
+            for (int i = 0; i < n; i++) {
+                msgs[i].iov_base = buf[i];
+                msgs[i].iov_len = mp_put(buf[i], t->thread, seq + (uint32_t)i, &seed);
+            }
+            t->failed = shm_child_send_batch(t->c, msgs, n) != 0;
+            seq += (uint32_t)n;
+            break;
+        }
+        default: {
+            size_t n = mp_put(buf[0], t->thread, seq, &seed);
+            while (shm_child_try_send(t->c, buf[0], n) != 0) {
+                if (errno != EAGAIN) {
+                    t->failed = 1;
+                    break;
+                }
+                sched_yield();
+            }
+            seq++;
+        }
+        }
+    }
+    return NULL;
+}
+
+static int mp_child(shm_child_t *c) {
+    CHECK(shm_child_multi_producer(c));
+    // Only whole sends are shared, so a lent reservation is refused
+    CHECK(shm_child_send_reserve(c, 16) == NULL && errno == EINVAL);
+
+    pthread_t tids[MP_THREADS];
+    mp_thread_t threads[MP_THREADS];
+    for (uint32_t i = 0; i < MP_THREADS; i++) {
+        threads[i] = (mp_thread_t){ c, i, 0 };
+        CHECK(pthread_create(&tids[i], NULL, mp_producer, &threads[i]) == 0);
+    }
+    for (int i = 0; i < MP_THREADS; i++) {
+        pthread_join(tids[i], NULL);
+        CHECK(!threads[i].failed);
+    }
+    return echo_child(c);
+}
+
+// --- Lanes ---
+
+#define LANES 2
+
+// Each lane echoes on its own channel: the child reads every lane without
+// blocking, so a lane whose FDs were left blocking stalls the test.
+static int lanes_parent(const char *self) {
+    static uint8_t buf[MAX_MSG], echo[MAX_MSG];
+    shm_parent_t *p = new_parent(self, RING_SHM, SHM_MODE_RING);
+    CHECK(p && shm_parent_set_lanes(p, LANES) == 0 && shm_parent_start(p) == 0);
+
+    for (uint32_t i = 0; i < 1000; i++) {
+        shm_parent_t *l = shm_parent_lane(p, (int)(i % LANES));
+        size_t n = 1 + i % 500, len;
+        fill(buf, n, i);
+        CHECK(l && shm_parent_send_data(l, buf, n) == 0);
+        CHECK(parent_recv(l, echo, sizeof(echo), &len) == 0);
+        CHECK(len == n && verify(echo, n, i));
+    }
+    shm_parent_close(p);
+    return 0;
+}
+
+static int lanes_child(shm_child_t *c) {
+    static uint8_t buf[MAX_MSG];
+    CHECK(c->lane_count == LANES && shm_child_set_nonblock(c, 1) == 0);
+    struct pollfd pfds[LANES];
+    for (int i = 0; i < LANES; i++) {
+        shm_child_t *l = shm_child_lane(c, i);
+        CHECK(fcntl(l->fd_p2c_send, F_GETFL) & O_NONBLOCK);
+        CHECK(fcntl(l->fd_c2p_ack, F_GETFL) & O_NONBLOCK);
+        pfds[i] = (struct pollfd){ .fd = shm_child_recv_fd(l), .events = POLLIN };
+    }
+
+    while (1) {
+        // Every lane is tried, ready or not, and must not block. An empty
+        // try_recv arms the wakeup, so poll only once all lanes came up empty.
+        int idle = 1;
+        for (int i = 0; i < LANES; i++) {
+            shm_child_t *l = shm_child_lane(c, i);
+            const uint8_t *data;
+            size_t n;
+            if (shm_child_try_recv(l, &data, &n) != 0) {
+                CHECK(errno == EAGAIN);
+                continue;
+            }
+            memcpy(buf, data, n);
+            CHECK(shm_child_read_end(l) == 0 && shm_child_send_data(l, buf, n) == 0);
+            idle = 0;
+        }
+        if (idle) CHECK(poll(pfds, LANES, TIMEOUT_MS) > 0);
+    }
+}
+
+// --- Compression ---
+
+// Shared with the Go and Rust tests, relative to c/
+#define LZ4_GOLDEN "../testdata/lz4_golden.txt"
+#define LZ4_VECS 16
+#define LZ4_MIN 64
+
+typedef struct {
+    char name[32];
+    uint8_t in[1024];
+    size_t in_len;
+    uint8_t frame[1024];
+    size_t frame_len; // 0: the input does not compress
+} lz4_vec_t;
+
+static int unhex(const char *hex, uint8_t *out, size_t cap, size_t *len) {
+    size_t n = strlen(hex);
+    if (strcmp(hex, "-") == 0) n = 0;
+    if (n % 2 || n / 2 > cap) return -1;
+    for (size_t i = 0; i < n / 2; i++) {
+        unsigned byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) return -1;
+        out[i] = (uint8_t)byte;
+    }
+    *len = n / 2;
+    return 0;
+}
+
+static int lz4_load(lz4_vec_t *vecs, int max) {
+    FILE *f = fopen(LZ4_GOLDEN, "r");
+    if (!f) return -1;
+    static char line[8192], in[4096], frame[4096];
+    int n = 0;
+    while (n < max && fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || sscanf(line, "%31s %4095s %4095s", vecs[n].name, in, frame) != 3) continue;
+        if (unhex(in, vecs[n].in, sizeof(vecs[n].in), &vecs[n].in_len) != 0 ||
+            unhex(frame, vecs[n].frame, sizeof(vecs[n].frame), &vecs[n].frame_len) != 0) break;
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+// Standard mode: writes a frame into P2C the way any peer would, flagged
+// with SHM_SIG_LZ4, and collects its ack itself
+static int lz4_inject(shm_parent_t *p, const uint8_t *frame, size_t n) {
+    memcpy(p->shm_p2c_ptr, frame, n);
+    uint64_t val = SHM_SIG_LZ4 | n;
+    if (write(p->efd_p2c_send, &val, sizeof(val)) != sizeof(val)) return -1;
+    if (wait_readable(p->efd_p2c_ack) != 0 || read(p->efd_p2c_ack, &val, sizeof(val)) != sizeof(val)) return -1;
+    return 0;
+}
+
+// The child's answer to the last message: its decoded bytes, or E
+static int lz4_answer(shm_parent_t *p, const uint8_t *want, size_t n) {
+    static uint8_t echo[MAX_MSG];
+    size_t len;
+    if (parent_recv(p, echo, sizeof(echo), &len) != 0) return 0;
+    return len == n && memcmp(echo, want, n) == 0;
+}
+
+static int lz4_standard_parent(const char *self) {
+    static lz4_vec_t vecs[LZ4_VECS];
+    static uint8_t buf[MAX_MSG];
+    int n = lz4_load(vecs, LZ4_VECS);
+    CHECK(n > 0);
+    shm_parent_t *p = new_parent(self, 65536, SHM_MODE_STANDARD);
+    CHECK(p && shm_parent_set_compress(p, 1) == 0 && shm_parent_start(p) == 0);
+
+    for (int i = 0; i < n; i++) {
+        const lz4_vec_t *v = &vecs[i];
+        // Our encoder leaves the golden frame in the memfd, or the input
+        // itself when it does not compress
+        CHECK(shm_parent_send_data(p, v->in, v->in_len) == 0 && lz4_answer(p, v->in, v->in_len));
+        if (v->frame_len) CHECK(memcmp(p->shm_p2c_ptr, v->frame, v->frame_len) == 0);
+        else CHECK(memcmp(p->shm_p2c_ptr, v->in, v->in_len) == 0);
+        if (!v->frame_len) continue;
+
+        // The child decodes the golden frame, and rejects it cut short, with
+        // a wrong raw length or without its block
+        CHECK(lz4_inject(p, v->frame, v->frame_len) == 0 && lz4_answer(p, v->in, v->in_len));
+        CHECK(lz4_inject(p, v->frame, v->frame_len - 1) == 0 && lz4_answer(p, (const uint8_t*)"E", 1));
+        memcpy(buf, v->frame, v->frame_len);
+        buf[0]++;
+        CHECK(lz4_inject(p, buf, v->frame_len) == 0 && lz4_answer(p, (const uint8_t*)"E", 1));
+        CHECK(lz4_inject(p, v->frame, SHM_LZ4_HDR_SIZE - 1) == 0 && lz4_answer(p, (const uint8_t*)"E", 1));
+    }
+
+    // Right below compress_min a message goes as it is, from it on framed
+    CHECK(shm_parent_set_compress(p, LZ4_MIN) == 0);
+    for (size_t j = 0; j < LZ4_MIN; j++) buf[j] = "abcd"[j % 4];
+    CHECK(shm_parent_send_data(p, buf, LZ4_MIN - 1) == 0 && lz4_answer(p, buf, LZ4_MIN - 1));
+    CHECK(memcmp(p->shm_p2c_ptr, buf, LZ4_MIN - 1) == 0);
+    CHECK(shm_parent_send_data(p, buf, LZ4_MIN) == 0 && lz4_answer(p, buf, LZ4_MIN));
+    CHECK(memcmp(p->shm_p2c_ptr, "\x40\0\0\0\0\0\0\0", SHM_LZ4_HDR_SIZE) == 0);
+    shm_parent_close(p);
+    return 0;
+}
+
+// Every fourth message is right at the compress_min edge; odd ones are
+// random bytes that do not compress
+static size_t lz4_msg(uint8_t *buf, uint32_t i, unsigned *seed) {
+    static const size_t edge[] = { LZ4_MIN - 1, LZ4_MIN, LZ4_MIN + 1 };
+    size_t n = i % 4 == 3 ? edge[i / 4 % 3] : 1 + (size_t)rand_r(seed) % 2000;
+    for (size_t j = 0; j < n; j++) buf[j] = i % 2 ? (uint8_t)rand_r(seed) : (uint8_t)"efdstream "[j % 10];
+    return n;
+}
+
+static int lz4_ring_parent(const char *self) {
+    static lz4_vec_t vecs[LZ4_VECS];
+    static uint8_t buf[MAX_MSG];
+    CHECK(lz4_load(vecs, LZ4_VECS) > 0 && vecs[0].frame_len);
+    shm_parent_t *p = new_parent(self, RING_SHM, SHM_MODE_RING);
+    CHECK(p && shm_parent_set_compress(p, LZ4_MIN) == 0 && shm_parent_start(p) == 0);
+    int status;
+    CHECK(waitpid(p->child_pid, &status, WUNTRACED) == p->child_pid && WIFSTOPPED(status));
+
+    // Two compressed records, spoilt before the stopped child sees them:
+    // a wrong raw length, then a block of garbage
+    const lz4_vec_t *v = &vecs[0];
+    for (int k = 0; k < 2; k++) {
+        shm_rec_t *rec = (shm_rec_t*)(p->ring_p2c.data + p->ring_p2c.tail % p->ring_p2c.capacity);
+        CHECK(shm_parent_send_data(p, v->in, v->in_len) == 0);
+        CHECK(rec->flags & SHM_REC_LZ4 && rec->len == v->frame_len);
+        CHECK(memcmp(rec + 1, v->frame, v->frame_len) == 0);
+        if (k == 0) ((uint8_t*)(rec + 1))[0]++;
+        else memset((uint8_t*)(rec + 1) + SHM_LZ4_HDR_SIZE, 0xff, rec->len - SHM_LZ4_HDR_SIZE);
+    }
+    CHECK(shm_parent_send_data(p, v->in, v->in_len) == 0);
+    CHECK(kill(p->child_pid, SIGCONT) == 0);
+    CHECK(lz4_answer(p, (const uint8_t*)"E", 1) && lz4_answer(p, (const uint8_t*)"E", 1));
+    CHECK(lz4_answer(p, v->in, v->in_len));
+
+    // Round trips, compressed both ways wherever that pays
+    unsigned seed = 1;
+    for (uint32_t i = 0; i < 4000; i++) {
+        size_t n = lz4_msg(buf, i, &seed);
+        CHECK(shm_parent_send_data(p, buf, n) == 0 && lz4_answer(p, buf, n));
+    }
+    shm_parent_close(p);
+    return 0;
+}
+
+// Echoes what it decodes and answers E to what it cannot
+static int lz4_child(shm_child_t *c) {
+    static uint8_t buf[MAX_MSG];
+    if (c->mode == SHM_MODE_RING) {
+        CHECK(shm_child_set_compress(c, LZ4_MIN) == 0);
+        raise(SIGSTOP);
+    }
+    while (1) {
+        size_t n;
+        if (child_recv(c, buf, sizeof(buf), &n) != 0) {
+            CHECK(errno == EBADMSG);
+            buf[0] = 'E';
+            n = 1;
+        }
+        CHECK(shm_child_send_data(c, buf, n) == 0);
+    }
+}
+
+// --- Handshake ---
+
+#define LEGACY_LEN 64
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// Its first message starts with four zero bytes, where a C2P hello would go
+static void legacy_msg(uint8_t *buf) {
+    memset(buf, 0, 4);
+    fill(buf + 4, LEGACY_LEN - 4, 7);
+}
+
+// SHM_MODE_AUTO with a child that predates the handshake: it gets standard
+// mode, and nothing the parent does to close the handshake may touch what
+// the child has written. A silent child costs SHM_HELLO_TIMEOUT_MS, one
+// that talks first none.
+static int auto_legacy_parent(const char *self, int silent) {
+    uint8_t buf[LEGACY_LEN], echo[MAX_MSG];
+    shm_parent_t *p = new_parent(self, RING_SHM, SHM_MODE_AUTO);
+    uint64_t start = now_ms();
+    CHECK(p && shm_parent_start(p) == 0);
+    uint64_t elapsed = now_ms() - start;
+    CHECK(p->mode == SHM_MODE_STANDARD && shm_parent_peer_features(p) == 0);
+    CHECK(silent ? elapsed >= SHM_HELLO_TIMEOUT_MS : elapsed < SHM_HELLO_TIMEOUT_MS);
+
+    size_t len;
+    legacy_msg(buf);
+    CHECK(parent_recv(p, echo, sizeof(echo), &len) == 0 && len == LEGACY_LEN);
+    CHECK(memcmp(echo, buf, LEGACY_LEN) == 0);
+    for (uint32_t i = 0; i < 100; i++) {
+        fill(buf, sizeof(buf), i);
+        CHECK(shm_parent_send_data(p, buf, sizeof(buf)) == 0);
+        CHECK(parent_recv(p, echo, sizeof(echo), &len) == 0 && len == sizeof(buf) && verify(echo, len, i));
+    }
+    shm_parent_close(p);
+    return 0;
+}
+
+static int auto_silent_parent(const char *self) {
+    return auto_legacy_parent(self, 1);
+}
+
+static int auto_early_parent(const char *self) {
+    return auto_legacy_parent(self, 0);
+}
+
+// The standard-mode protocol by hand on the fixed FDs, the way a child
+// built before the handshake speaks it: the hello in P2C goes unread
+static int legacy_child(size_t shm_size) {
+    uint8_t *p2c = mmap(NULL, shm_size, PROT_READ, MAP_SHARED, 5, 0);
+    uint8_t *c2p = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, 8, 0);
+    CHECK(p2c != MAP_FAILED && c2p != MAP_FAILED);
+
+    // Written at once, signalled only after the parent has given up on a
+    // hello when silent
+    uint64_t val = LEGACY_LEN;
+    legacy_msg(c2p);
+    if (strcmp(getenv(ENV_TEST), "auto_silent") == 0) usleep((SHM_HELLO_TIMEOUT_MS + 500) * 1000);
+    CHECK(write(6, &val, 8) == 8 && read(7, &val, 8) == 8);
+
+    while (1) {
+        CHECK(read(3, &val, 8) == 8 && val <= shm_size);
+        memcpy(c2p, p2c, val);
+        uint64_t ack = 1;
+        CHECK(write(4, &ack, 8) == 8);
+        CHECK(write(6, &val, 8) == 8 && read(7, &ack, 8) == 8);
+    }
+}
+
+// A C child answers the handshake and gets ring mode without the timeout
+static int auto_ring_parent(const char *self) {
+    uint8_t buf[256], echo[MAX_MSG];
+    shm_parent_t *p = new_parent(self, RING_SHM, SHM_MODE_AUTO);
+    uint64_t start = now_ms();
+    CHECK(p && shm_parent_start(p) == 0);
+    CHECK(now_ms() - start < SHM_HELLO_TIMEOUT_MS);
+    CHECK(p->mode == SHM_MODE_RING && (shm_parent_peer_features(p) & SHM_FEAT_RING));
+
+    size_t len;
+    for (uint32_t i = 0; i < 100; i++) {
+        fill(buf, sizeof(buf), i);
+        CHECK(shm_parent_send_data(p, buf, sizeof(buf)) == 0);
+        CHECK(parent_recv(p, echo, sizeof(echo), &len) == 0 && len == sizeof(buf) && verify(echo, len, i));
+    }
+    shm_parent_close(p);
+    return 0;
+}
+
+static const test_t tests[] = {
+    { "ring_wrap", ring_wrap_parent, echo_child, NULL },
+    { "ring_full", ring_full_parent, ring_full_child, NULL },
+    { "drop_oldest", drop_oldest_parent, drop_oldest_child, NULL },
+    { "corrupt_record", corrupt_record_parent, corrupt_record_child, NULL },
+    { "slots_seq", slots_seq_parent, slots_seq_child, NULL },
+    { "mp_producers", mp_parent, mp_child, NULL },
+    { "lanes", lanes_parent, lanes_child, NULL },
+    { "lz4_standard", lz4_standard_parent, lz4_child, NULL },
+    { "lz4_ring", lz4_ring_parent, lz4_child, NULL },
+    { "auto_silent", auto_silent_parent, NULL, legacy_child },
+    { "auto_early", auto_early_parent, NULL, legacy_child },
+    { "auto_ring", auto_ring_parent, echo_child, NULL },
+};
+
+#define N_TESTS (int)(sizeof(tests) / sizeof(tests[0]))
+
+static int run_child(size_t shm_size) {
+    // Never outlive a parent that failed a check
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    const char *name = getenv(ENV_TEST);
+    for (int i = 0; name && i < N_TESTS; i++) {
+        if (strcmp(tests[i].name, name) != 0) continue;
+        if (tests[i].legacy) return tests[i].legacy(shm_size);
+        shm_child_t *c = shm_child_new(shm_size);
+        if (!c) return 1;
+        return tests[i].child(c);
+    }
+    fprintf(stderr, "Unknown test %s\n", name ? name : "(none)");
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    size_t shm_size = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-mode") == 0 && i + 1 < argc && strcmp(argv[i + 1], "child") == 0) {
+            for (int k = i; k + 1 < argc; k++) {
+                if (strcmp(argv[k], "-shm-size") == 0) shm_size = strtoul(argv[k + 1], NULL, 10);
+            }
+            return run_child(shm_size);
+        }
+    }
+
+    // Tests named on the command line, or all of them
+    int failed = 0;
+    for (int i = 0; i < N_TESTS; i++) {
+        int selected = argc == 1;
+        for (int k = 1; k < argc; k++) selected |= strcmp(argv[k], tests[i].name) == 0;
+        if (!selected) continue;
+
+        setenv(ENV_TEST, tests[i].name, 1);
+        int ret = tests[i].parent(argv[0]);
+        printf("%-24s %s\n", tests[i].name, ret == 0 ? "ok" : "FAILED");
+        failed += ret != 0;
+    }
+    return failed ? 1 : 0;
+}
@@ -5,14 +5,38 @@ import (
 	"fmt"
 	"os"
 	"os/exec"
+	"sync"
+	"sync/atomic"
+	"unsafe"
 
 	"golang.org/x/sys/unix"
 )
 
+// Handshake with a C parent in auto mode (shm_hello_t in efd.h): the parent
+// puts a hello at offset 0 of P2C, which we claim by moving its magic to
+// helloClaimed, and waits for ours at offset 0 of C2P, signalled with
+// sigHello. This implementation only speaks standard mode.
+const (
+	helloMagic   = 0x4f4c4548 // "HELO"
+	helloClaimed = 0x444d4c43 // "CLMD"
+	helloVersion = 1
+	helloSize    = 24
+	sigHello     = uint64(1) << 61
+
+	// FeatLZ4 is the feature bit of LZ4-compressed messages.
+	FeatLZ4 = 0x10
+	// FeatResize is the feature bit of following memfds grown by the parent.
+	FeatResize = 0x20
+)
+
+// Children sharing the FDs in one process hand-shake once
+var handshakeMu sync.Mutex
+
 // ShmParent manages the child process, eventfd, and shared memory.
 type ShmParent struct {
-	childPath string
-	shmSize   int
+	childPath   string
+	shmSize     int
+	compressMin int
 
 	// Resources
 	efdP2CSend int
@@ -44,6 +68,13 @@ func NewShmParent(childPath string, shmSize int) *ShmParent {
 	}
 }
 
+// SetCompress makes SendData LZ4-compress messages of at least minSize
+// bytes when that makes them smaller; 0 turns it off. Such a message only
+// has to fit the region compressed, and needs a peer that decodes it.
+func (p *ShmParent) SetCompress(minSize int) {
+	p.compressMin = minSize
+}
+
 // Start launches the child process and sets up resources.
 func (p *ShmParent) Start() error {
 	var err error
@@ -132,16 +163,24 @@ func (p *ShmParent) Start() error {
 
 // SendData sends data to the child (P2C).
 func (p *ShmParent) SendData(data []byte) error {
-	if len(data) > p.shmSize {
-		return fmt.Errorf("data too large")
+	length := uint64(len(data))
+	n := 0
+	if p.compressMin > 0 && len(data) >= p.compressMin {
+		n = lz4Frame(p.shmP2CPtr, p.shmSize, data)
 	}
 
-	// Write to SHM
-	copy(p.shmP2CPtr, data)
+	if n > 0 {
+		length = uint64(n) | sigLZ4
+	} else if len(data) > p.shmSize {
+		return fmt.Errorf("data too large")
+	} else {
+		// Write to SHM
+		copy(p.shmP2CPtr, data)
+	}
 
 	// Signal
 	lenBuf := make([]byte, 8)
-	binary.LittleEndian.PutUint64(lenBuf, uint64(len(data)))
+	binary.LittleEndian.PutUint64(lenBuf, length)
 	if _, err := p.fileP2CSend.Write(lenBuf); err != nil {
 		return err
 	}
@@ -162,15 +201,22 @@ func (p *ShmParent) ReadData() ([]byte, error) {
 	if _, err := p.fileC2PSend.Read(lenBuf); err != nil {
 		return nil, err
 	}
-	length := binary.LittleEndian.Uint64(lenBuf)
+	val := binary.LittleEndian.Uint64(lenBuf)
+	length := val &^ sigLZ4
 
-	if int(length) > p.shmSize {
+	if length > uint64(p.shmSize) {
 		return nil, fmt.Errorf("received length %d exceeds SHM size", length)
 	}
 
 	// Read from SHM
-	data := make([]byte, length)
-	copy(data, p.shmC2PPtr[:length])
+	var data []byte
+	var decErr error
+	if val&sigLZ4 != 0 {
+		data, decErr = lz4Unframe(p.shmC2PPtr[:length])
+	} else {
+		data = make([]byte, length)
+		copy(data, p.shmC2PPtr[:length])
+	}
 
 	// Send ACK
 	ackBuf := make([]byte, 8)
@@ -179,7 +225,7 @@ func (p *ShmParent) ReadData() ([]byte, error) {
 		return nil, err
 	}
 
-	return data, nil
+	return data, decErr
 }
 
 // Close cleans up resources.
@@ -205,6 +251,9 @@ type ShmChild struct {
 	fdC2PShm  int
 	shmSize   int
 
+	compressMin  int
+	peerFeatures uint32
+
 	shmP2CPtr []byte
 	shmC2PPtr []byte
 
@@ -245,9 +294,72 @@ func NewShmChild(shmSize int) (*ShmChild, error) {
 	c.fileC2PSend = os.NewFile(uintptr(c.fdC2PSend), "efd_c2p_send")
 	c.fileC2PAck = os.NewFile(uintptr(c.fdC2PAck), "efd_c2p_ack")
 
+	if err := c.handshake(); err != nil {
+		return nil, fmt.Errorf("handshake failed: %w", err)
+	}
+
 	return c, nil
 }
 
+// handshake answers a parent in auto mode, which lays out the memfds for
+// standard mode once it has our hello and then lets us go on.
+func (c *ShmChild) handshake() error {
+	handshakeMu.Lock()
+	defer handshakeMu.Unlock()
+
+	if c.shmSize < helloSize || binary.LittleEndian.Uint32(c.shmP2CPtr) != helloMagic {
+		return nil
+	}
+
+	// Claim the parent's hello, unless it has given up waiting for ours. It
+	// is the only word of P2C we write.
+	p2c := c.shmP2CPtr[:helloSize]
+	if err := unix.Mprotect(p2c, unix.PROT_READ|unix.PROT_WRITE); err != nil {
+		return fmt.Errorf("failed to claim the hello: %w", err)
+	}
+	claimed := atomic.CompareAndSwapUint32((*uint32)(unsafe.Pointer(&p2c[0])), helloMagic, helloClaimed)
+	unix.Mprotect(p2c, unix.PROT_READ)
+	if !claimed {
+		return nil
+	}
+	c.peerFeatures = binary.LittleEndian.Uint32(p2c[8:])
+
+	hello := c.shmC2PPtr[:helloSize]
+	clear(hello)
+	binary.LittleEndian.PutUint32(hello, helloMagic)
+	binary.LittleEndian.PutUint32(hello[4:], helloVersion)
+	binary.LittleEndian.PutUint32(hello[8:], FeatLZ4|FeatResize)
+	binary.LittleEndian.PutUint64(hello[16:], uint64(c.shmSize))
+
+	buf := make([]byte, 8)
+	binary.LittleEndian.PutUint64(buf, sigHello)
+	if _, err := c.fileC2PSend.Write(buf); err != nil {
+		return err
+	}
+
+	// Acked like a message, so that the first real one does not add up with it
+	if _, err := c.fileP2CSend.Read(buf); err != nil {
+		return err
+	}
+	if binary.LittleEndian.Uint64(buf)&sigHello == 0 {
+		return fmt.Errorf("unexpected signal from parent")
+	}
+	binary.LittleEndian.PutUint64(buf, 1)
+	_, err := c.fileP2CAck.Write(buf)
+	return err
+}
+
+// PeerFeatures returns the feature bits the parent announced in the
+// handshake, or 0 if there was none.
+func (c *ShmChild) PeerFeatures() uint32 {
+	return c.peerFeatures
+}
+
+// SetCompress is the same as ShmParent.SetCompress, for C2P.
+func (c *ShmChild) SetCompress(minSize int) {
+	c.compressMin = minSize
+}
+
 // Listen reads data from the parent (P2C).
 func (c *ShmChild) Listen(handler func([]byte)) error {
 	lenBuf := make([]byte, 8)
@@ -258,16 +370,31 @@ func (c *ShmChild) Listen(handler func([]byte)) error {
 		if _, err := c.fileP2CSend.Read(lenBuf); err != nil {
 			return err
 		}
-		length := binary.LittleEndian.Uint64(lenBuf)
-
-		if int(length) > c.shmSize {
-			fmt.Printf("Received length %d exceeds SHM size\n", length)
-			continue
+		val := binary.LittleEndian.Uint64(lenBuf)
+		length := val &^ sigLZ4
+
+		// A C parent may have grown the memfd (shm_parent_resize)
+		if length > uint64(len(c.shmP2CPtr)) {
+			grown, err := remap(c.fdP2CShm, c.shmP2CPtr, int(length), unix.PROT_READ)
+			if err != nil {
+				fmt.Printf("Received length %d exceeds SHM size\n", length)
+				continue
+			}
+			c.shmP2CPtr = grown
 		}
 
-		data := make([]byte, length)
-		copy(data, c.shmP2CPtr[:length])
-		handler(data)
+		if val&sigLZ4 != 0 {
+			data, err := lz4Unframe(c.shmP2CPtr[:length])
+			if err != nil {
+				fmt.Printf("%v\n", err)
+			} else {
+				handler(data)
+			}
+		} else {
+			data := make([]byte, length)
+			copy(data, c.shmP2CPtr[:length])
+			handler(data)
+		}
 
 		if _, err := c.fileP2CAck.Write(ackBuf); err != nil {
 			return err
@@ -277,16 +404,30 @@ func (c *ShmChild) Listen(handler func([]byte)) error {
 
 // SendData sends data to the parent (C2P).
 func (c *ShmChild) SendData(data []byte) error {
-	if len(data) > c.shmSize {
-		return fmt.Errorf("data too large")
+	length := uint64(len(data))
+	n := 0
+	peerLZ4 := c.peerFeatures == 0 || c.peerFeatures&FeatLZ4 != 0
+	if c.compressMin > 0 && len(data) >= c.compressMin && peerLZ4 {
+		n = lz4Frame(c.shmC2PPtr, len(c.shmC2PPtr), data)
+	}
+	if n == 0 && len(data) > len(c.shmC2PPtr) {
+		grown, err := remap(c.fdC2PShm, c.shmC2PPtr, len(data), unix.PROT_READ|unix.PROT_WRITE)
+		if err != nil {
+			return fmt.Errorf("data too large")
+		}
+		c.shmC2PPtr = grown
 	}
 
-	// Write to SHM
-	copy(c.shmC2PPtr, data)
+	if n > 0 {
+		length = uint64(n) | sigLZ4
+	} else {
+		// Write to SHM
+		copy(c.shmC2PPtr, data)
+	}
 
 	// Signal
 	lenBuf := make([]byte, 8)
-	binary.LittleEndian.PutUint64(lenBuf, uint64(len(data)))
+	binary.LittleEndian.PutUint64(lenBuf, length)
 	if _, err := c.fileC2PSend.Write(lenBuf); err != nil {
 		return err
 	}
@@ -300,6 +441,24 @@ func (c *ShmChild) SendData(data []byte) error {
 	return nil
 }
 
+// remap maps fd again at its current size, which must have grown to at
+// least need bytes, and unmaps the old mapping.
+func remap(fd int, old []byte, need int, prot int) ([]byte, error) {
+	var st unix.Stat_t
+	if err := unix.Fstat(fd, &st); err != nil {
+		return nil, err
+	}
+	if int(st.Size) < need || int(st.Size) <= len(old) {
+		return nil, fmt.Errorf("memfd of %d bytes has no room for %d", st.Size, need)
+	}
+	grown, err := unix.Mmap(fd, 0, int(st.Size), prot, unix.MAP_SHARED)
+	if err != nil {
+		return nil, err
+	}
+	unix.Munmap(old)
+	return grown, nil
+}
+
 // Close cleans up resources.
 func (c *ShmChild) Close() {
 	if c.shmP2CPtr != nil {
@@ -0,0 +1,198 @@
+package efd
+
+import (
+	"encoding/binary"
+	"fmt"
+)
+
+// Compressed messages, as the C library sends them when compression is
+// enabled: the eventfd value has sigLZ4 set and the region holds a frame of
+// the raw length (4 bytes little endian), 4 zero bytes and one LZ4 block.
+const (
+	sigLZ4       = uint64(1) << 62
+	lz4HdrSize   = 8
+	lz4HashBits  = 12
+	lz4MinMatch  = 4
+	lz4LastLits  = 5
+	lz4MFLimit   = 12
+	lz4MaxOffset = 65535
+	lz4MaxInput  = 0x7E000000
+)
+
+func lz4Hash(v uint32) uint32 {
+	return (v * 2654435761) >> (32 - lz4HashBits)
+}
+
+func lz4PutLen(dst []byte, n int) []byte {
+	for n >= 255 {
+		dst = append(dst, 255)
+		n -= 255
+	}
+	return append(dst, byte(n))
+}
+
+func lz4Token(lit, mlen int) byte {
+	return byte(min(lit, 15)<<4 | min(mlen, 15))
+}
+
+// lz4Compress appends the LZ4 block for src to dst, giving up (ok false)
+// once the block would exceed limit bytes.
+func lz4Compress(dst, src []byte, limit int) ([]byte, bool) {
+	start := len(dst)
+	anchor, ip, n := 0, 0, len(src)
+
+	if n >= lz4MFLimit+1 {
+		var table [1 << lz4HashBits]int32
+		mflimit, matchLimit := n-lz4MFLimit, n-lz4LastLits
+
+		for ip <= mflimit {
+			seq := binary.LittleEndian.Uint32(src[ip:])
+			h := lz4Hash(seq)
+			ref := int(table[h])
+			table[h] = int32(ip)
+			if ref >= ip || ip-ref > lz4MaxOffset || binary.LittleEndian.Uint32(src[ref:]) != seq {
+				// Skip faster through data that does not match
+				ip += 1 + (ip-anchor)>>6
+				continue
+			}
+
+			for ip > anchor && ref > 0 && src[ip-1] == src[ref-1] {
+				ip--
+				ref--
+			}
+			mp, rp := ip+lz4MinMatch, ref+lz4MinMatch
+			for mp < matchLimit && src[mp] == src[rp] {
+				mp++
+				rp++
+			}
+
+			lit, mlen := ip-anchor, mp-ip-lz4MinMatch
+			if len(dst)-start+lit/255+lit+mlen/255+5 > limit {
+				return dst[:start], false
+			}
+			dst = append(dst, lz4Token(lit, mlen))
+			if lit >= 15 {
+				dst = lz4PutLen(dst, lit-15)
+			}
+			dst = append(dst, src[anchor:ip]...)
+			dst = append(dst, byte(ip-ref), byte((ip-ref)>>8))
+			if mlen >= 15 {
+				dst = lz4PutLen(dst, mlen-15)
+			}
+
+			ip, anchor = mp, mp
+			if ip <= mflimit {
+				table[lz4Hash(binary.LittleEndian.Uint32(src[ip-2:]))] = int32(ip - 2)
+			}
+		}
+	}
+
+	lit := n - anchor
+	if len(dst)-start+lit/255+lit+2 > limit {
+		return dst[:start], false
+	}
+	dst = append(dst, lz4Token(lit, 0))
+	if lit >= 15 {
+		dst = lz4PutLen(dst, lit-15)
+	}
+	return append(dst, src[anchor:]...), true
+}
+
+func lz4GetLen(src []byte, ip *int, n *int) bool {
+	for {
+		if *ip >= len(src) {
+			return false
+		}
+		b := src[*ip]
+		*ip++
+		*n += int(b)
+		if b != 255 {
+			return true
+		}
+	}
+}
+
+// lz4Decompress decodes a block that must expand to exactly raw bytes.
+func lz4Decompress(src []byte, raw int) ([]byte, bool) {
+	dst := make([]byte, 0, raw)
+	ip := 0
+
+	for ip < len(src) {
+		token := src[ip]
+		ip++
+		lit := int(token >> 4)
+		if lit == 15 && !lz4GetLen(src, &ip, &lit) {
+			return nil, false
+		}
+		if lit > len(src)-ip || lit > raw-len(dst) {
+			return nil, false
+		}
+		dst = append(dst, src[ip:ip+lit]...)
+		ip += lit
+		if ip == len(src) {
+			break // The last sequence has no match
+		}
+
+		if len(src)-ip < 2 {
+			return nil, false
+		}
+		off := int(src[ip]) | int(src[ip+1])<<8
+		ip += 2
+		if off == 0 || off > len(dst) {
+			return nil, false
+		}
+
+		mlen := int(token & 15)
+		if mlen == 15 && !lz4GetLen(src, &ip, &mlen) {
+			return nil, false
+		}
+		mlen += lz4MinMatch
+		if mlen > raw-len(dst) {
+			return nil, false
+		}
+
+		// Overlapping matches repeat the last off bytes
+		m := len(dst) - off
+		for i := 0; i < mlen; i++ {
+			dst = append(dst, dst[m+i])
+		}
+	}
+
+	if len(dst) != raw {
+		return nil, false
+	}
+	return dst, true
+}
+
+// lz4Frame writes data as a frame of at most capacity bytes into dst and
+// returns its size, or 0 when that would not be smaller than data itself.
+func lz4Frame(dst []byte, capacity int, data []byte) int {
+	if capacity >= len(data) {
+		capacity = len(data) - 1
+	}
+	if len(data) == 0 || len(data) > lz4MaxInput || capacity <= lz4HdrSize {
+		return 0
+	}
+
+	block, ok := lz4Compress(make([]byte, 0, capacity-lz4HdrSize), data, capacity-lz4HdrSize)
+	if !ok {
+		return 0
+	}
+	binary.LittleEndian.PutUint32(dst, uint32(len(data)))
+	binary.LittleEndian.PutUint32(dst[4:], 0)
+	copy(dst[lz4HdrSize:], block)
+	return lz4HdrSize + len(block)
+}
+
+// lz4Unframe decodes a frame received in shared memory.
+func lz4Unframe(frame []byte) ([]byte, error) {
+	if len(frame) >= lz4HdrSize {
+		raw := binary.LittleEndian.Uint32(frame)
+		if raw <= lz4MaxInput {
+			if data, ok := lz4Decompress(frame[lz4HdrSize:], int(raw)); ok {
+				return data, nil
+			}
+		}
+	}
+	return nil, fmt.Errorf("corrupt LZ4 frame of %d bytes", len(frame))
+}
@@ -0,0 +1,119 @@
+package efd
+
+import (
+	"bufio"
+	"bytes"
+	"encoding/hex"
+	"math/rand"
+	"os"
+	"strings"
+	"testing"
+)
+
+// Shared with the C and Rust tests
+const lz4Golden = "../../testdata/lz4_golden.txt"
+
+type lz4Vector struct {
+	name  string
+	in    []byte
+	frame []byte // nil when in does not compress
+}
+
+func loadLZ4Golden(t *testing.T) []lz4Vector {
+	f, err := os.Open(lz4Golden)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer f.Close()
+
+	var vecs []lz4Vector
+	sc := bufio.NewScanner(f)
+	sc.Buffer(nil, 1<<20)
+	for sc.Scan() {
+		fields := strings.Fields(sc.Text())
+		if len(fields) != 3 || strings.HasPrefix(fields[0], "#") {
+			continue
+		}
+		v := lz4Vector{name: fields[0]}
+		if v.in, err = hex.DecodeString(fields[1]); err != nil {
+			t.Fatalf("%s: %v", v.name, err)
+		}
+		if fields[2] != "-" {
+			if v.frame, err = hex.DecodeString(fields[2]); err != nil {
+				t.Fatalf("%s: %v", v.name, err)
+			}
+		}
+		vecs = append(vecs, v)
+	}
+	if err := sc.Err(); err != nil {
+		t.Fatal(err)
+	}
+	if len(vecs) == 0 {
+		t.Fatalf("no vectors in %s", lz4Golden)
+	}
+	return vecs
+}
+
+func TestLZ4Golden(t *testing.T) {
+	for _, v := range loadLZ4Golden(t) {
+		dst := make([]byte, len(v.in))
+		if n := lz4Frame(dst, len(dst), v.in); !bytes.Equal(dst[:n], v.frame) {
+			t.Errorf("%s: frame %x, want %x", v.name, dst[:n], v.frame)
+		}
+		if v.frame == nil {
+			continue
+		}
+		if got, err := lz4Unframe(v.frame); err != nil || !bytes.Equal(got, v.in) {
+			t.Errorf("%s: decoded %x (%v), want %x", v.name, got, err, v.in)
+		}
+	}
+}
+
+func TestLZ4Corrupt(t *testing.T) {
+	for _, v := range loadLZ4Golden(t) {
+		if v.frame == nil {
+			continue
+		}
+		raw := append([]byte{v.frame[0] + 1}, v.frame[1:]...)
+		bad := map[string][]byte{
+			"truncated":    v.frame[:len(v.frame)-1],
+			"short header": v.frame[:lz4HdrSize-1],
+			"raw length":   raw,
+		}
+		for what, frame := range bad {
+			if _, err := lz4Unframe(frame); err == nil {
+				t.Errorf("%s: %s frame decoded", v.name, what)
+			}
+		}
+	}
+}
+
+func TestLZ4RoundTrip(t *testing.T) {
+	rng := rand.New(rand.NewSource(1))
+	for i := 0; i < 2000; i++ {
+		data := make([]byte, 1+rng.Intn(4000))
+		for j := range data {
+			if i%2 == 0 {
+				data[j] = "efdstream "[j%10]
+			} else {
+				data[j] = byte(rng.Intn(256))
+			}
+		}
+
+		dst := make([]byte, len(data))
+		n := lz4Frame(dst, len(dst), data)
+		if n == 0 {
+			// Random bytes do not compress, a repeated word does once it is long enough
+			if i%2 == 0 && len(data) >= 64 {
+				t.Fatalf("%d bytes of text did not compress", len(data))
+			}
+			continue
+		}
+		if n >= len(data) {
+			t.Fatalf("frame of %d bytes for %d", n, len(data))
+		}
+		if got, err := lz4Unframe(dst[:n]); err != nil || !bytes.Equal(got, data) {
+			t.Fatalf("round trip of %d bytes: %v", len(data), err)
+		}
+	}
+}
@@ -1,12 +1,18 @@
 package main
 
 import (
+	"bytes"
 	"flag"
 	"fmt"
 	"log"
+	"os"
+	"slices"
+	"strconv"
+	"strings"
 	"time"
 
 	"github.com/snowmerak/efdstream/go/efd"
+	"golang.org/x/sys/unix"
 )
 
 var (
@@ -22,12 +28,44 @@ var (
 	fdC2PShm  = flag.Int("fd-c2p-shm", 8, "FD for C2P shm")
 
 	shmSize = flag.Int("shm-size", 1024*1024, "Size of shared memory")
+
+	// Passed by a C parent for broadcast readers and FD passing, which this child does not use
+	_ = flag.Int("fd-bcast", -1, "First broadcast FD (unused)")
+	_ = flag.Int("fd-sock", -1, "FD passing socket (unused)")
+
+	iters      = flag.Int("iters", 0, "Parent: time this many sends per payload size instead of the demo exchange")
+	maxPayload = flag.Int("max-payload", 65536, "Largest payload timed with -iters")
 )
 
+// Both sides LZ4-compress sends of at least this many bytes, and repeat the
+// text of every demo message up to that size so it compresses. An
+// environment variable, since the parent does not pass its flags on.
+const envCompress = "EFDSTREAM_COMPRESS"
+
+func demoCompress() int {
+	n, _ := strconv.Atoi(os.Getenv(envCompress))
+	return n
+}
+
+// demoMessage is the text alone, or followed by a space and repeated until
+// min bytes.
+func demoMessage(text string, min int) string {
+	if min == 0 {
+		return text
+	}
+	var b strings.Builder
+	for b.Len() < min {
+		b.WriteString(text + " ")
+	}
+	return b.String()
+}
+
 func main() {
 	flag.Parse()
 
-	if *mode == "parent" {
+	if *mode == "parent" && *iters > 0 {
+		runBench()
+	} else if *mode == "parent" {
 		runParent()
 	} else {
 		runChild()
@@ -41,6 +79,7 @@ func runParent() {
 
 	// FDs are now auto-generated and mapped to 3, 4, 5, 6, 7, 8 in the child.
 	parent := efd.NewShmParent(*childPath, *shmSize)
+	parent.SetCompress(demoCompress())
 	if err := parent.Start(); err != nil {
 		log.Fatalf("Failed to start parent: %v", err)
 	}
@@ -50,7 +89,7 @@ func runParent() {
 
 	for i := 0; i < 5; i++ {
 		// Send
-		msg := fmt.Sprintf("Hello from Go Parent %d", i)
+		msg := demoMessage(fmt.Sprintf("Hello from Go Parent %d", i), demoCompress())
 		fmt.Printf("[Go Parent] Sending: %s\n", msg)
 		if err := parent.SendData([]byte(msg)); err != nil {
 			log.Fatalf("[Go Parent] Send error: %v", err)
@@ -68,6 +107,68 @@ func runParent() {
 	}
 }
 
+// startQuiet starts the child with its stdout on /dev/null, since it prints
+// every message it receives.
+func startQuiet(p *efd.ShmParent) error {
+	devnull, err := os.OpenFile(os.DevNull, os.O_WRONLY, 0)
+	if err != nil {
+		return err
+	}
+	defer devnull.Close()
+	saved, err := unix.Dup(1)
+	if err != nil {
+		return err
+	}
+	defer unix.Close(saved)
+
+	unix.Dup2(int(devnull.Fd()), 1)
+	err = p.Start()
+	unix.Dup2(saved, 1)
+	return err
+}
+
+// runBench times -iters SendData calls, each a round trip to the child's
+// ack, per payload size from 8 bytes up to -max-payload, and prints them in
+// the layout of efdstream_bench.
+func runBench() {
+	if *childPath == "" {
+		log.Fatal("Child path is required in parent mode")
+	}
+
+	parent := efd.NewShmParent(*childPath, *shmSize)
+	if err := startQuiet(parent); err != nil {
+		log.Fatalf("Failed to start parent: %v", err)
+	}
+	defer parent.Close()
+
+	fmt.Printf("%-10s %-10s %-6s %8s %12s %9s %9s %9s %9s\n",
+		"shm_size", "payload", "test", "msgs", "msgs/s", "GB/s", "p50_us", "p99_us", "p999_us")
+
+	buf := bytes.Repeat([]byte{0xab}, *maxPayload)
+	lat := make([]time.Duration, *iters)
+	for payload := 8; payload <= *maxPayload && payload <= *shmSize; payload *= 8 {
+		start := time.Now()
+		for i := range lat {
+			t0 := time.Now()
+			if err := parent.SendData(buf[:payload]); err != nil {
+				parent.Close()
+				log.Fatalf("[Go Parent] Send error: %v", err)
+			}
+			lat[i] = time.Since(t0)
+		}
+		elapsed := time.Since(start).Seconds()
+
+		slices.Sort(lat)
+		pct := func(q float64) float64 {
+			return float64(lat[int(q*float64(len(lat)-1)+0.5)]) / 1e3
+		}
+		n := float64(len(lat))
+		fmt.Printf("%-10d %-10d %-6s %8d %12.0f %9.3f %9.2f %9.2f %9.2f\n",
+			*shmSize, payload, "ping", len(lat), n/elapsed, n*float64(payload)/elapsed/1e9,
+			pct(0.50), pct(0.99), pct(0.999))
+	}
+}
+
 func runChild() {
 	fmt.Printf("[Go Child] Started with FDs: P2C(3,4,5) C2P(6,7,8)\n")
 
@@ -77,12 +178,13 @@ func runChild() {
 		log.Fatalf("[Go Child] Failed to create child: %v", err)
 	}
 	defer child.Close()
+	child.SetCompress(demoCompress())
 
 	// Start a goroutine to send data back
 	go func() {
 		for i := 0; i < 5; i++ {
 			time.Sleep(500 * time.Millisecond) // Wait a bit
-			msg := fmt.Sprintf("Hello from Go Child %d", i)
+			msg := demoMessage(fmt.Sprintf("Hello from Go Child %d", i), demoCompress())
 			fmt.Printf("[Go Child] Sending: %s\n", msg)
 			if err := child.SendData([]byte(msg)); err != nil {
 				log.Printf("[Go Child] Send error: %v", err)
@@ -7,14 +7,40 @@ use std::ptr::{self, NonNull};
 use std::slice;
 
 use nix::sys::eventfd::{EventFd, EfdFlags};
-use nix::sys::mman::{mmap, munmap, MapFlags, ProtFlags};
+use nix::sys::mman::{mmap, mprotect, munmap, MapFlags, ProtFlags};
 use nix::sys::memfd::{memfd_create, MFdFlags};
 use nix::unistd::ftruncate;
 use std::ffi::CString;
 
+use std::sync::Mutex;
+use std::sync::atomic::{AtomicU32, Ordering};
+
+use crate::lz4;
+
+// Handshake with a C parent in auto mode (shm_hello_t in efd.h): the parent
+// puts a hello at offset 0 of P2C, which we claim by moving its magic to
+// HELLO_CLAIMED, and waits for ours at offset 0 of C2P, signalled with
+// SIG_HELLO. This implementation only speaks standard mode.
+const HELLO_MAGIC: u32 = 0x4f4c4548; // "HELO"
+const HELLO_CLAIMED: u32 = 0x444d4c43; // "CLMD"
+const HELLO_VERSION: u32 = 1;
+const HELLO_SIZE: usize = 24;
+const SIG_HELLO: u64 = 1 << 61;
+
+/// Feature bit of LZ4-compressed messages.
+pub const FEAT_LZ4: u32 = 0x10;
+/// Feature bit of following memfds grown by the parent.
+pub const FEAT_RESIZE: u32 = 0x20;
+
+// Children sharing the FDs in one process hand-shake once, and the later
+// ones learn the parent's features from here
+static HANDSHAKE: Mutex<()> = Mutex::new(());
+static PEER_FEATURES: AtomicU32 = AtomicU32::new(0);
+
 pub struct ShmParent {
     child_path: String,
     shm_size: usize,
+    compress_min: usize,
 
     // Resources
     file_p2c_send: Option<File>,
@@ -37,6 +63,7 @@ impl ShmParent {
         Self {
             child_path: child_path.to_string(),
             shm_size,
+            compress_min: 0,
             file_p2c_send: None, file_p2c_ack: None, shm_p2c_file: None, shm_p2c_ptr: ptr::null_mut(),
             file_c2p_send: None, file_c2p_ack: None, shm_c2p_file: None, shm_c2p_ptr: ptr::null_mut(),
             child: None,
@@ -131,22 +158,21 @@ impl ShmParent {
         Ok(())
     }
 
+    /// Messages of at least min_size bytes are LZ4-compressed when that makes
+    /// them smaller (0 turns it off). Such a message only has to fit the
+    /// region compressed, and needs a peer that decodes it.
+    pub fn set_compress(&mut self, min_size: usize) {
+        self.compress_min = min_size;
+    }
+
     pub fn send_data(&mut self, data: &[u8]) -> std::io::Result<()> {
-        if data.len() > self.shm_size {
-            return Err(std::io::Error::new(std::io::ErrorKind::InvalidInput, "Data too large for SHM"));
-        }
         if self.shm_p2c_ptr.is_null() {
             return Err(std::io::Error::new(std::io::ErrorKind::Other, "Not started"));
         }
-
-        // Write to SHM
-        unsafe {
-            ptr::copy_nonoverlapping(data.as_ptr(), self.shm_p2c_ptr, data.len());
-        }
+        let len = write_message(self.shm_p2c_ptr, self.shm_size, self.compress_min, data)?;
 
         // Send Length
         if let Some(file_send) = &mut self.file_p2c_send {
-            let len = data.len() as u64;
             let bytes = len.to_ne_bytes();
             file_send.write_all(&bytes)?;
         }
@@ -166,20 +192,22 @@ impl ShmParent {
         }
 
         // Wait for Signal
-        let length = if let Some(file_read) = &mut self.file_c2p_send {
+        let val = if let Some(file_read) = &mut self.file_c2p_send {
             let mut buf = [0u8; 8];
             file_read.read_exact(&mut buf)?;
-            u64::from_ne_bytes(buf) as usize
+            u64::from_ne_bytes(buf)
         } else {
             return Err(std::io::Error::new(std::io::ErrorKind::Other, "Not started"));
         };
+        let length = (val & !lz4::SIG_LZ4) as usize;
 
         if length > self.shm_size {
             return Err(std::io::Error::new(std::io::ErrorKind::InvalidData, "Received length exceeds SHM size"));
         }
 
         // Read from SHM
-        let data = unsafe { slice::from_raw_parts(self.shm_c2p_ptr, length).to_vec() };
+        let shm = unsafe { slice::from_raw_parts(self.shm_c2p_ptr, length) };
+        let data = if val & lz4::SIG_LZ4 != 0 { lz4::unframe(shm) } else { Ok(shm.to_vec()) };
 
         // Send ACK
         if let Some(file_write) = &mut self.file_c2p_ack {
@@ -188,8 +216,50 @@ impl ShmParent {
             file_write.write_all(&bytes)?;
         }
 
-        Ok(data)
+        data
+    }
+}
+
+// Maps fd again at its current size, which must have grown to at least
+// need bytes, and unmaps the old mapping of size bytes at ptr.
+fn remap(fd: RawFd, ptr: *mut u8, size: usize, need: usize, prot: ProtFlags) -> std::io::Result<(*mut u8, usize)> {
+    let file = unsafe { File::from_raw_fd(fd) };
+    let meta = file.metadata();
+    let _ = file.into_raw_fd();
+    let new_size = meta?.len() as usize;
+    if new_size < need || new_size <= size {
+        return Err(std::io::Error::new(std::io::ErrorKind::InvalidInput, "Data too large for SHM"));
+    }
+
+    let borrowed = unsafe { BorrowedFd::borrow_raw(fd) };
+    let grown = unsafe {
+        mmap(None, std::num::NonZeroUsize::new(new_size).unwrap(), prot, MapFlags::MAP_SHARED, borrowed, 0)
+            .map_err(|e| std::io::Error::from_raw_os_error(e as i32))?
+    };
+    if let Some(old) = NonNull::new(ptr as *mut std::ffi::c_void) {
+        let _ = unsafe { munmap(old, size) };
+    }
+    Ok((grown.as_ptr() as *mut u8, new_size))
+}
+
+// Writes data at the start of a region, compressed if min_size allows and
+// it helps, and returns the value to signal for it.
+fn write_message(shm: *mut u8, shm_size: usize, min_size: usize, data: &[u8]) -> std::io::Result<u64> {
+    if min_size > 0 && data.len() >= min_size {
+        let region = unsafe { slice::from_raw_parts_mut(shm, shm_size) };
+        let n = lz4::frame(region, data);
+        if n > 0 {
+            return Ok(n as u64 | lz4::SIG_LZ4);
+        }
+    }
+
+    if data.len() > shm_size {
+        return Err(std::io::Error::new(std::io::ErrorKind::InvalidInput, "Data too large for SHM"));
     }
+    unsafe {
+        ptr::copy_nonoverlapping(data.as_ptr(), shm, data.len());
+    }
+    Ok(data.len() as u64)
 }
 
 impl Drop for ShmParent {
@@ -221,7 +291,10 @@ pub struct ShmChild {
     fd_c2p_send: RawFd,
     fd_c2p_ack: RawFd,
     fd_c2p_shm: RawFd,
-    shm_size: usize,
+    shm_size: usize, // Mapped bytes of P2C
+    c2p_size: usize, // Mapped bytes of C2P; both grow after a resize
+    compress_min: usize,
+    peer_features: u32,
     shm_p2c_ptr: *mut u8,
     shm_c2p_ptr: *mut u8,
 }
@@ -236,6 +309,9 @@ impl ShmChild {
             fd_p2c_send, fd_p2c_ack, fd_p2c_shm,
             fd_c2p_send, fd_c2p_ack, fd_c2p_shm,
             shm_size, 
+            c2p_size: shm_size,
+            compress_min: 0,
+            peer_features: 0,
             shm_p2c_ptr: ptr::null_mut(),
             shm_c2p_ptr: ptr::null_mut(),
         }
@@ -260,7 +336,70 @@ impl ShmChild {
         };
         self.shm_c2p_ptr = ptr_c2p.as_ptr() as *mut u8;
 
-        Ok(())
+        self.handshake()
+    }
+
+    // Answers a parent in auto mode, which lays out the memfds for standard
+    // mode once it has our hello and then lets us go on.
+    fn handshake(&mut self) -> std::io::Result<()> {
+        let _guard = HANDSHAKE.lock().unwrap_or_else(|e| e.into_inner());
+
+        let p2c = unsafe { slice::from_raw_parts(self.shm_p2c_ptr, self.shm_size.min(HELLO_SIZE)) };
+        if p2c.len() < HELLO_SIZE || u32::from_le_bytes([p2c[0], p2c[1], p2c[2], p2c[3]]) != HELLO_MAGIC {
+            self.peer_features = PEER_FEATURES.load(Ordering::Relaxed);
+            return Ok(());
+        }
+
+        // Claim the parent's hello, unless it has given up waiting for ours.
+        // It is the only word of P2C we write.
+        let addr = NonNull::new(self.shm_p2c_ptr as *mut std::ffi::c_void).unwrap();
+        unsafe { mprotect(addr, HELLO_SIZE, ProtFlags::PROT_READ | ProtFlags::PROT_WRITE) }
+            .map_err(std::io::Error::from)?;
+        let claim = unsafe { &*(self.shm_p2c_ptr as *const AtomicU32) };
+        let claimed = claim.compare_exchange(HELLO_MAGIC, HELLO_CLAIMED, Ordering::SeqCst, Ordering::SeqCst).is_ok();
+        let _ = unsafe { mprotect(addr, HELLO_SIZE, ProtFlags::PROT_READ) };
+        if !claimed {
+            return Ok(());
+        }
+        self.peer_features = u32::from_le_bytes([p2c[8], p2c[9], p2c[10], p2c[11]]);
+        PEER_FEATURES.store(self.peer_features, Ordering::Relaxed);
+
+        let hello = unsafe { slice::from_raw_parts_mut(self.shm_c2p_ptr, HELLO_SIZE) };
+        hello.fill(0);
+        hello[0..4].copy_from_slice(&HELLO_MAGIC.to_le_bytes());
+        hello[4..8].copy_from_slice(&HELLO_VERSION.to_le_bytes());
+        hello[8..12].copy_from_slice(&(FEAT_LZ4 | FEAT_RESIZE).to_le_bytes());
+        hello[16..24].copy_from_slice(&(self.shm_size as u64).to_le_bytes());
+
+        let mut file_send = unsafe { File::from_raw_fd(self.fd_c2p_send) };
+        let sent = file_send.write_all(&SIG_HELLO.to_ne_bytes());
+        let _ = file_send.into_raw_fd();
+        sent?;
+
+        // Acked like a message, so that the first real one does not add up with it
+        let mut file_read = unsafe { File::from_raw_fd(self.fd_p2c_send) };
+        let mut buf = [0u8; 8];
+        let read = file_read.read_exact(&mut buf);
+        let _ = file_read.into_raw_fd();
+        read?;
+        if u64::from_ne_bytes(buf) & SIG_HELLO == 0 {
+            return Err(std::io::Error::new(std::io::ErrorKind::InvalidData, "Unexpected signal from parent"));
+        }
+
+        let mut file_ack = unsafe { File::from_raw_fd(self.fd_p2c_ack) };
+        let acked = file_ack.write_all(&1u64.to_ne_bytes());
+        let _ = file_ack.into_raw_fd();
+        acked
+    }
+
+    /// Feature bits the parent announced in the handshake, 0 if there was none.
+    pub fn peer_features(&self) -> u32 {
+        self.peer_features
+    }
+
+    /// Same as ShmParent::set_compress, for C2P.
+    pub fn set_compress(&mut self, min_size: usize) {
+        self.compress_min = min_size;
     }
 
     pub fn listen<F>(&mut self, callback: F) -> std::io::Result<()>
@@ -278,15 +417,29 @@ impl ShmChild {
             let mut buf = [0u8; 8];
             match file_read.read_exact(&mut buf) {
                 Ok(_) => {
-                    let length = u64::from_ne_bytes(buf) as usize;
+                    let val = u64::from_ne_bytes(buf);
+                    let length = (val & !lz4::SIG_LZ4) as usize;
+                    // A C parent may have grown the memfd (shm_parent_resize)
                     if length > self.shm_size {
-                        eprintln!("Received length {} exceeds SHM size {}", length, self.shm_size);
-                        continue;
+                        match remap(self.fd_p2c_shm, self.shm_p2c_ptr, self.shm_size, length, ProtFlags::PROT_READ) {
+                            Ok((ptr, size)) => (self.shm_p2c_ptr, self.shm_size) = (ptr, size),
+                            Err(_) => {
+                                eprintln!("Received length {} exceeds SHM size {}", length, self.shm_size);
+                                continue;
+                            }
+                        }
                     }
 
                     // Read from SHM
                     let data = unsafe { slice::from_raw_parts(self.shm_p2c_ptr, length) };
-                    callback(data);
+                    if val & lz4::SIG_LZ4 == 0 {
+                        callback(data);
+                    } else {
+                        match lz4::unframe(data) {
+                            Ok(raw) => callback(&raw),
+                            Err(e) => eprintln!("{}", e),
+                        }
+                    }
 
                     // Send Ack (1)
                     let ack_val: u64 = 1;
@@ -302,18 +455,19 @@ impl ShmChild {
         if self.shm_c2p_ptr.is_null() {
             self.init()?;
         }
-        if data.len() > self.shm_size {
-            return Err(std::io::Error::new(std::io::ErrorKind::InvalidInput, "Data too large for SHM"));
-        }
-
-        // Write to SHM
-        unsafe {
-            ptr::copy_nonoverlapping(data.as_ptr(), self.shm_c2p_ptr, data.len());
+        let peer_lz4 = self.peer_features == 0 || self.peer_features & FEAT_LZ4 != 0;
+        let min_size = if peer_lz4 { self.compress_min } else { 0 };
+        // The parent may have grown the memfd (shm_parent_resize)
+        if data.len() > self.c2p_size {
+            if let Ok((ptr, size)) = remap(self.fd_c2p_shm, self.shm_c2p_ptr, self.c2p_size, data.len(),
+                                           ProtFlags::PROT_READ | ProtFlags::PROT_WRITE) {
+                (self.shm_c2p_ptr, self.c2p_size) = (ptr, size);
+            }
         }
+        let len = write_message(self.shm_c2p_ptr, self.c2p_size, min_size, data)?;
 
         // Send Length
         let mut file_send = unsafe { File::from_raw_fd(self.fd_c2p_send) };
-        let len = data.len() as u64;
         let bytes = len.to_ne_bytes();
         file_send.write_all(&bytes)?;
         // Prevent closing fd when file_send drops
@@ -341,7 +495,7 @@ impl Drop for ShmChild {
         if !self.shm_c2p_ptr.is_null() {
             unsafe {
                 if let Some(ptr) = NonNull::new(self.shm_c2p_ptr as *mut std::ffi::c_void) {
-                    let _ = munmap(ptr, self.shm_size);
+                    let _ = munmap(ptr, self.c2p_size);
                 }
             }
         }
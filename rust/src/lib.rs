@@ -1,3 +1,4 @@
 pub mod efd;
+mod lz4;
 pub use efd::{ShmParent, ShmChild};
 
@@ -0,0 +1,278 @@
+// LZ4 block codec for compressed messages, as the C library sends them:
+// the eventfd value has SIG_LZ4 set and the region holds a frame of the raw
+// length (4 bytes little endian), 4 zero bytes and one LZ4 block.
+
+pub const SIG_LZ4: u64 = 1 << 62;
+
+const HDR_SIZE: usize = 8;
+const HASH_BITS: u32 = 12;
+const MIN_MATCH: usize = 4;
+const LAST_LITERALS: usize = 5;
+const MFLIMIT: usize = 12;
+const MAX_OFFSET: usize = 65535;
+const MAX_INPUT: usize = 0x7E00_0000;
+
+fn read32(src: &[u8], i: usize) -> u32 {
+    u32::from_le_bytes([src[i], src[i + 1], src[i + 2], src[i + 3]])
+}
+
+fn hash(v: u32) -> usize {
+    (v.wrapping_mul(2654435761) >> (32 - HASH_BITS)) as usize
+}
+
+fn put_len(dst: &mut Vec<u8>, mut n: usize) {
+    while n >= 255 {
+        dst.push(255);
+        n -= 255;
+    }
+    dst.push(n as u8);
+}
+
+fn token(lit: usize, mlen: usize) -> u8 {
+    (lit.min(15) << 4 | mlen.min(15)) as u8
+}
+
+/// Compresses src into one block, or None once it would exceed limit bytes.
+fn compress(src: &[u8], limit: usize) -> Option<Vec<u8>> {
+    let n = src.len();
+    let mut dst = Vec::with_capacity(limit);
+    let (mut anchor, mut ip) = (0usize, 0usize);
+
+    if n >= MFLIMIT + 1 {
+        let mut table = [0u32; 1 << HASH_BITS];
+        let (mflimit, match_limit) = (n - MFLIMIT, n - LAST_LITERALS);
+
+        while ip <= mflimit {
+            let seq = read32(src, ip);
+            let h = hash(seq);
+            let mut r = table[h] as usize;
+            table[h] = ip as u32;
+            if r >= ip || ip - r > MAX_OFFSET || read32(src, r) != seq {
+                // Skip faster through data that does not match
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            while ip > anchor && r > 0 && src[ip - 1] == src[r - 1] {
+                ip -= 1;
+                r -= 1;
+            }
+            let (mut mp, mut rp) = (ip + MIN_MATCH, r + MIN_MATCH);
+            while mp < match_limit && src[mp] == src[rp] {
+                mp += 1;
+                rp += 1;
+            }
+
+            let (lit, mlen) = (ip - anchor, mp - ip - MIN_MATCH);
+            if dst.len() + lit / 255 + lit + mlen / 255 + 5 > limit {
+                return None;
+            }
+            dst.push(token(lit, mlen));
+            if lit >= 15 {
+                put_len(&mut dst, lit - 15);
+            }
+            dst.extend_from_slice(&src[anchor..ip]);
+            dst.extend_from_slice(&((ip - r) as u16).to_le_bytes());
+            if mlen >= 15 {
+                put_len(&mut dst, mlen - 15);
+            }
+
+            ip = mp;
+            anchor = mp;
+            if ip <= mflimit {
+                table[hash(read32(src, ip - 2))] = (ip - 2) as u32;
+            }
+        }
+    }
+
+    let lit = n - anchor;
+    if dst.len() + lit / 255 + lit + 2 > limit {
+        return None;
+    }
+    dst.push(token(lit, 0));
+    if lit >= 15 {
+        put_len(&mut dst, lit - 15);
+    }
+    dst.extend_from_slice(&src[anchor..]);
+    Some(dst)
+}
+
+fn get_len(src: &[u8], ip: &mut usize, n: &mut usize) -> Option<()> {
+    loop {
+        let b = *src.get(*ip)?;
+        *ip += 1;
+        *n += b as usize;
+        if b != 255 {
+            return Some(());
+        }
+    }
+}
+
+/// Decodes a block that must expand to exactly raw bytes.
+fn decompress(src: &[u8], raw: usize) -> Option<Vec<u8>> {
+    let mut dst: Vec<u8> = Vec::with_capacity(raw);
+    let mut ip = 0usize;
+
+    while ip < src.len() {
+        let token = src[ip];
+        ip += 1;
+        let mut lit = (token >> 4) as usize;
+        if lit == 15 {
+            get_len(src, &mut ip, &mut lit)?;
+        }
+        if lit > src.len() - ip || lit > raw - dst.len() {
+            return None;
+        }
+        dst.extend_from_slice(&src[ip..ip + lit]);
+        ip += lit;
+        if ip == src.len() {
+            break; // The last sequence has no match
+        }
+
+        if src.len() - ip < 2 {
+            return None;
+        }
+        let off = u16::from_le_bytes([src[ip], src[ip + 1]]) as usize;
+        ip += 2;
+        if off == 0 || off > dst.len() {
+            return None;
+        }
+
+        let mut mlen = (token & 15) as usize;
+        if mlen == 15 {
+            get_len(src, &mut ip, &mut mlen)?;
+        }
+        mlen += MIN_MATCH;
+        if mlen > raw - dst.len() {
+            return None;
+        }
+
+        // Overlapping matches repeat the last off bytes
+        let m = dst.len() - off;
+        for i in 0..mlen {
+            dst.push(dst[m + i]);
+        }
+    }
+
+    if dst.len() == raw { Some(dst) } else { None }
+}
+
+/// Writes data as a frame into dst, which bounds its size, and returns the
+/// frame size, or 0 when that would not be smaller than data itself.
+pub fn frame(dst: &mut [u8], data: &[u8]) -> usize {
+    let cap = dst.len().min(data.len().saturating_sub(1));
+    if data.is_empty() || data.len() > MAX_INPUT || cap <= HDR_SIZE {
+        return 0;
+    }
+
+    match compress(data, cap - HDR_SIZE) {
+        Some(block) => {
+            dst[..4].copy_from_slice(&(data.len() as u32).to_le_bytes());
+            dst[4..HDR_SIZE].fill(0);
+            dst[HDR_SIZE..HDR_SIZE + block.len()].copy_from_slice(&block);
+            HDR_SIZE + block.len()
+        }
+        None => 0,
+    }
+}
+
+/// Decodes a frame received in shared memory.
+pub fn unframe(frame: &[u8]) -> std::io::Result<Vec<u8>> {
+    let corrupt = || std::io::Error::new(std::io::ErrorKind::InvalidData,
+        format!("Corrupt LZ4 frame of {} bytes", frame.len()));
+    if frame.len() < HDR_SIZE {
+        return Err(corrupt());
+    }
+    let raw = u32::from_le_bytes([frame[0], frame[1], frame[2], frame[3]]) as usize;
+    if raw > MAX_INPUT {
+        return Err(corrupt());
+    }
+    decompress(&frame[HDR_SIZE..], raw).ok_or_else(corrupt)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    // Shared with the C and Go tests
+    const GOLDEN: &str = include_str!("../../testdata/lz4_golden.txt");
+
+    struct Vector {
+        name: String,
+        input: Vec<u8>,
+        frame: Option<Vec<u8>>, // None when the input does not compress
+    }
+
+    fn unhex(hex: &str) -> Vec<u8> {
+        (0..hex.len()).step_by(2).map(|i| u8::from_str_radix(&hex[i..i + 2], 16).unwrap()).collect()
+    }
+
+    fn golden() -> Vec<Vector> {
+        let vecs: Vec<Vector> = GOLDEN
+            .lines()
+            .filter(|line| !line.starts_with('#'))
+            .filter_map(|line| {
+                let fields: Vec<&str> = line.split_whitespace().collect();
+                if fields.len() != 3 {
+                    return None;
+                }
+                Some(Vector {
+                    name: fields[0].to_string(),
+                    input: unhex(fields[1]),
+                    frame: if fields[2] == "-" { None } else { Some(unhex(fields[2])) },
+                })
+            })
+            .collect();
+        assert!(!vecs.is_empty());
+        vecs
+    }
+
+    #[test]
+    fn golden_frames() {
+        for v in golden() {
+            let mut dst = vec![0u8; v.input.len()];
+            let n = frame(&mut dst, &v.input);
+            assert_eq!(&dst[..n], v.frame.as_deref().unwrap_or(&[]), "{}: frame", v.name);
+            if let Some(f) = &v.frame {
+                assert_eq!(unframe(f).unwrap(), v.input, "{}: decoded", v.name);
+            }
+        }
+    }
+
+    #[test]
+    fn corrupt_frames() {
+        for v in golden() {
+            let Some(f) = &v.frame else { continue };
+            let mut raw = f.clone();
+            raw[0] = raw[0].wrapping_add(1);
+            assert!(unframe(&f[..f.len() - 1]).is_err(), "{}: truncated frame decoded", v.name);
+            assert!(unframe(&f[..HDR_SIZE - 1]).is_err(), "{}: short header decoded", v.name);
+            assert!(unframe(&raw).is_err(), "{}: wrong raw length decoded", v.name);
+        }
+    }
+
+    #[test]
+    fn round_trip() {
+        let mut seed = 1u32;
+        let mut next = || {
+            seed = seed.wrapping_mul(1103515245).wrapping_add(12345);
+            (seed >> 16) as usize
+        };
+        for i in 0..2000 {
+            let len = 1 + next() % 4000;
+            let data: Vec<u8> = (0..len)
+                .map(|j| if i % 2 == 0 { b"efdstream "[j % 10] } else { next() as u8 })
+                .collect();
+
+            let mut dst = vec![0u8; len];
+            let n = frame(&mut dst, &data);
+            if n == 0 {
+                // Random bytes do not compress, a repeated word does once it is long enough
+                assert!(i % 2 == 1 || len < 64, "{} bytes of text did not compress", len);
+                continue;
+            }
+            assert!(n < len);
+            assert_eq!(unframe(&dst[..n]).unwrap(), data, "round trip of {} bytes", len);
+        }
+    }
+}
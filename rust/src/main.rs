@@ -1,9 +1,32 @@
 use std::env;
+use std::io::Write;
 use std::thread;
-use std::time::Duration;
+use std::time::{Duration, Instant};
 
 use efdstream::{ShmParent, ShmChild};
 
+// Both sides LZ4-compress sends of at least this many bytes, and repeat the
+// text of every demo message up to that size so it compresses. An
+// environment variable, since the parent does not pass its flags on.
+const ENV_COMPRESS: &str = "EFDSTREAM_COMPRESS";
+
+fn demo_compress() -> usize {
+    env::var(ENV_COMPRESS).ok().and_then(|v| v.parse().ok()).unwrap_or(0)
+}
+
+// The text alone, or followed by a space and repeated until min bytes
+fn demo_message(text: &str, min: usize) -> String {
+    if min == 0 {
+        return text.to_string();
+    }
+    let mut msg = String::new();
+    while msg.len() < min {
+        msg.push_str(text);
+        msg.push(' ');
+    }
+    msg
+}
+
 fn main() {
     let args: Vec<String> = env::args().collect();
     
@@ -18,6 +41,8 @@ fn main() {
     let mut fd_c2p_shm = 8;
 
     let mut shm_size = 1024 * 1024;
+    let mut iters = 0;
+    let mut max_payload = 65536;
 
     let mut i = 1;
     while i < args.len() {
@@ -39,11 +64,17 @@ fn main() {
             if i + 1 < args.len() { fd_c2p_shm = args[i+1].parse().unwrap_or(8); i += 1; }
         } else if args[i] == "-shm-size" || args[i] == "--shm-size" {
             if i + 1 < args.len() { shm_size = args[i+1].parse().unwrap_or(1024 * 1024); i += 1; }
+        } else if args[i] == "-iters" || args[i] == "--iters" {
+            if i + 1 < args.len() { iters = args[i+1].parse().unwrap_or(0); i += 1; }
+        } else if args[i] == "-max-payload" || args[i] == "--max-payload" {
+            if i + 1 < args.len() { max_payload = args[i+1].parse().unwrap_or(65536); i += 1; }
         }
         i += 1;
     }
 
-    if mode == "parent" {
+    if mode == "parent" && iters > 0 {
+        run_bench(&child_path, shm_size, iters, max_payload);
+    } else if mode == "parent" {
         run_parent(&child_path, shm_size);
     } else {
         run_child(fd_p2c_send, fd_p2c_ack, fd_p2c_shm, fd_c2p_send, fd_c2p_ack, fd_c2p_shm, shm_size);
@@ -58,13 +89,14 @@ fn run_parent(child_path: &str, shm_size: usize) {
 
     // FDs are now auto-generated and mapped to 3, 4, 5, 6, 7, 8 in the child.
     let mut parent = ShmParent::new(child_path, shm_size);
+    parent.set_compress(demo_compress());
     parent.start().expect("Failed to start parent");
 
     println!("[Rust Parent] Child started");
 
     for i in 0..5 {
         // Send
-        let msg = format!("Hello from Rust Parent {}", i);
+        let msg = demo_message(&format!("Hello from Rust Parent {}", i), demo_compress());
         println!("[Rust Parent] Sending: {}", msg);
         parent.send_data(msg.as_bytes()).expect("Communication error");
         println!("[Rust Parent] Received ACK");
@@ -82,6 +114,66 @@ fn run_parent(child_path: &str, shm_size: usize) {
     }
 }
 
+// Starts the child with its stdout on /dev/null, since it prints every
+// message it receives.
+fn start_quiet(parent: &mut ShmParent) -> std::io::Result<()> {
+    std::io::stdout().flush()?;
+    let devnull = std::fs::OpenOptions::new().write(true).open("/dev/null")?;
+    unsafe {
+        use std::os::unix::io::AsRawFd;
+        let saved = libc::dup(libc::STDOUT_FILENO);
+        if saved == -1 {
+            return Err(std::io::Error::last_os_error());
+        }
+        libc::dup2(devnull.as_raw_fd(), libc::STDOUT_FILENO);
+        let res = parent.start();
+        libc::dup2(saved, libc::STDOUT_FILENO);
+        libc::close(saved);
+        res
+    }
+}
+
+// Times iters send_data calls, each a round trip to the child's ack, per
+// payload size from 8 bytes up to max_payload, and prints them in the
+// layout of efdstream_bench.
+fn run_bench(child_path: &str, shm_size: usize, iters: usize, max_payload: usize) {
+    if child_path.is_empty() {
+        eprintln!("Child path is required in parent mode");
+        std::process::exit(1);
+    }
+
+    let mut parent = ShmParent::new(child_path, shm_size);
+    start_quiet(&mut parent).expect("Failed to start parent");
+
+    println!("{:<10} {:<10} {:<6} {:>8} {:>12} {:>9} {:>9} {:>9} {:>9}",
+        "shm_size", "payload", "test", "msgs", "msgs/s", "GB/s", "p50_us", "p99_us", "p999_us");
+
+    let buf = vec![0xabu8; max_payload];
+    let mut lat = vec![Duration::ZERO; iters];
+    let mut payload = 8;
+    while payload <= max_payload && payload <= shm_size {
+        let start = Instant::now();
+        for l in lat.iter_mut() {
+            let t0 = Instant::now();
+            if let Err(e) = parent.send_data(&buf[..payload]) {
+                eprintln!("[Rust Parent] Send error: {}", e);
+                drop(parent);
+                std::process::exit(1);
+            }
+            *l = t0.elapsed();
+        }
+        let secs = start.elapsed().as_secs_f64();
+
+        lat.sort();
+        let pct = |q: f64| lat[(q * (iters - 1) as f64 + 0.5) as usize].as_nanos() as f64 / 1e3;
+        let n = iters as f64;
+        println!("{:<10} {:<10} {:<6} {:>8} {:>12.0} {:>9.3} {:>9.2} {:>9.2} {:>9.2}",
+            shm_size, payload, "ping", iters, n / secs, n * payload as f64 / secs / 1e9,
+            pct(0.50), pct(0.99), pct(0.999));
+        payload *= 8;
+    }
+}
+
 fn run_child(fd_p2c_send: i32, fd_p2c_ack: i32, fd_p2c_shm: i32,
              fd_c2p_send: i32, fd_c2p_ack: i32, fd_c2p_shm: i32,
              shm_size: usize) {
@@ -104,11 +196,12 @@ fn run_child(fd_p2c_send: i32, fd_p2c_ack: i32, fd_p2c_shm: i32,
         fd_p2c_send, fd_p2c_ack, fd_p2c_shm,
         fd_c2p_send, fd_c2p_ack, fd_c2p_shm,
         shm_size);
+    child_sender.set_compress(demo_compress());
     
     thread::spawn(move || {
         for i in 0..5 {
             thread::sleep(Duration::from_millis(500));
-            let msg = format!("Hello from Rust Child {}", i);
+            let msg = demo_message(&format!("Hello from Rust Child {}", i), demo_compress());
             println!("[Rust Child] Sending: {}", msg);
             if let Err(e) = child_sender.send_data(msg.as_bytes()) {
                 println!("[Rust Child] Send error: {}", e);